@@ -0,0 +1,286 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file bench_ini.cpp Scaling benchmark for IniFile operations.
+
+  Synthetic INI files are generated with different numbers of sections and
+  keys, short or long values and ASCII or non-Latin (Greek and Cyrillic) names.
+  For each file, every operation is timed:
+  - cold: first call on a newly created IniFile object (includes building
+    the index of the file)
+  - warm: subsequent calls on the same object, on random sections and keys
+
+  Results are written as JSON on standard output or in the file given with
+  `--out`. File opens and bytes read and written per operation come from the
+  IniStats counters.
+
+  Usage:
+    bench_ini [--max-keys N] [--values short|long|both] [--names ascii|other|both]
+              [--budget milliseconds] [--out file.json]
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <utf8/ini.h>
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+/// Shape of a generated file
+struct shape {
+  size_t sections;
+  size_t keys;        ///< keys per section
+  bool long_values;
+  bool ascii_names;
+};
+
+/// Result of timing one operation on one file
+struct result {
+  string op;
+  double cold_ns;
+  double warm_ns;     ///< mean time of warm calls
+  size_t warm_calls;
+  double opens;       ///< file opens per warm call
+  double bytes_read;  ///< bytes read per warm call
+  double bytes_written; ///< bytes written per warm call
+};
+
+static const char* INI_NAME = "bench_ini.ini";
+static milliseconds budget (250);   //time spent on warm calls of each operation
+static const size_t MAX_WARM_CALLS = 100000;
+
+/// Simple deterministic random generator (LCG)
+static uint32_t rnd ()
+{
+  static uint64_t state = 0x2545F4914F6CDD1DULL;
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (uint32_t)(state >> 33);
+}
+
+static string section_name (const shape& s, size_t i)
+{
+  return (s.ascii_names ? "Section_" : "Τμήμα_") + to_string (i);
+}
+
+static string key_name (const shape& s, size_t i)
+{
+  return (s.ascii_names ? "key_" : "ключ_") + to_string (i);
+}
+
+static string value (const shape& s, size_t i)
+{
+  string v = "value " + to_string (i);
+  if (s.long_values)
+    v.append (200, 'x');
+  return v;
+}
+
+/// Write the INI file of a shape
+static bool generate (const shape& s)
+{
+  FILE* f = utf8::fopen (INI_NAME, "wb");
+  if (!f)
+    return false;
+  for (size_t i = 0; i < s.sections; i++)
+  {
+    fprintf (f, "[%s]\n", section_name (s, i).c_str ());
+    for (size_t j = 0; j < s.keys; j++)
+      fprintf (f, "%s=%s\n", key_name (s, j).c_str (), value (s, j).c_str ());
+  }
+  return fclose (f) == 0;
+}
+
+/*
+  Time an operation. The function is called with the call number; the first
+  call is made on a new IniFile object.
+*/
+static result measure (const string& name, const function<void (utf8::IniFile&, size_t)>& op)
+{
+  result r{ name, 0, 0, 0, 0, 0, 0 };
+  utf8::IniFile ini (INI_NAME);
+
+  auto t0 = steady_clock::now ();
+  op (ini, 0);
+  r.cold_ns = (double)duration_cast<nanoseconds> (steady_clock::now () - t0).count ();
+
+  auto before = utf8::IniFile::global_stats ();
+  auto start = steady_clock::now ();
+  auto end = start;
+  do
+  {
+    op (ini, ++r.warm_calls);
+    end = steady_clock::now ();
+  } while (end - start < budget && r.warm_calls < MAX_WARM_CALLS);
+  auto after = utf8::IniFile::global_stats ();
+
+  double n = (double)r.warm_calls;
+  r.warm_ns = duration_cast<nanoseconds> (end - start).count () / n;
+  r.opens = (after.opens - before.opens) / n;
+  r.bytes_read = (after.bytes_read - before.bytes_read) / n;
+  r.bytes_written = (after.bytes_written - before.bytes_written) / n;
+  return r;
+}
+
+/// Run all operations on a file
+static vector<result> run (const shape& s)
+{
+  vector<result> results;
+
+  results.push_back (measure ("GetString", [&s] (utf8::IniFile& ini, size_t) {
+    ini.GetString (key_name (s, rnd () % s.keys), section_name (s, rnd () % s.sections));
+  }));
+  results.push_back (measure ("HasKey", [&s] (utf8::IniFile& ini, size_t) {
+    ini.HasKey (key_name (s, rnd () % s.keys), section_name (s, rnd () % s.sections));
+  }));
+  results.push_back (measure ("GetKeys", [&s] (utf8::IniFile& ini, size_t) {
+    deque<string> keys;
+    ini.GetKeys (keys, section_name (s, rnd () % s.sections));
+  }));
+  results.push_back (measure ("GetSections", [] (utf8::IniFile& ini, size_t) {
+    deque<string> sections;
+    ini.GetSections (sections);
+  }));
+
+  //operations that change the file
+  results.push_back (measure ("PutString", [&s] (utf8::IniFile& ini, size_t i) {
+    ini.PutString (key_name (s, rnd () % s.keys), "new value " + to_string (i),
+                   section_name (s, rnd () % s.sections));
+  }));
+  results.push_back (measure ("CopySection", [&s] (utf8::IniFile& ini, size_t i) {
+    ini.CopySection (ini, section_name (s, rnd () % s.sections), "Copy_" + to_string (i));
+  }));
+  results.push_back (measure ("DeleteKey", [&s] (utf8::IniFile& ini, size_t i) {
+    //delete keys in order so that each call removes an existing key
+    ini.DeleteKey (key_name (s, i % s.keys), section_name (s, i / s.keys % s.sections));
+  }));
+  return results;
+}
+
+static void print (ostream& os, const shape& s, uint64_t size, const vector<result>& results, bool& first)
+{
+  for (auto& r : results)
+  {
+    os << (first ? "\n" : ",\n");
+    first = false;
+    os << "    {\"sections\": " << s.sections
+       << ", \"keys_per_section\": " << s.keys
+       << ", \"values\": \"" << (s.long_values ? "long" : "short") << '"'
+       << ", \"names\": \"" << (s.ascii_names ? "ascii" : "other") << '"'
+       << ", \"file_size\": " << size
+       << ", \"op\": \"" << r.op << '"'
+       << ", \"cold_ns\": " << r.cold_ns
+       << ", \"warm_ns\": " << r.warm_ns
+       << ", \"warm_calls\": " << r.warm_calls
+       << ", \"ops_per_sec\": " << (r.warm_ns ? 1e9 / r.warm_ns : 0)
+       << ", \"opens_per_op\": " << r.opens
+       << ", \"bytes_read_per_op\": " << r.bytes_read
+       << ", \"bytes_written_per_op\": " << r.bytes_written
+       << "}";
+  }
+}
+
+static void usage ()
+{
+  cerr << "Usage: bench_ini [--max-keys N] [--values short|long|both] "
+          "[--names ascii|other|both] [--budget milliseconds] [--out file.json]\n";
+}
+
+int main (int argc, char** argv)
+{
+  size_t max_keys = 1000000;
+  string values = "both", names = "both", out;
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 == argc)
+    {
+      usage ();
+      return 1;
+    }
+    if (!strcmp (argv[i], "--max-keys"))
+      max_keys = strtoul (argv[++i], nullptr, 10);
+    else if (!strcmp (argv[i], "--values"))
+      values = argv[++i];
+    else if (!strcmp (argv[i], "--names"))
+      names = argv[++i];
+    else if (!strcmp (argv[i], "--budget"))
+      budget = milliseconds (strtoul (argv[++i], nullptr, 10));
+    else if (!strcmp (argv[i], "--out"))
+      out = argv[++i];
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  //sections x keys per section
+  const size_t sizes[][2] = {
+    { 10, 1 }, { 10, 100 }, { 1000, 10 }, { 1000, 1000 }, { 100000, 1 }, { 100000, 10 }
+  };
+
+  ostringstream os;
+  os << "{\n  \"benchmark\": \"ini\",\n  \"results\": [";
+  bool first = true;
+  for (auto& sz : sizes)
+  {
+    if (sz[0] * sz[1] > max_keys)
+      continue;
+    for (int v = 0; v < 2; v++)
+    {
+      if ((v == 0 && values == "long") || (v == 1 && values == "short"))
+        continue;
+      for (int n = 0; n < 2; n++)
+      {
+        if ((n == 0 && names == "other") || (n == 1 && names == "ascii"))
+          continue;
+        shape s{ sz[0], sz[1], v == 1, n == 0 };
+        if (!generate (s))
+        {
+          cerr << "Cannot create " << INI_NAME << '\n';
+          return 2;
+        }
+        uint64_t size = 0;
+        FILE* f = utf8::fopen (INI_NAME, "rb");
+        if (f)
+        {
+          fseek (f, 0, SEEK_END);
+          size = ftell (f);
+          fclose (f);
+        }
+        cerr << s.sections << " sections x " << s.keys << " keys, "
+             << (s.long_values ? "long" : "short") << " values, "
+             << (s.ascii_names ? "ASCII" : "non-Latin") << " names\n";
+        print (os, s, size, run (s), first);
+      }
+    }
+  }
+  os << "\n  ]\n}\n";
+  utf8::remove (INI_NAME);
+
+  if (out.empty ())
+    cout << os.str ();
+  else
+  {
+    utf8::ofstream json (out);
+    json << os.str ();
+    if (!json)
+    {
+      cerr << "Cannot write " << out << '\n';
+      return 2;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,389 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file bench_utf8.cpp Benchmark for conversion and classification functions.
+
+  A corpus of random text is generated for each kind of script: ASCII,
+  Latin-1 supplement, Greek and Cyrillic, CJK, emoji, a mix of all of them and
+  the mix with invalid bytes injected. Each function is called repeatedly on
+  the whole corpus and the best time is used to compute the throughput in
+  GB/s (relative to the size of the UTF-8 text) and cycles per byte.
+
+  Cycles are counted with the CPU cycles hardware counter (perf_event_open)
+  if `--perf` option is given and the counter is available. Otherwise, on x86
+  processors, the time stamp counter is used.
+
+  Usage:
+    bench_utf8 [--size kilobytes] [--budget milliseconds] [--perf]
+               [--format json|csv] [--out file]
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAVE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+/// Range of code points used to generate a corpus
+struct cp_range {
+  char32_t first;
+  char32_t last;
+};
+
+/// Kind of corpus
+struct corpus_kind {
+  const char* name;
+  vector<cp_range> ranges;
+  bool invalid;       ///< inject invalid bytes
+};
+
+/// Result of timing one function on one corpus
+struct result {
+  string corpus;
+  string function;
+  size_t bytes;       ///< size of UTF-8 text processed in one call
+  double best_ns;     ///< best time of one call
+  double cycles;      ///< cycles of best call (0 if not available)
+};
+
+static milliseconds budget (200);   //time spent on each function
+static const int MIN_CALLS = 3;
+
+/// Simple deterministic random generator (LCG)
+static uint32_t rnd ()
+{
+  static uint64_t state = 0x2545F4914F6CDD1DULL;
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (uint32_t)(state >> 33);
+}
+
+/*
+  Generate about `size` bytes of text. Words of 1 to 10 characters are
+  separated by spaces; some characters are digits.
+*/
+static string generate (const corpus_kind& kind, size_t size)
+{
+  string text;
+  text.reserve (size + 16);
+  while (text.size () < size)
+  {
+    size_t word = rnd () % 10 + 1;
+    for (size_t i = 0; i < word; i++)
+    {
+      if (rnd () % 16 == 0)
+        text.push_back ((char)('0' + rnd () % 10));
+      else
+      {
+        auto& r = kind.ranges[rnd () % kind.ranges.size ()];
+        text += utf8::narrow ((char32_t)(r.first + rnd () % (r.last - r.first + 1)));
+      }
+      if (kind.invalid && rnd () % 64 == 0)
+      {
+        //stray continuation byte, overlong lead byte or invalid byte
+        static const char bad[] = { '\x80', '\xC0', '\xFF' };
+        text.push_back (bad[rnd () % 3]);
+      }
+    }
+    text.push_back (' ');
+  }
+  return text;
+}
+
+/// CPU cycles counter
+class cycle_counter {
+public:
+  cycle_counter (bool use_perf)
+  {
+#ifdef __linux__
+    if (use_perf)
+    {
+      perf_event_attr attr;
+      memset (&attr, 0, sizeof (attr));
+      attr.size = sizeof (attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd = (int)syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+  }
+
+  ~cycle_counter ()
+  {
+#ifdef __linux__
+    if (fd >= 0)
+      close (fd);
+#endif
+  }
+
+  /// Name of cycle source
+  const char* source () const
+  {
+    return fd >= 0 ? "perf" :
+#ifdef HAVE_TSC
+      "tsc";
+#else
+      "none";
+#endif
+  }
+
+  void start ()
+  {
+#ifdef __linux__
+    if (fd >= 0)
+    {
+      ioctl (fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+      return;
+    }
+#endif
+#ifdef HAVE_TSC
+    tsc = __rdtsc ();
+#endif
+  }
+
+  /// Cycles since last call to start()
+  double stop ()
+  {
+#ifdef __linux__
+    if (fd >= 0)
+    {
+      ioctl (fd, PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t value = 0;
+      if (read (fd, &value, sizeof (value)) != sizeof (value))
+        return 0;
+      return (double)value;
+    }
+#endif
+#ifdef HAVE_TSC
+    return (double)(__rdtsc () - tsc);
+#else
+    return 0;
+#endif
+  }
+
+private:
+  int fd = -1;
+  uint64_t tsc = 0;
+};
+
+static cycle_counter* counter;
+
+/// Time a function on a corpus; keep the best call
+static result measure (const string& corpus, const string& function, size_t bytes,
+                       const std::function<size_t ()>& fn)
+{
+  result r{ corpus, function, bytes, 0, 0 };
+  volatile size_t sink = fn (); //warm-up
+  auto start = steady_clock::now ();
+  for (int calls = 0; calls < MIN_CALLS || steady_clock::now () - start < budget; calls++)
+  {
+    counter->start ();
+    auto t0 = steady_clock::now ();
+    sink = sink + fn ();
+    auto t1 = steady_clock::now ();
+    double cycles = counter->stop ();
+    double ns = (double)duration_cast<nanoseconds> (t1 - t0).count ();
+    if (!calls || ns < r.best_ns)
+    {
+      r.best_ns = ns;
+      r.cycles = cycles;
+    }
+  }
+  return r;
+}
+
+// Count characters that satisfy a predicate
+static size_t count_if (const string& text, bool (*pred)(const char*))
+{
+  size_t n = 0;
+  for (const char* p = text.c_str (); *p; utf8::next (p))
+    n += pred (p);
+  return n;
+}
+
+/// Run all functions on a corpus
+static void run (const string& name, const string& text, vector<result>& results)
+{
+  size_t sz = text.size ();
+  wstring wide = utf8::widen (text);
+  u32string wide32 = utf8::runes (text);
+  string upper = utf8::toupper (text);
+
+  results.push_back (measure (name, "narrow(wstring)", sz, [&] { return utf8::narrow (wide).size (); }));
+  results.push_back (measure (name, "narrow(u32string)", sz, [&] { return utf8::narrow (wide32).size (); }));
+  results.push_back (measure (name, "widen", sz, [&] { return utf8::widen (text).size (); }));
+  results.push_back (measure (name, "runes", sz, [&] { return utf8::runes (text).size (); }));
+  results.push_back (measure (name, "valid_str", sz, [&] { return (size_t)utf8::valid_str (text); }));
+  results.push_back (measure (name, "length", sz, [&] { return utf8::length (text); }));
+  results.push_back (measure (name, "tolower", sz, [&] { return utf8::tolower (text).size (); }));
+  results.push_back (measure (name, "toupper", sz, [&] { return utf8::toupper (text).size (); }));
+  if (utf8::valid_str (text)) //icompare requires valid strings
+    results.push_back (measure (name, "icompare", sz, [&] { return (size_t)utf8::icompare (text, upper); }));
+
+  static const struct {
+    const char* name;
+    bool (*pred)(const char*);
+  } predicates[] = {
+    { "isspace", utf8::isspace }, { "isblank", utf8::isblank },
+    { "isdigit", utf8::isdigit }, { "isalnum", utf8::isalnum },
+    { "isalpha", utf8::isalpha }, { "isxdigit", utf8::isxdigit },
+    { "isupper", utf8::isupper }, { "islower", utf8::islower }
+  };
+  for (auto& p : predicates)
+    results.push_back (measure (name, p.name, sz, [&] { return count_if (text, p.pred); }));
+}
+
+static void print_json (ostream& os, const vector<result>& results)
+{
+  os << "{\n  \"benchmark\": \"utf8\",\n  \"cycle_source\": \"" << counter->source ()
+     << "\",\n  \"results\": [";
+  bool first = true;
+  for (auto& r : results)
+  {
+    os << (first ? "\n" : ",\n");
+    first = false;
+    os << "    {\"corpus\": \"" << r.corpus << '"'
+       << ", \"function\": \"" << r.function << '"'
+       << ", \"bytes\": " << r.bytes
+       << ", \"best_ns\": " << r.best_ns
+       << ", \"gb_per_sec\": " << (r.best_ns ? r.bytes / r.best_ns : 0)
+       << ", \"cycles_per_byte\": " << r.cycles / r.bytes
+       << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+static void print_csv (ostream& os, const vector<result>& results)
+{
+  os << "corpus,function,bytes,best_ns,gb_per_sec,cycles_per_byte\n";
+  for (auto& r : results)
+  {
+    os << r.corpus << ',' << r.function << ',' << r.bytes << ',' << r.best_ns << ','
+       << (r.best_ns ? r.bytes / r.best_ns : 0) << ',' << r.cycles / r.bytes << '\n';
+  }
+}
+
+static void usage ()
+{
+  cerr << "Usage: bench_utf8 [--size kilobytes] [--budget milliseconds] [--perf] "
+          "[--format json|csv] [--out file]\n";
+}
+
+int main (int argc, char** argv)
+{
+  size_t size = 1024;
+  bool use_perf = false;
+  string format = "json", out;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp (argv[i], "--perf"))
+    {
+      use_perf = true;
+      continue;
+    }
+    if (i + 1 == argc)
+    {
+      usage ();
+      return 1;
+    }
+    if (!strcmp (argv[i], "--size"))
+      size = strtoul (argv[++i], nullptr, 10);
+    else if (!strcmp (argv[i], "--budget"))
+      budget = milliseconds (strtoul (argv[++i], nullptr, 10));
+    else if (!strcmp (argv[i], "--format"))
+      format = argv[++i];
+    else if (!strcmp (argv[i], "--out"))
+      out = argv[++i];
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+  if (!size || (format != "json" && format != "csv"))
+  {
+    usage ();
+    return 1;
+  }
+
+  cycle_counter cc (use_perf);
+  counter = &cc;
+  if (use_perf && strcmp (cc.source (), "perf"))
+    cerr << "Hardware counters not available; using " << cc.source () << '\n';
+
+  const cp_range ascii[] = { { 'a', 'z' }, { 'A', 'Z' } };
+  const cp_range latin1[] = { { 'a', 'z' }, { 'A', 'Z' }, { 0xC0, 0xD6 }, { 0xD8, 0xF6 }, { 0xF8, 0xFF } };
+  const cp_range greek_cyrillic[] = { { 0x391, 0x3A9 }, { 0x3B1, 0x3C9 }, { 0x410, 0x44F } };
+  const cp_range cjk[] = { { 0x4E00, 0x9FFF } };
+  const cp_range emoji[] = { { 0x1F300, 0x1F5FF }, { 0x1F600, 0x1F64F } };
+  const vector<cp_range> mixed{ { 'a', 'z' }, { 0xC0, 0xD6 }, { 0x3B1, 0x3C9 }, { 0x410, 0x44F },
+                                { 0x4E00, 0x9FFF }, { 0x1F600, 0x1F64F } };
+
+  const corpus_kind kinds[] = {
+    { "ascii", { begin (ascii), end (ascii) }, false },
+    { "latin1", { begin (latin1), end (latin1) }, false },
+    { "greek_cyrillic", { begin (greek_cyrillic), end (greek_cyrillic) }, false },
+    { "cjk", { begin (cjk), end (cjk) }, false },
+    { "emoji", { begin (emoji), end (emoji) }, false },
+    { "mixed", mixed, false },
+    { "invalid", mixed, true }
+  };
+
+  utf8::error_mode (utf8::action::replace);
+  vector<result> results;
+  for (auto& k : kinds)
+  {
+    cerr << k.name << '\n';
+    run (k.name, generate (k, size * 1024), results);
+  }
+
+  ostringstream os;
+  if (format == "csv")
+    print_csv (os, results);
+  else
+    print_json (os, results);
+
+  if (out.empty ())
+    cout << os.str ();
+  else
+  {
+    utf8::ofstream file (out);
+    file << os.str ();
+    if (!file)
+    {
+      cerr << "Cannot write " << out << '\n';
+      return 2;
+    }
+  }
+  return 0;
+}
@@ -8,10 +8,49 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <deque>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <type_traits>
 
 namespace utf8 {
 
+class IniSections;
+class IniEntries;
+struct file_stamp;
+
+/// Counters of INI file operations returned by IniFile::stats() function
+struct IniStats {
+  /// Kinds of timed operations
+  enum op {
+    read,           ///< reading a key value
+    write,          ///< writing or deleting a key or section
+    enumerate,      ///< listing keys or sections
+    copy,           ///< copying a section
+    compile,        ///< compiling or loading an image
+    compact,        ///< merging a journal file into the INI file
+    flush,          ///< writing asynchronous changes
+    op_count        ///< number of operation kinds
+  };
+
+  uint64_t opens = 0;           ///< files opened
+  uint64_t bytes_read = 0;      ///< bytes read from files (mapped files are not counted)
+  uint64_t bytes_written = 0;   ///< bytes written to files
+  uint64_t rewrites = 0;        ///< files written from scratch
+  uint64_t skipped_writes = 0;  ///< writes skipped because they didn't change anything
+  uint64_t rename_retries = 0;  ///< retries of replacing a file with its temporary copy
+  uint64_t calls[op_count] = {};                ///< number of operations of each kind
+  std::chrono::nanoseconds time[op_count] = {}; ///< wall time spent in each kind of operation
+};
+
 ///Operations on INI files
 class IniFile
 {
@@ -68,6 +107,14 @@ public:
   /// Write a floating point value key
   bool PutDouble (const std::string& key, double value, const std::string& section, int dec = 2);
 
+  /// Read and parse a typed key value
+  template <typename T>
+  bool GetValue (const std::string& key, const std::string& section, T& value) const;
+
+  /// Write a typed key value
+  template <typename T>
+  bool PutValue (const std::string& key, T value, const std::string& section);
+
   /// Delete a key
   bool DeleteKey (const std::string& key, const std::string& section);
 
@@ -92,6 +139,63 @@ public:
   /// Return the names of all sections in the INI file.
   size_t GetSections (std::deque<std::string>& sections);
 
+  /// Range of all section names
+  IniSections sections () const;
+
+  /// Range of keys and values in a section
+  IniEntries entries (const std::string& section) const;
+
+  /// Write a compiled image of the INI file
+  bool Compile (const std::string& image_path) const;
+
+  /// Use a compiled image for read operations
+  bool LoadCompiled (const std::string& image_path);
+
+  /// Read from a compiled image shared with other processes
+  bool EnableShared (const std::string& name);
+
+  /// Stop using the image shared with other processes
+  void DisableShared ();
+
+  /// Remove shared memory segments used by EnableShared()
+  static bool RemoveShared (const std::string& name);
+
+  /// Append changes to a journal file instead of rewriting the INI file
+  void EnableJournal (size_t max_size = 64 * 1024,
+                      std::chrono::milliseconds max_age = std::chrono::seconds (30));
+
+  /// Stop journal mode and merge the journal into the INI file
+  bool DisableJournal ();
+
+  /// Merge the journal file into the INI file
+  bool Compact ();
+
+  /// Write changes in the background
+  void EnableAsync (std::chrono::milliseconds debounce = std::chrono::milliseconds (50),
+                    std::chrono::milliseconds max_delay = std::chrono::seconds (1));
+
+  /// Write pending changes and stop asynchronous mode
+  bool DisableAsync ();
+
+  /// Wait until all pending changes have been written
+  bool Flush ();
+
+  /// Request writing of all pending changes
+  std::future<bool> FlushAsync ();
+
+  /// Return counters of operations performed by this object
+  IniStats stats () const;
+
+  /// Return counters of all INI file operations in this process
+  static IniStats global_stats ();
+
+  /// Function called at the end of each operation
+  using stats_callback = std::function<void (const std::string& file, IniStats::op kind,
+                                             std::chrono::nanoseconds duration)>;
+
+  /// Set function called at the end of each operation
+  static void set_stats_callback (stats_callback cb);
+
 #ifdef _WIN32          // Windows specific vvvvvvvv
   ///Return a color specification key
   COLORREF GetColor (const std::string& key, const std::string& section, COLORREF defval = RGB (0, 0, 0)) const;
@@ -107,10 +211,470 @@ public:
 #endif                // end Windows specific ^^^^^^^^
 
 private:
+  struct index;
+  bool readkey (const std::string& section, const std::string& key, char* buffer, size_t bsize,
+                std::string_view& value) const;
+  void invalidate ();
+  bool update (const char* key, const char* value, const char* section);
+  void stop_writers ();
+  void sync () const;
+  bool locate (FILE* fp, const file_stamp& st, const std::string& section,
+               long& line, long& body, long& end) const;
+  int list_keys (const std::string& section, std::function<void (const char*)> fun) const;
+  int list_sections (std::function<void (const char*)> fun) const;
+
+  bool get_value (const std::string& key, const std::string& section, int64_t& value) const;
+  bool get_value (const std::string& key, const std::string& section, uint64_t& value) const;
+  bool get_value (const std::string& key, const std::string& section, double& value) const;
+  bool get_value (const std::string& key, const std::string& section, bool& value) const;
+  bool get_duration (const std::string& key, const std::string& section, double& value,
+                     bool& whole, int64_t& ticks, intmax_t num, intmax_t den) const;
+
+  bool put_value (const std::string& key, int64_t value, const std::string& section, const char* suffix = nullptr);
+  bool put_value (const std::string& key, uint64_t value, const std::string& section);
+  bool put_value (const std::string& key, double value, const std::string& section, const char* suffix = nullptr);
 
   std::string filename;
   bool temp_file;
+  std::unique_ptr<index> idx;
+};
+
+/// \cond
+namespace detail {
+struct mapping;
+}
+/// \endcond
+
+/*!
+  Range of section names returned by IniFile::sections() function.
+
+  Names are views into the INI file mapped in memory. They remain valid as long
+  as the range object exists.
+*/
+class IniSections
+{
+public:
+  /// Forward iterator over section names
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view*;
+    using reference = const std::string_view&;
+
+    iterator () = default;
+    reference operator* () const
+      { return name; }
+    pointer operator-> () const
+      { return &name; }
+    iterator& operator++ ()
+      { next (); return *this; }
+    iterator operator++ (int)
+      { iterator tmp = *this; next (); return tmp; }
+    bool operator== (const iterator& other) const
+      { return pos == other.pos; }
+    bool operator!= (const iterator& other) const
+      { return pos != other.pos; }
+
+  private:
+    iterator (const char* first, const char* last);
+    void next ();
+
+    const char* pos = nullptr;    ///< start of next line or NULL at end
+    const char* last = nullptr;
+    std::string_view name;
+
+    friend class IniSections;
+  };
+
+  iterator begin () const
+    { return iterator (first, last); }
+  iterator end () const
+    { return iterator (); }
+
+private:
+  std::shared_ptr<detail::mapping> map;
+  const char* first = nullptr;
+  const char* last = nullptr;
+
+  friend class IniFile;
 };
 
+/// Key and value returned by iterating over IniEntries
+struct IniEntry {
+  std::string_view key;
+  std::string_view value;
+};
+
+/*!
+  Range of keys and values in a section returned by IniFile::entries() function.
+
+  Keys and values are views into the INI file mapped in memory. They remain
+  valid as long as the range object exists.
+*/
+class IniEntries
+{
+public:
+  /// Forward iterator over keys and values
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IniEntry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const IniEntry*;
+    using reference = const IniEntry&;
+
+    iterator () = default;
+    reference operator* () const
+      { return entry; }
+    pointer operator-> () const
+      { return &entry; }
+    iterator& operator++ ()
+      { next (); return *this; }
+    iterator operator++ (int)
+      { iterator tmp = *this; next (); return tmp; }
+    bool operator== (const iterator& other) const
+      { return pos == other.pos; }
+    bool operator!= (const iterator& other) const
+      { return pos != other.pos; }
+
+  private:
+    iterator (const char* first, const char* last);
+    void next ();
+
+    const char* pos = nullptr;    ///< start of next line or NULL at end
+    const char* last = nullptr;
+    IniEntry entry;
+
+    friend class IniEntries;
+  };
+
+  iterator begin () const
+    { return iterator (first, last); }
+  iterator end () const
+    { return iterator (); }
+
+private:
+  std::shared_ptr<detail::mapping> map;
+  const char* first = nullptr;
+  const char* last = nullptr;
+
+  friend class IniFile;
+};
+
+/*!
+  In-memory model of an INI file.
+
+  The document keeps all lines of the file, including comments and blank lines,
+  so that it can be edited in memory and written back with a single sequential
+  write. Changes are made in the same way as IniFile functions make them.
+*/
+class IniDocument
+{
+public:
+  /// Create an empty document
+  IniDocument ();
+
+  /// Create a document from the content of an INI file
+  explicit IniDocument (const std::string& filename);
+
+  /// Copy constructor
+  IniDocument (const IniDocument& other);
+
+  /// Move constructor
+  IniDocument (IniDocument&& other) noexcept;
+
+  /// Destructor
+  ~IniDocument ();
+
+  /// Assignment operator
+  IniDocument& operator= (const IniDocument& other);
+
+  /// Move assignment operator
+  IniDocument& operator= (IniDocument&& other) noexcept;
+
+  /// Replace document content with the content of an INI file
+  bool Load (const std::string& filename);
+
+  /// Replace document content with the given text
+  void Parse (std::string_view text);
+
+  /// Write document to a file
+  bool Save (const std::string& filename) const;
+
+  /// Return document content as text
+  std::string str () const;
+
+  /// Return a string key
+  std::string GetString (const std::string& key, const std::string& section,
+                         const std::string& defval = std::string ()) const;
+
+  /// Check for key existence
+  bool HasKey (const std::string& key, const std::string& section) const;
+
+  /// Return \b true if document contains a non empty section with the given name
+  bool HasSection (const std::string& section) const;
+
+  /// Write a string key
+  bool PutString (const std::string& key, const std::string& value, const std::string& section);
+
+  /// Delete a key
+  bool DeleteKey (const std::string& key, const std::string& section);
+
+  /// Delete an entire section
+  bool DeleteSection (const std::string& section);
+
+  /// Copy all keys from one section to another
+  bool CopySection (const IniDocument& from_doc, const std::string& from_sect,
+                    const std::string& to_sect = std::string ());
+
+  /// Retrieve names of all keys in a section
+  size_t GetKeys (std::deque<std::string>& keys, const std::string& section) const;
+
+  /// Return the names of all sections
+  size_t GetSections (std::deque<std::string>& sections) const;
+
+private:
+  struct model;
+  std::unique_ptr<model> doc;
+};
+
+/*!
+  Read-only overlay of several INI files.
+
+  Each key is looked up in the layers from the top one (the last one added) to
+  the bottom one and the first value found is returned. A merged index records
+  which layer has the winning value of each key, so that a lookup takes only
+  one hash probe, no matter how many layers there are.
+*/
+class IniStack
+{
+public:
+  /// Create an empty stack
+  IniStack ();
+
+  /// Create a stack with the given files, from bottom to top
+  IniStack (std::initializer_list<std::string> files);
+
+  /// Destructor
+  ~IniStack ();
+
+  /// Add a file on top of the stack
+  bool Push (const std::string& filename);
+
+  /// Add the file of an IniFile object on top of the stack
+  bool Push (const IniFile& file);
+
+  /// Return number of layers
+  size_t Size () const;
+
+  /// Return a string key
+  std::string GetString (const std::string& key, const std::string& section,
+                         const std::string& defval = std::string ()) const;
+
+  /// Check for key existence
+  bool HasKey (const std::string& key, const std::string& section) const;
+
+  /// Return the index of the layer that provides the value of a key
+  int Layer (const std::string& key, const std::string& section) const;
+
+private:
+  IniStack (const IniStack&) = delete;
+  IniStack& operator= (const IniStack&) = delete;
+
+  struct index;
+  std::unique_ptr<index> idx;
+};
+
+/*!
+  Receiver of events generated by ini_parse() function.
+
+  Names, values and comments are views into the parsing buffer; they are valid
+  only until the function returns. Each function returns `true` to continue
+  parsing or `false` to stop.
+*/
+class IniHandler
+{
+public:
+  virtual ~IniHandler () = default;
+
+  /// Called for each section line
+  virtual bool section (std::string_view /*name*/, size_t /*offset*/)
+    { return true; }
+
+  /// Called for each key line
+  virtual bool entry (std::string_view /*key*/, std::string_view /*value*/, size_t /*offset*/)
+    { return true; }
+
+  /// Called for each comment line
+  virtual bool comment (std::string_view /*text*/, size_t /*offset*/)
+    { return true; }
+};
+
+/// Parse an INI file and send its content to a handler
+bool ini_parse (const std::string& filename, IniHandler& handler);
+
+/// Parse an opened INI file and send its content to a handler
+bool ini_parse (FILE* source, IniHandler& handler);
+
+/// \cond
+namespace detail {
+template <typename T> struct is_duration : std::false_type {};
+template <class Rep, class Period>
+struct is_duration<std::chrono::duration<Rep, Period>> : std::true_type {};
+
+/// Unit suffix used when writing durations. Unknown periods are written without suffix.
+template <class Period>
+constexpr const char* duration_suffix ()
+{
+  if constexpr (std::is_same_v<Period, std::nano>)
+    return "ns";
+  else if constexpr (std::is_same_v<Period, std::micro>)
+    return "us";
+  else if constexpr (std::is_same_v<Period, std::milli>)
+    return "ms";
+  else if constexpr (std::is_same_v<Period, std::ratio<1>>)
+    return "s";
+  else if constexpr (std::is_same_v<Period, std::ratio<60>>)
+    return "min";
+  else if constexpr (std::is_same_v<Period, std::ratio<3600>>)
+    return "h";
+  else
+    return nullptr;
+}
+}
+/// \endcond
+
+/*!
+  \param key      key name
+  \param section  section name
+  \param value    parsed value
+  \return         `true` if key was found and its value could be parsed,
+                  `false` otherwise
+
+  Supported types are integers, floating point numbers, `bool`, enumerations
+  (stored as their underlying integer value) and `std::chrono::duration`
+  values. If the function fails, \p value is left unchanged.
+
+  Numbers are parsed with `std::from_chars` and are not affected by the current
+  locale. The whole value must be a valid number within the range of type \p T.
+
+  Boolean values can be any of "on", "yes", "true", "1" or "off", "no",
+  "false", "0" (case-insensitive).
+
+  Durations are a number followed by an optional unit suffix: "ns", "us", "ms",
+  "s", "min", "h" or "d". If there is no suffix, the number is a count of
+  ticks of the duration type.
+*/
+template <typename T>
+bool IniFile::GetValue (const std::string& key, const std::string& section, T& value) const
+{
+  if constexpr (std::is_same_v<T, bool>)
+    return get_value (key, section, value);
+  else if constexpr (std::is_enum_v<T>)
+  {
+    std::underlying_type_t<T> v;
+    if (!GetValue (key, section, v))
+      return false;
+    value = static_cast<T>(v);
+    return true;
+  }
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+  {
+    int64_t v;
+    if (!get_value (key, section, v)
+     || v < (std::numeric_limits<T>::min)() || v > (std::numeric_limits<T>::max)())
+      return false;
+    value = static_cast<T>(v);
+    return true;
+  }
+  else if constexpr (std::is_integral_v<T>)
+  {
+    uint64_t v;
+    if (!get_value (key, section, v) || v > (std::numeric_limits<T>::max)())
+      return false;
+    value = static_cast<T>(v);
+    return true;
+  }
+  else if constexpr (std::is_floating_point_v<T>)
+  {
+    double v;
+    if (!get_value (key, section, v))
+      return false;
+    value = static_cast<T>(v);
+    return true;
+  }
+  else
+  {
+    static_assert (detail::is_duration<T>::value, "Unsupported type for IniFile::GetValue");
+    using period = typename T::period;
+    using rep = typename T::rep;
+    double v;
+    bool whole;
+    int64_t ticks;
+    if (!get_duration (key, section, v, whole, ticks, period::num, period::den))
+      return false;
+    if constexpr (std::is_floating_point_v<rep>)
+      value = T (static_cast<rep>(v));
+    else if (whole)
+    {
+      bool fits = (ticks < 0) ? std::is_signed_v<rep> && ticks >= (int64_t)(std::numeric_limits<rep>::min)()
+                              : (uint64_t)ticks <= (uint64_t)(std::numeric_limits<rep>::max)();
+      if (!fits)
+        return false;
+      value = T (static_cast<rep>(ticks));
+    }
+    else
+    {
+      //fractional number: round to nearest tick
+      v = (v < 0) ? v - 0.5 : v + 0.5;
+      //max + 1 is a power of 2, exactly representable as double
+      if (!(v >= (double)(std::numeric_limits<rep>::min)()
+         && v < (double)((std::numeric_limits<rep>::max)() / 2 + 1) * 2))
+        return false;
+      value = T (static_cast<rep>(v));
+    }
+    return true;
+  }
+}
+
+/*!
+  \param key      key name
+  \param value    key value
+  \param section  section name
+  \return         `true` if successful, `false` otherwise
+
+  Numbers are formatted with `std::to_chars`. Floating point values are written
+  with the shortest representation that reads back to the same value. Boolean
+  values are written as "On" or "Off", enumerations as their underlying integer
+  value and durations as a tick count followed by a unit suffix.
+*/
+template <typename T>
+bool IniFile::PutValue (const std::string& key, T value, const std::string& section)
+{
+  if constexpr (std::is_same_v<T, bool>)
+    return PutBool (key, value, section);
+  else if constexpr (std::is_enum_v<T>)
+    return PutValue (key, static_cast<std::underlying_type_t<T>>(value), section);
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    return put_value (key, static_cast<int64_t>(value), section);
+  else if constexpr (std::is_integral_v<T>)
+    return put_value (key, static_cast<uint64_t>(value), section);
+  else if constexpr (std::is_floating_point_v<T>)
+    return put_value (key, static_cast<double>(value), section);
+  else
+  {
+    static_assert (detail::is_duration<T>::value, "Unsupported type for IniFile::PutValue");
+    const char* suffix = detail::duration_suffix<typename T::period> ();
+    if constexpr (std::is_floating_point_v<typename T::rep>)
+      return put_value (key, static_cast<double>(value.count ()), section, suffix);
+    else
+      return put_value (key, static_cast<int64_t>(value.count ()), section, suffix);
+  }
+}
+
 
 }
@@ -0,0 +1,272 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file inlines.h Definitions of basic decoding and encoding functions.
+
+  This file is included by utf8.h when `UTF8_HEADER_ONLY` is defined and the
+  functions become inline functions. Otherwise, it is included only by
+  utf8.cpp and the functions are compiled in the library.
+*/
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include <utf8/utf8.h>
+
+#ifndef UTF8_INLINE
+#define UTF8_INLINE inline
+#endif
+
+namespace utf8 {
+UTF8_INLINE_BEGIN
+
+/*!
+  Decodes a UTF-8 encoded character and advances iterator to next code point
+
+  \param ptr    Reference to iterator to be advanced
+  \param last   Iterator pointing to the end of range  
+  \return       decoded character
+
+  If the iterator points to an invalid UTF-8 encoding or is at end, the function
+  throws an exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending
+  on error handling mode. In any case, the iterator is advanced to beginning of
+  next character or end of string.
+*/
+UTF8_INLINE
+char32_t next (std::string::const_iterator& ptr, const std::string::const_iterator last)
+{
+  if (ptr == last)
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+
+  const char* p = &*ptr;
+  bool valid;
+  char32_t rune = detail::decode (p, p + (last - ptr), valid);
+  ptr += p - &*ptr;
+  if (!valid)
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  return rune;
+}
+
+/*!
+  Decodes a UTF-8 encoded character and advances pointer to next character
+
+  \param ptr    <b>Reference</b> to character pointer to be advanced
+  \return       decoded character
+
+  If the string contains an invalid UTF-8 encoding, the function throws an 
+  exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending on error
+  handling mode. In any case, the pointer is advanced to beginning of next
+  character or end of string.
+*/
+UTF8_INLINE
+char32_t next (const char*& ptr)
+{
+  if (!*ptr)
+    return 0;
+
+  bool valid;
+  char32_t rune = detail::decode (ptr, nullptr, valid);
+  if (!valid)
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  return rune;
+}
+
+/*!
+  Decrements a character pointer to previous UTF-8 character
+
+  \param ptr    <b>Reference</b> to character pointer to be decremented
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function throws an 
+  exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending on error
+  handling mode. In this case the pointer remains unchanged.
+*/
+UTF8_INLINE
+char32_t prev (const char* & ptr)
+{
+  int cont = 0;
+  const char* in_ptr = ptr;
+  char32_t rune = 0;
+  unsigned char ch;
+  while (((ch = *--ptr) & 0xc0) == 0x80 && cont < 3)
+  {
+    rune += (char32_t)(ch & 0x3f) << cont++ * 6;
+  }
+  if (cont == 3 && (ch & 0xF8) == 0xF0)
+    rune += (char32_t)(ch & 0x0f) << 18;
+  else if (cont == 2 && (ch & 0xF0) == 0xE0)
+    rune += (char32_t)(ch & 0x1f) << 12;
+  else if (cont == 1 && (ch & 0xE0) == 0xC0)
+    rune += (char32_t)(ch & 0x3f) << 6;
+  else if (cont == 0 && ch < 0x7f)
+    rune += ch;
+  else
+  {
+    ptr = in_ptr;
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  }
+
+  if ((0xD800 <= rune && rune <= 0xdfff) //surrogate
+   || (cont > 0 && rune < 0x80)
+   || (cont > 1 && rune < 0x800)
+   || (cont > 2 && rune < 0x10000))  //overlong encoding
+  {
+    ptr = in_ptr;
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  }
+
+  return rune;
+}
+
+/*!
+  Decrements an iterator to previous UTF-8 character
+
+  \param ptr    iterator to be decremented
+  \param first  iterator pointing to beginning of string
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and iterator remains unchanged.
+*/
+UTF8_INLINE
+char32_t prev (std::string::const_iterator& ptr, const std::string::const_iterator first)
+{
+  int cont = 0;
+  auto in_ptr = ptr;
+  char32_t rune = 0;
+  unsigned char ch;
+  while (((ch = *--ptr) & 0xc0) == 0x80 && cont < 3 && ptr > first)
+  {
+    rune += (char32_t)(ch & 0x3f) << cont++ * 6;
+  }
+  if (cont == 3 && (ch & 0xF8) == 0xF0)
+    rune += (char32_t)(ch & 0x0f) << 18;
+  else if (cont == 2 && (ch & 0xF0) == 0xE0)
+    rune += (char32_t)(ch & 0x1f) << 12;
+  else if (cont == 1 && (ch & 0xE0) == 0xC0)
+    rune += (char32_t)(ch & 0x3f) << 6;
+  else if (cont == 0 && ch < 0x7f)
+    rune += ch;
+  else
+  {
+    ptr = in_ptr;
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  }
+
+  if ((0xD800 <= rune && rune <= 0xdfff) //surrogate
+   || (cont > 0 && rune < 0x80)
+   || (cont > 1 && rune < 0x800)
+   || (cont > 2 && rune < 0x10000))  //overlong encoding
+  {
+    ptr = in_ptr;
+    return detail::throw_or_replace (utf8::exception::invalid_utf8);
+  }
+
+  return rune;
+}
+
+/*!
+  Counts number of characters in an UTF8 encoded string
+
+  \param s UTF8-encoded string
+  \return number of characters in string
+
+  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html
+*/
+UTF8_INLINE
+size_t length (const std::string& s)
+{
+  size_t nc = 0;
+  auto p = s.begin ();
+  while (p != s.end ())
+  {
+    if ((*p++ & 0xC0) != 0x80)
+      nc++;
+  }
+  return nc;
+}
+
+/// \copydoc utf8::length()
+UTF8_INLINE
+size_t length (const char* s)
+{
+  size_t nc = 0;
+  while (*s)
+  {
+    if ((*s++ & 0xC0) != 0x80)
+      nc++;
+  }
+  return nc;
+}
+
+/*!
+  Check if character is space or tab
+  \param r character to check
+  \return `true` if character is `\t` (0x09) or is in the "Space_Separator" (Zs)
+          category, `false` otherwise.
+
+  See [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
+  for a list of characters in the Zs (Space_Separator) category. The function adds
+  HORIZONTAL_TAB (0x09 or '\\t') to the space separator category for compatibility
+  with standard `isblank (char c)` C function.
+*/
+UTF8_INLINE
+bool isblank (char32_t r)
+{
+  static constexpr char32_t blanktab[]{ 0x09, 0x20, 0xA0, 0x1680, 0x2000, 0x2001, 0x2002,
+    0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A, 0x202f, 0x205f, 0x3000 };
+
+  auto f = std::lower_bound (std::begin (blanktab), std::end (blanktab), r);
+  return (f != std::end (blanktab) && *f == r);
+}
+
+/*!
+  Check if character is white space.
+  \param r character to check
+  \return `true` if character is white space, `false` otherwise
+
+  Returns `true` if Unicode character has the "White_Space=yes" property in the
+  [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
+*/
+UTF8_INLINE
+bool isspace (char32_t r)
+{
+  static constexpr char32_t spacetab[]{ 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x20, 0x85, 0xA0, 0x1680,
+    0x2000, 0x2001, 0x2002, 0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A,
+    0x2028, 0x2029, 0x202f, 0x205f, 0x3000 };
+
+  auto f = std::lower_bound (std::begin (spacetab), std::end (spacetab), r);
+  return (f != std::end (spacetab) && *f == r);
+}
+
+/*!
+  Encode a character and append it to a string
+  \param c   character to encode
+  \param s   string where the UTF-8 encoding is appended
+
+  If the character is not a valid code point, the function throws an exception
+  or appends utf8::REPLACEMENT_CHARACTER (0xfffd), depending on error
+  handling mode.
+*/
+UTF8_INLINE
+void encode (char32_t c, std::string& s)
+{
+  if (c <= 0x7f)
+  {
+    s.push_back ((char)c);
+    return;
+  }
+  char buf[4];
+  int n = detail::encode (c, buf);
+  if (!n)
+    n = detail::encode (detail::throw_or_replace (exception::cause::invalid_char32), buf);
+  s.append (buf, n);
+}
+
+UTF8_INLINE_END
+} //namespace utf8
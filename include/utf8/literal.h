@@ -0,0 +1,245 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file literal.h Compile-time decoding and encoding of UTF-8 strings.
+
+  The functions in this file are `constexpr` and can be used to convert
+  string literals at compile time:
+\code
+  constexpr auto greek = utf8::literal_wide (u8"ελληνικό");
+  static_assert (greek.size () == 8);
+  HANDLE f = CreateFile (greek.c_str (), ...);
+\endcode
+
+  This file is included by utf8.h.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace utf8 {
+namespace detail {
+
+/*!
+  Decode a UTF-8 character and advance pointer to next character
+  \param ptr    <b>Reference</b> to character pointer to be advanced
+  \param last   end of range or `nullptr` if the range ends at a null character
+  \param valid  set to `true` if the encoding is valid, `false` otherwise
+  \return       decoded character or utf8::REPLACEMENT_CHARACTER if encoding
+                is invalid
+
+  This is the decoder used by utf8::next() functions. The pointer is advanced to
+  the beginning of next character, even if the encoding is invalid.
+*/
+constexpr char32_t decode (const char*& ptr, const char* last, bool& valid)
+{
+  valid = false;
+  if (ptr == last)
+    return REPLACEMENT_CHARACTER;
+
+  char32_t rune = 0;
+  if ((*ptr & 0x80) == 0)
+  {
+    valid = true;
+    return (char32_t)*ptr++;
+  }
+  else if ((*ptr & 0xC0) == 0x80)
+  {
+    do {
+      ++ptr;
+    } while (ptr != last && (*ptr & 0x80) == 0x80);
+    return REPLACEMENT_CHARACTER;
+  }
+
+  int cont = 0;
+  if ((*ptr & 0xE0) == 0xC0)
+  {
+    cont = 1;
+    rune = *ptr++ & 0x1f;
+  }
+  else if ((*ptr & 0xF0) == 0xE0)
+  {
+    cont = 2;
+    rune = *ptr++ & 0x0f;
+  }
+  else if ((*ptr & 0xF8) == 0xF0)
+  {
+    cont = 3;
+    rune = *ptr++ & 0x07;
+  }
+  else
+  {
+    //code points > U+0x10FFFF are invalid
+    do {
+      ++ptr;
+    } while (ptr != last && (*ptr & 0xC0) == 0x80);
+    return REPLACEMENT_CHARACTER;
+  }
+  int i = 0;
+  for (; i < cont && ptr != last && (*ptr & 0xC0) == 0x80; i++)
+  {
+    rune <<= 6;
+    rune += *ptr++ & 0x3f;
+  }
+
+  if (i != cont                               //short encoding
+   || (0xD800 <= rune && rune <= 0xdfff)      //surrogates (U+D000 to U+DFFF) are invalid
+   || rune < 0x80
+   || (cont > 1 && rune < 0x800)
+   || (cont > 2 && rune < 0x10000))           //overlong encoding
+    return REPLACEMENT_CHARACTER;
+
+  valid = true;
+  return rune;
+}
+
+/*!
+  Encode a character
+  \param c    character to encode
+  \param buf  buffer for encoding (at least 4 bytes)
+  \return     number of bytes of encoding or 0 if character is not a valid
+              code point.
+
+  This is the encoder used by utf8::encode() function.
+*/
+constexpr int encode (char32_t c, char* buf)
+{
+  if (c <= 0x7f)
+  {
+    buf[0] = (char)c;
+    return 1;
+  }
+  else if (c <= 0x7ff)
+  {
+    buf[0] = (char)(0xC0 | c >> 6);
+    buf[1] = (char)(0x80 | (c & 0x3f));
+    return 2;
+  }
+  else if (c <= 0xFFFF)
+  {
+    if (c >= 0xD800 && c <= 0xdfff)
+      return 0;
+    buf[0] = (char)(0xE0 | c >> 12);
+    buf[1] = (char)(0x80 | (c >> 6 & 0x3f));
+    buf[2] = (char)(0x80 | (c & 0x3f));
+    return 3;
+  }
+  else if (c <= 0x10ffff)
+  {
+    buf[0] = (char)(0xF0 | c >> 18);
+    buf[1] = (char)(0x80 | (c >> 12 & 0x3f));
+    buf[2] = (char)(0x80 | (c >> 6 & 0x3f));
+    buf[3] = (char)(0x80 | (c & 0x3f));
+    return 4;
+  }
+  return 0;
+}
+
+} //namespace detail
+
+/// Result of compile-time conversion of a string literal
+template <class T, size_t N>
+struct literal {
+  T data[N] = {};     ///< converted string, null-terminated
+  size_t len = 0;     ///< number of elements, without the terminating null
+
+  /// Pointer to null-terminated string
+  constexpr const T* c_str () const { return data; }
+
+  /// Number of elements (without the terminating null)
+  constexpr size_t size () const { return len; }
+
+  /// String view of the converted string
+  constexpr std::basic_string_view<T> view () const { return { data, len }; }
+
+  /// Conversion to string object
+  operator std::basic_string<T> () const { return { data, len }; }
+};
+
+/*!
+  Check if a string is a valid UTF-8 string
+  \param s  string to check
+  \return   `true` if string is a valid UTF-8 encoded string, `false` otherwise
+
+  Unlike the other versions of valid_str(), this one can be evaluated at
+  compile time:
+\code
+  using namespace std::literals;
+  static_assert (utf8::valid_str (u8"ελληνικό"sv));
+\endcode
+*/
+constexpr bool valid_str (std::string_view s)
+{
+  const char* p = s.data ();
+  const char* last = p + s.size ();
+  bool valid = true;
+  while (p != last && valid)
+    detail::decode (p, last, valid);
+  return valid;
+}
+
+/*!
+  Convert a UTF-8 string literal to UTF-16
+  \param s  string literal
+  \return   converted string
+
+  The result is the same as the one of utf8::widen() function. If the function
+  is evaluated at compile time, an invalid encoding produces a compilation
+  error. At run time, it throws a utf8::exception.
+*/
+template <size_t N>
+constexpr literal<wchar_t, N> literal_wide (const char (&s)[N])
+{
+  literal<wchar_t, N> out;
+  const char* p = s;
+  const char* last = s + N - 1;
+  while (p != last)
+  {
+    bool valid = false;
+    char32_t c = detail::decode (p, last, valid);
+    if (!valid)
+      throw exception (exception::invalid_utf8);
+    if (c < 0x10000)
+      out.data[out.len++] = (wchar_t)c;
+    else
+    {
+      c -= 0x10000;
+      out.data[out.len++] = (wchar_t)((c >> 10) + 0xD800);
+      out.data[out.len++] = (wchar_t)((c & 0x3FF) + 0xDC00);
+    }
+  }
+  return out;
+}
+
+/*!
+  Convert a UTF-8 string literal to UTF-32
+  \param s  string literal
+  \return   converted string
+
+  The result is the same as the one of utf8::runes() function. If the function
+  is evaluated at compile time, an invalid encoding produces a compilation
+  error. At run time, it throws a utf8::exception.
+*/
+template <size_t N>
+constexpr literal<char32_t, N> literal_runes (const char (&s)[N])
+{
+  literal<char32_t, N> out;
+  const char* p = s;
+  const char* last = s + N - 1;
+  while (p != last)
+  {
+    bool valid = false;
+    char32_t c = detail::decode (p, last, valid);
+    if (!valid)
+      throw exception (exception::invalid_utf8);
+    out.data[out.len++] = c;
+  }
+  return out;
+}
+
+} //namespace utf8
@@ -0,0 +1,75 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file mapped.h Definition of mapped_text class
+
+  This file is included by utf8.h.
+*/
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace utf8 {
+
+/*!
+  Read-only view of a text file mapped in memory.
+
+  The file is not copied: view() returns a string view of the mapped file,
+  without the byte order mark (BOM) if the file has one.
+
+  Validation of UTF-8 encoding is done only when requested, with the valid()
+  functions. The text is divided in chunks that are validated in parallel and
+  the results are kept, so that each chunk is validated only once.
+*/
+class mapped_text
+{
+public:
+  /// Byte order mark at the beginning of file
+  enum class bom_type {
+    none,     ///< no BOM
+    utf8,     ///< UTF-8 BOM (EF BB BF)
+    utf16le,  ///< UTF-16 little endian BOM (FF FE)
+    utf16be,  ///< UTF-16 big endian BOM (FE FF)
+    utf32le,  ///< UTF-32 little endian BOM (FF FE 00 00)
+    utf32be   ///< UTF-32 big endian BOM (00 00 FE FF)
+  };
+
+  mapped_text ();
+  explicit mapped_text (const std::string& filename);
+  mapped_text (mapped_text&& other) noexcept;
+  mapped_text& operator= (mapped_text&& other) noexcept;
+  ~mapped_text ();
+
+  bool open (const std::string& filename);
+  void close ();
+
+  /// Return `true` if a file is mapped
+  bool is_open () const
+    { return (bool)p; }
+
+  std::string_view view () const;
+
+  /// Pointer to text (after the BOM)
+  const char* data () const
+    { return view ().data (); }
+
+  /// Size of text (without the BOM)
+  size_t size () const
+    { return view ().size (); }
+
+  bom_type bom () const;
+
+  bool valid () const;
+  bool valid (size_t pos, size_t len) const;
+
+private:
+  struct impl;
+  std::unique_ptr<impl> p;
+};
+
+} //namespace utf8
@@ -6,9 +6,13 @@
 /// \file utf8.h UTF-8 Conversion functions
 #pragma once
 
+#include <cstdint>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
+#include <memory>
 
 /*!
   If USE_WINDOWS_API is not zero, the library issues direct Windows API
@@ -34,6 +38,25 @@
 
 #endif
 
+/*!
+  If UTF8_HEADER_ONLY is defined, the basic decoding and encoding functions
+  (next(), prev(), length(), encode() and the character classification
+  functions that use them) are defined inline in header files, allowing the
+  compiler to optimize loops that call them. The inline versions are placed in
+  an inline namespace so that they don't clash with the versions compiled in
+  the library. Conversion functions are still provided by the library.
+*/
+
+//#define UTF8_HEADER_ONLY
+
+#ifdef UTF8_HEADER_ONLY
+#define UTF8_INLINE_BEGIN inline namespace header_only {
+#define UTF8_INLINE_END }
+#else
+#define UTF8_INLINE_BEGIN
+#define UTF8_INLINE_END
+#endif
+
 namespace utf8 {
 
 /// Exception thrown on encoding/decoding failure
@@ -68,9 +91,47 @@ enum action {
 /// Set error handling mode for this thread
 action error_mode (action mode);
 
+namespace detail {
+/// Throw an exception or return the replacement character, depending on error handling mode
+char32_t throw_or_replace (exception::cause err);
+}
+
 /// Replacement character used for invalid encodings
 const char32_t REPLACEMENT_CHARACTER = 0xfffd;
 
+/*!
+  Counters of conversion functions.
+
+  Counters are collected only if the library was built with `UTF8_STATS`
+  defined and collection has been turned on with collect_stats() function.
+*/
+struct conversion_stats {
+  /// Kinds of conversions
+  enum kind {
+    wide_to_utf8,   ///< narrow() from UTF-16
+    utf32_to_utf8,  ///< narrow() from UTF-32
+    utf8_to_wide,   ///< widen()
+    utf8_to_utf32,  ///< runes()
+    kind_count      ///< number of conversion kinds
+  };
+
+  uint64_t bytes_in[kind_count] = {};   ///< bytes of input strings
+  uint64_t bytes_out[kind_count] = {};  ///< bytes of output strings
+  uint64_t replacements[4] = {};        ///< invalid encodings replaced, indexed by exception::cause
+  uint64_t exceptions[4] = {};          ///< exceptions thrown, indexed by exception::cause
+  uint64_t ascii_chars = 0;             ///< characters converted on the single-byte (fast) path
+  uint64_t multibyte_chars = 0;         ///< characters converted on the multi-byte (slow) path
+};
+
+/// Turn on or off collection of conversion statistics
+bool collect_stats (bool on);
+
+/// Return conversion statistics of all threads
+conversion_stats stats ();
+
+/// Return name of instruction set used by vectorized functions
+const char* cpu_target ();
+
 
 /// \addtogroup basecvt
 /// @{
@@ -85,13 +146,54 @@ std::wstring widen (const std::string& s);
 std::u32string runes (const char* s, size_t nch = 0);
 std::u32string runes (const std::string& s);
 
+/*!
+  Wide character string converted in a thread-local scratch buffer.
+
+  Use it instead of widen() for short-lived wide strings, like arguments of
+  Windows API functions:
+\code
+  _wremove (utf8::scoped_wide (filename).c_str ());
+\endcode
+  The buffer is reused by subsequent conversions so, in steady state, no
+  memory is allocated. The string is valid during the lifetime of the object.
+  Objects must be destroyed in the reverse order of their creation, as it
+  happens with local variables and temporaries.
+*/
+class scoped_wide
+{
+public:
+  explicit scoped_wide (const char* s, size_t nch = 0);
+  explicit scoped_wide (const std::string& s);
+  ~scoped_wide ();
+
+  scoped_wide (const scoped_wide&) = delete;
+  scoped_wide& operator= (const scoped_wide&) = delete;
+
+  /// Pointer to null-terminated wide character string
+  const wchar_t* c_str () const { return str; }
+
+  /// Number of wide characters (without the terminating null)
+  size_t size () const { return len; }
+
+  /// String view of the wide character string
+  operator std::wstring_view () const { return { str, len }; }
+
+private:
+  void convert (const char* s, size_t nch);
+
+  wchar_t* str;
+  size_t len;
+  size_t block;   //top of scratch buffer before conversion
+  size_t used;
+};
+
+UTF8_INLINE_BEGIN
 char32_t rune (const char* p);
 char32_t rune (const std::string::const_iterator& p);
 /// @}
 
 bool is_valid (const char* p);
 bool is_valid (std::string::const_iterator p, const std::string::const_iterator last);
-bool valid_str (const char* s, size_t nch = 0);
 bool valid_str (const std::string& s);
 
 char32_t next (std::string::const_iterator& ptr, const std::string::const_iterator last);
@@ -107,6 +209,11 @@ char32_t prev (std::string::iterator& ptr, const std::string::const_iterator fir
 size_t length (const std::string& s);
 size_t length (const char* s);
 
+void encode (char32_t c, std::string& s);
+UTF8_INLINE_END
+
+bool valid_str (const char* s, size_t nch = 0);
+
 /*!
   \addtogroup folding
   @{
@@ -115,14 +222,66 @@ void make_lower (std::string& str);
 void make_upper (std::string& str);
 std::string tolower (const std::string& str);
 std::string toupper (const std::string& str);
+char32_t tolower (char32_t r);
+char32_t toupper (char32_t r);
 int icompare (const std::string& s1, const std::string& s2);
 /// @}
 
+/// Conversion functions that allocate their results from a memory resource
+namespace pmr {
+std::pmr::string narrow (std::wstring_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::string narrow (std::u32string_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::string narrow (char32_t r,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::wstring widen (std::string_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::u32string runes (std::string_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::string tolower (std::string_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+std::pmr::string toupper (std::string_view s,
+  std::pmr::memory_resource* mr = std::pmr::get_default_resource ());
+}
+
+/// Invalid row of a column
+struct row_error {
+  size_t row;       ///< row number
+  size_t position;  ///< position of first invalid encoding in row
+};
+
+/// \addtogroup column
+/// @{
+bool valid_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::vector<row_error>* errors = nullptr);
+size_t length_column (const char* data, const int32_t* offsets, size_t rows,
+                      std::vector<size_t>& lengths);
+bool widen_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::wstring& out, std::vector<int32_t>& out_offsets,
+                   std::vector<row_error>* errors = nullptr);
+bool runes_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::u32string& out, std::vector<int32_t>& out_offsets,
+                   std::vector<row_error>* errors = nullptr);
+bool narrow_column (const wchar_t* data, const int32_t* offsets, size_t rows,
+                    std::string& out, std::vector<int32_t>& out_offsets,
+                    std::vector<row_error>* errors = nullptr);
+bool narrow_column (const char32_t* data, const int32_t* offsets, size_t rows,
+                    std::string& out, std::vector<int32_t>& out_offsets,
+                    std::vector<row_error>* errors = nullptr);
+/// @}
+
 /*!
   \addtogroup charclass
   @{
 */
 
+bool isupper (char32_t r);
+bool isupper (const char* p);
+bool islower (char32_t r);
+bool islower (const char* p);
+
+UTF8_INLINE_BEGIN
 bool isspace (char32_t r);
 bool isspace (const char* p);
 bool isspace (std::string::const_iterator p);
@@ -147,91 +306,280 @@ bool isxdigit (char32_t r);
 bool isxdigit (const char* p);
 bool isxdigit (std::string::const_iterator p);
 
-bool isupper (char32_t r);
-bool isupper (const char* p);
 bool isupper (std::string::const_iterator p);
-
-bool islower (char32_t r);
-bool islower (const char* p);
 bool islower (std::string::const_iterator p);
+UTF8_INLINE_END
 /// @}
 
-/// Input stream class using UTF-8 filename
-#ifdef _WIN32
+/// Encoding of text files
+enum class file_encoding {
+  utf8,     ///< UTF-8 (no conversion)
+  utf16le,  ///< UTF-16 little endian
+  utf16be,  ///< UTF-16 big endian
+  utf32le,  ///< UTF-32 little endian
+  utf32be   ///< UTF-32 big endian
+};
+
+/*!
+  Stream buffer that converts between UTF-8 and UTF-16 or UTF-32.
+
+  The program reads and writes UTF-8 text while the target stream buffer
+  supplies or receives text in the selected encoding. Sequences split between
+  buffer refills are kept until they are complete. Invalid encodings are
+  handled according to error handling mode.
+
+  Byte order marks are converted like any other character; they are not
+  added or removed. Positioning in stream is not supported.
+*/
+class transcoding_buf : public std::streambuf
+{
+public:
+  transcoding_buf (std::streambuf* target, file_encoding enc);
+  ~transcoding_buf ();
+
+  transcoding_buf (const transcoding_buf&) = delete;
+  transcoding_buf& operator= (const transcoding_buf&) = delete;
+
+  /// Change target stream buffer
+  void target (std::streambuf* buf)
+    { tgt = buf; }
+
+protected:
+  int_type underflow () override;
+  int_type overflow (int_type c) override;
+  int sync () override;
+
+private:
+  size_t decode (const char* s, size_t n);
+  bool flush (bool final);
+
+  std::streambuf* tgt;
+  file_encoding enc;
+  std::string in;     //get area
+  std::string raw;    //incomplete code units received from target
+  std::string out;    //put area
+};
+
+/*!
+  Input stream class using UTF-8 filename.
+
+  If the file encoding is not UTF-8, the file is opened in binary mode and its
+  content is converted to UTF-8 by a transcoding_buf object.
+*/
 class ifstream : public std::ifstream
 {
 public:
   ifstream () : std::ifstream () {};
-  explicit ifstream (const char* filename, std::ios_base::openmode mode = ios_base::in)
-    : std::ifstream (utf8::widen (filename), mode) {};
-  explicit ifstream (const std::string& filename, std::ios_base::openmode mode = ios_base::in)
-    : std::ifstream (utf8::widen (filename), mode) {};
-  ifstream (ifstream&& other) noexcept : std::ifstream ((std::ifstream&&)other) {};
+  explicit ifstream (const char* filename, std::ios_base::openmode mode = ios_base::in,
+                     file_encoding enc = file_encoding::utf8)
+    { open (filename, mode, enc); };
+  explicit ifstream (const std::string& filename, std::ios_base::openmode mode = ios_base::in,
+                     file_encoding enc = file_encoding::utf8)
+    { open (filename.c_str (), mode, enc); };
+  ifstream (ifstream&& other) noexcept
+    : std::ifstream ((std::ifstream&&)other)
+    , tbuf (std::move (other.tbuf))
+    { other.detach (); attach (); };
   ifstream (const ifstream& rhs) = delete;
 
-  void open (const char* filename, std::ios_base::openmode mode = ios_base::in)
+  ifstream& operator= (ifstream&& other)
   {
-    std::ifstream::open (utf8::widen (filename), mode);
+    detach ();
+    std::ifstream::operator= ((std::ifstream&&)other);
+    tbuf = std::move (other.tbuf);
+    other.detach ();
+    attach ();
+    return *this;
   }
-  void open (const std::string& filename, ios_base::openmode mode = ios_base::in)
+  ifstream& operator= (const ifstream& rhs) = delete;
+
+  /*!
+    Return stream buffer with UTF-8 text: the transcoding buffer if the file
+    is not UTF-8, the file buffer otherwise. Unlike rdbuf(), which returns the
+    file buffer, it can be used to copy the converted text (`ss << f.textbuf ()`).
+  */
+  std::streambuf* textbuf () const
+  {
+    return tbuf ? (std::streambuf*)tbuf.get () : std::ifstream::rdbuf ();
+  }
+
+  void open (const char* filename, std::ios_base::openmode mode = ios_base::in,
+             file_encoding enc = file_encoding::utf8)
+  {
+    if (enc != file_encoding::utf8)
+      mode |= ios_base::binary;
+#ifdef _WIN32
+    std::ifstream::open (utf8::scoped_wide (filename).c_str (), mode);
+#else
+    std::ifstream::open (filename, mode);
+#endif
+    if (enc != file_encoding::utf8 && !fail ())
+    {
+      tbuf = std::make_unique<transcoding_buf> (std::ifstream::rdbuf (), enc);
+      attach ();
+    }
+  }
+  void open (const std::string& filename, ios_base::openmode mode = ios_base::in,
+             file_encoding enc = file_encoding::utf8)
+  {
+    open (filename.c_str (), mode, enc);
+  }
+  void close ()
+  {
+    detach ();
+    std::ifstream::close ();
+  }
+
+private:
+  // Insert transcoding buffer between stream and file buffer
+  void attach ()
+  {
+    if (!tbuf)
+      return;
+    auto st = rdstate ();
+    tbuf->target (std::ifstream::rdbuf ());
+    std::ios::rdbuf (tbuf.get ());
+    clear (st);
+  }
+
+  // Remove transcoding buffer and use the file buffer directly
+  void detach ()
   {
-    std::ifstream::open (utf8::widen (filename), mode);
+    auto st = rdstate ();
+    std::ios::rdbuf (std::ifstream::rdbuf ());
+    tbuf.reset ();
+    clear (st);
   }
+
+  std::unique_ptr<transcoding_buf> tbuf;
 };
-/// Output stream class using UTF-8 filename
+
+/*!
+  Output stream class using UTF-8 filename.
+
+  If the file encoding is not UTF-8, the file is opened in binary mode and
+  the UTF-8 text written to the stream is converted by a transcoding_buf object.
+*/
 class ofstream : public std::ofstream
 {
 public:
   ofstream () : std::ofstream () {};
-  explicit ofstream (const char* filename, std::ios_base::openmode mode = ios_base::out)
-    : std::ofstream (utf8::widen (filename), mode) {};
-  explicit ofstream (const std::string& filename, std::ios_base::openmode mode = ios_base::out)
-    : std::ofstream (utf8::widen (filename), mode) {};
-  ofstream (ofstream&& other) noexcept : std::ofstream ((std::ofstream&&)other) {};
+  explicit ofstream (const char* filename, std::ios_base::openmode mode = ios_base::out,
+                     file_encoding enc = file_encoding::utf8)
+    { open (filename, mode, enc); };
+  explicit ofstream (const std::string& filename, std::ios_base::openmode mode = ios_base::out,
+                     file_encoding enc = file_encoding::utf8)
+    { open (filename.c_str (), mode, enc); };
+  ofstream (ofstream&& other) noexcept
+    : std::ofstream ((std::ofstream&&)other)
+    , tbuf (std::move (other.tbuf))
+    { other.detach (); attach (); };
   ofstream (const ofstream& rhs) = delete;
 
-  void open (const char* filename, ios_base::openmode mode = ios_base::out)
+  ofstream& operator= (ofstream&& other)
+  {
+    detach ();
+    std::ofstream::operator= ((std::ofstream&&)other);
+    tbuf = std::move (other.tbuf);
+    other.detach ();
+    attach ();
+    return *this;
+  }
+  ofstream& operator= (const ofstream& rhs) = delete;
+
+  /*!
+    Return stream buffer with UTF-8 text: the transcoding buffer if the file
+    is not UTF-8, the file buffer otherwise. Unlike rdbuf(), which returns the
+    file buffer, it can be used to copy the converted text (`ss << f.textbuf ()`).
+  */
+  std::streambuf* textbuf () const
+  {
+    return tbuf ? (std::streambuf*)tbuf.get () : std::ofstream::rdbuf ();
+  }
+
+  void open (const char* filename, ios_base::openmode mode = ios_base::out,
+             file_encoding enc = file_encoding::utf8)
+  {
+    if (enc != file_encoding::utf8)
+      mode |= ios_base::binary;
+#ifdef _WIN32
+    std::ofstream::open (utf8::scoped_wide (filename).c_str (), mode);
+#else
+    std::ofstream::open (filename, mode);
+#endif
+    if (enc != file_encoding::utf8 && !fail ())
+    {
+      tbuf = std::make_unique<transcoding_buf> (std::ofstream::rdbuf (), enc);
+      attach ();
+    }
+  }
+  void open (const std::string& filename, ios_base::openmode mode = ios_base::out,
+             file_encoding enc = file_encoding::utf8)
+  {
+    open (filename.c_str (), mode, enc);
+  }
+  void close ()
+  {
+    detach ();   //flush remaining characters before closing the file
+    std::ofstream::close ();
+  }
+
+private:
+  // Insert transcoding buffer between stream and file buffer
+  void attach ()
   {
-    std::ofstream::open (utf8::widen (filename), mode);
+    if (!tbuf)
+      return;
+    auto st = rdstate ();
+    tbuf->target (std::ofstream::rdbuf ());
+    std::ios::rdbuf (tbuf.get ());
+    clear (st);
   }
-  void open (const std::string& filename, ios_base::openmode mode = ios_base::out)
+
+  // Remove transcoding buffer and use the file buffer directly
+  void detach ()
   {
-    std::ofstream::open (utf8::widen (filename), mode);
+    auto st = rdstate ();
+    std::ios::rdbuf (std::ofstream::rdbuf ());
+    tbuf.reset ();
+    clear (st);
   }
+
+  std::unique_ptr<transcoding_buf> tbuf;
 };
 
 /// Bidirectional stream class using UTF-8 filename
+#ifdef _WIN32
 class fstream : public std::fstream
 {
 public:
   fstream () : std::fstream () {};
   explicit fstream (const char* filename, std::ios_base::openmode mode = ios_base::in | ios_base::out)
-    : std::fstream (utf8::widen (filename), mode) {};
+    : std::fstream (utf8::scoped_wide (filename).c_str (), mode) {};
   explicit fstream (const std::string& filename, std::ios_base::openmode mode = ios_base::in | ios_base::out)
-    : std::fstream (utf8::widen (filename), mode) {};
+    : std::fstream (utf8::scoped_wide (filename).c_str (), mode) {};
   fstream (fstream&& other) noexcept : std::fstream ((std::fstream&&)other) {};
   fstream (const fstream& rhs) = delete;
 
   void open (const char* filename, ios_base::openmode mode = ios_base::in | ios_base::out)
   {
-    std::fstream::open (utf8::widen (filename), mode);
+    std::fstream::open (utf8::scoped_wide (filename).c_str (), mode);
   }
   void open (const std::string& filename, ios_base::openmode mode = ios_base::in | ios_base::out)
   {
-    std::fstream::open (utf8::widen (filename), mode);
+    std::fstream::open (utf8::scoped_wide (filename).c_str (), mode);
   }
 };
-
 #else
 //Under Linux file streams already use UTF-8 filenames
-typedef std::ifstream ifstream;
-typedef std::ofstream ofstream;
 typedef std::fstream fstream;
 #endif
 
 
 // INLINES --------------------------------------------------------------------
 
+UTF8_INLINE_BEGIN
+
 /*!
   Check if pointer points to a valid UTF-8 encoding
   \param p pointer to string
@@ -257,7 +605,6 @@ bool is_valid (const char* p)
 inline
 bool is_valid (std::string::const_iterator p, const std::string::const_iterator last)
 {
-  auto len = last - p;
   auto prev_mode = error_mode (action::replace);
   bool valid = (next (p, last) != REPLACEMENT_CHARACTER);
   error_mode (prev_mode);
@@ -332,7 +679,7 @@ char32_t prev (char*& ptr)
 inline
 bool valid_str (const std::string& s)
 {
-  return valid_str (s.c_str (), s.size());
+  return utf8::valid_str (s.c_str (), s.size());
 }
 
 /// @copydoc rune()
@@ -511,15 +858,16 @@ bool isxdigit (std::string::const_iterator p)
 inline
 bool isupper (std::string::const_iterator p)
 {
-  return isupper (rune(p));
+  return utf8::isupper (rune (p));
 }
 
 /// \copydoc islower(const char*p)
 inline
 bool islower (std::string::const_iterator p)
 {
-  return islower (rune(p));
+  return utf8::islower (rune (p));
 }
+UTF8_INLINE_END
 
 // File System functions -----------------------------------------------------
 
@@ -535,7 +883,7 @@ FILE* fopen (const std::string& filename, const std::string& mode)
 {
   FILE* h = nullptr;
 #ifdef _WIN32
-  _wfopen_s (&h, widen (filename).c_str (), widen (mode).c_str ());
+  _wfopen_s (&h, scoped_wide (filename).c_str (), scoped_wide (mode).c_str ());
 #else
   h = ::fopen (filename.c_str(), mode.c_str());
 #endif
@@ -548,7 +896,7 @@ FILE* fopen (const char* filename, const char* mode)
 {
   FILE* h = nullptr;
 #ifdef _WIN32
-  _wfopen_s (&h, widen (filename).c_str (), widen (mode).c_str ());
+  _wfopen_s (&h, scoped_wide (filename).c_str (), scoped_wide (mode).c_str ());
 #else
   h = ::fopen (filename, mode);
 #endif
@@ -591,7 +939,7 @@ inline
 bool chdir (const std::string& dirname)
 {
 #if USE_WINDOWS_API
-  return (_wchdir (widen (dirname).c_str ()) == 0);
+  return (_wchdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -609,7 +957,7 @@ inline
 bool chdir (const char* dirname)
 {
 #if USE_WINDOWS_API
-  return (_wchdir (widen (dirname).c_str ()) == 0);
+  return (_wchdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -633,7 +981,7 @@ inline
 bool mkdir (const std::string& dirname)
 {
 #if USE_WINDOWS_API
-  return (_wmkdir (widen (dirname).c_str ()) == 0);
+  return (_wmkdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -652,7 +1000,7 @@ inline
 bool mkdir (const char* dirname)
 {
 #if USE_WINDOWS_API
-  return (_wmkdir (widen (dirname).c_str ()) == 0);
+  return (_wmkdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -675,7 +1023,7 @@ inline
 bool rmdir (const std::string& dirname)
 {
 #if USE_WINDOWS_API
-  return (_wrmdir (widen (dirname).c_str ()) == 0);
+  return (_wrmdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -693,7 +1041,7 @@ inline
 bool rmdir (const char* dirname)
 {
 #if USE_WINDOWS_API
-  return (_wrmdir (widen (dirname).c_str ()) == 0);
+  return (_wrmdir (scoped_wide (dirname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path dir (widen (dirname));
@@ -717,7 +1065,7 @@ inline
 bool rename (const std::string& oldname, const std::string& newname)
 {
 #if USE_WINDOWS_API
-  return (_wrename (widen (oldname).c_str (), widen (newname).c_str ()) == 0);
+  return (_wrename (scoped_wide (oldname).c_str (), scoped_wide (newname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path fn (widen (newname));
@@ -737,7 +1085,7 @@ inline
 bool rename (const char* oldname, const char* newname)
 {
 #if USE_WINDOWS_API
-  return (_wrename (widen (oldname).c_str (), widen (newname).c_str ()) == 0);
+  return (_wrename (scoped_wide (oldname).c_str (), scoped_wide (newname).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path fn (widen (newname));
@@ -762,7 +1110,7 @@ inline
 bool remove (const std::string& filename)
 {
 #if USE_WINDOWS_API
-  return (_wremove (widen (filename).c_str ()) == 0);
+  return (_wremove (scoped_wide (filename).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path f (widen(filename));
@@ -781,7 +1129,7 @@ inline
 bool remove (const char* filename)
 {
 #if USE_WINDOWS_API
-  return (_wremove (widen (filename).c_str ()) == 0);
+  return (_wremove (scoped_wide (filename).c_str ()) == 0);
 #else
 # ifdef _WIN32
   std::filesystem::path f (widen (filename));
@@ -818,6 +1166,11 @@ bool operator !=(const exception& lhs, const exception& rhs)
 
 }; //namespace utf8
 
+#include <utf8/literal.h>
+#include <utf8/mapped.h>
+#ifdef UTF8_HEADER_ONLY
+#include <utf8/inlines.h>
+#endif
 #ifdef _WIN32
 #include <utf8/winutf8.h>
 #endif
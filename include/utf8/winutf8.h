@@ -196,14 +196,14 @@ operator << (std::ostream& s, const buffer& b)
 inline
 bool chmod (const char* filename, int mode)
 {
-  return (_wchmod (widen (filename).c_str (), mode) == 0);
+  return (_wchmod (scoped_wide (filename).c_str (), mode) == 0);
 }
 
 /// \copydoc utf8::chmod()
 inline
 bool chmod (const std::string& filename, int mode)
 {
-  return (_wchmod (widen (filename).c_str (), mode) == 0);
+  return (_wchmod (scoped_wide (filename).c_str (), mode) == 0);
 }
 
 
@@ -223,14 +223,14 @@ bool chmod (const std::string& filename, int mode)
 inline
 bool access (const char* filename, int mode)
 {
-  return (_waccess (widen (filename).c_str (), mode) == 0);
+  return (_waccess (scoped_wide (filename).c_str (), mode) == 0);
 }
 
 /// \copydoc utf8::access()
 inline
 bool access (const std::string& filename, int mode)
 {
-  return (_waccess (widen (filename).c_str (), mode) == 0);
+  return (_waccess (scoped_wide (filename).c_str (), mode) == 0);
 }
 
 
@@ -245,7 +245,7 @@ bool access (const std::string& filename, int mode)
 inline
 bool putenv (const std::string& str)
 {
-  return (_wputenv (utf8::widen (str).c_str ()) == 0);
+  return (_wputenv (utf8::scoped_wide (str).c_str ()) == 0);
 }
 
 /*!
@@ -261,8 +261,8 @@ bool putenv (const std::string& str)
 inline
 bool putenv (const std::string& var, const std::string& val)
 {
-  return (_wputenv_s (widen (var).c_str (),
-    widen (val).c_str ()) == 0);
+  return (_wputenv_s (scoped_wide (var).c_str (),
+    scoped_wide (val).c_str ()) == 0);
 }
 
 /*!
@@ -42,6 +42,31 @@ namespace utf8 {
 // definition of 'l2u' and 'uc' tables
 #include "lowertab.h"
 
+/*
+  Apply a case folding function to UTF-8 characters from `s` to `end` and
+  append the result to `out`.
+*/
+template <class S>
+static void fold (const char* s, const char* end, S& out, char32_t (*conv)(char32_t))
+{
+  out.reserve (out.size () + (end - s));
+  while (s < end)
+  {
+    bool valid;
+    char32_t c = detail::decode (s, end, valid);
+    if (!valid)
+      c = detail::throw_or_replace (exception::cause::invalid_utf8);
+    c = conv (c);
+    if (c < 0x80)
+      out.push_back ((char)c);
+    else
+    {
+      char buf[4];
+      out.append (buf, detail::encode (c, buf));
+    }
+  }
+}
+
 
 /// Return `true` if character is a lowercase character
 /// \param r character to check
@@ -75,18 +100,25 @@ bool islower (const char* p)
 
 std::string tolower (const std::string& str)
 {
-  u32string wstr;
-  auto ptr = str.begin ();
-  while (ptr < str.end ())
-  {
-    auto c = next (ptr, str.end ());
-    auto f = lower_bound (begin (u2l), end (u2l), c);
-    if (f != end (u2l) && *f == c)
-      wstr.push_back (lc[f - u2l]);
-    else
-      wstr.push_back (c);
-  }
-  return narrow (wstr);
+  string out;
+  fold (str.data (), str.data () + str.size (), out, tolower);
+  return out;
+}
+
+/*!
+  Convert a character to lower case.
+
+  \param r character to convert
+  \return lower case equivalent of character or the character itself if it
+          doesn't have a lower case equivalent.
+*/
+char32_t tolower (char32_t r)
+{
+  if (r < 0x80)
+    return ('A' <= r && r <= 'Z') ? r + 0x20 : r;
+
+  auto f = lower_bound (begin (u2l), end (u2l), r);
+  return (f != end (u2l) && *f == r) ? lc[f - u2l] : r;
 }
 
 /*!
@@ -132,18 +164,25 @@ bool isupper (const char* p)
 */
 std::string toupper (const std::string& str)
 {
-  u32string wstr;
-  auto ptr = str.begin();
-  while (ptr < str.end())
-  {
-    auto c = next (ptr, str.end ());
-    auto f = lower_bound (begin (l2u), end (l2u), c);
-    if (f != end (l2u) && *f == c)
-      wstr.push_back (uc[f - l2u]);
-    else
-      wstr.push_back (c);
-  }
-  return narrow (wstr);
+  string out;
+  fold (str.data (), str.data () + str.size (), out, toupper);
+  return out;
+}
+
+/*!
+  Convert a character to upper case.
+
+  \param r character to convert
+  \return upper case equivalent of character or the character itself if it
+          doesn't have an upper case equivalent.
+*/
+char32_t toupper (char32_t r)
+{
+  if (r < 0x80)
+    return ('a' <= r && r <= 'z') ? r - 0x20 : r;
+
+  auto f = lower_bound (begin (l2u), end (l2u), r);
+  return (f != end (l2u) && *f == r) ? uc[f - l2u] : r;
 }
 
 /*!
@@ -176,20 +215,8 @@ int icompare (const std::string& s1, const std::string& s2)
   auto p1 = begin (s1), p2 = begin (s2);
   while (p1 < end (s1) && p2 < end (s2))
   {
-    char32_t lc1, lc2,
-      c1 = next (p1, end (s1)),
-      c2 = next (p2, end (s2));
-
-    auto f = lower_bound (begin (u2l), end (u2l), c1);
-    if (f != end (u2l) && *f == c1)
-      lc1 = lc[f - u2l];
-    else
-      lc1 = c1;
-    f = lower_bound (begin (u2l), end (u2l), c2);
-    if (f != end (u2l) && *f == c2)
-      lc2 = lc[f - u2l];
-    else
-      lc2 = c2;
+    char32_t lc1 = tolower (next (p1, end (s1))),
+             lc2 = tolower (next (p2, end (s2)));
     if ((lc1 != lc2))
       return (lc1 < lc2)? -1 : 1;
   }
@@ -200,4 +227,26 @@ int icompare (const std::string& s1, const std::string& s2)
   return 0;
 }
 
+/// Convert UTF-8 string to lower case
+/// \param s   string to convert
+/// \param mr  memory resource for result
+/// \ingroup pmr
+std::pmr::string pmr::tolower (std::string_view s, std::pmr::memory_resource* mr)
+{
+  std::pmr::string out (mr);
+  fold (s.data (), s.data () + s.size (), out, utf8::tolower);
+  return out;
+}
+
+/// Convert UTF-8 string to upper case
+/// \param s   string to convert
+/// \param mr  memory resource for result
+/// \ingroup pmr
+std::pmr::string pmr::toupper (std::string_view s, std::pmr::memory_resource* mr)
+{
+  std::pmr::string out (mr);
+  fold (s.data (), s.data () + s.size (), out, utf8::toupper);
+  return out;
+}
+
 }
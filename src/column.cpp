@@ -0,0 +1,320 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file column.cpp Validation and conversion of string columns
+
+#include <utf8/utf8.h>
+
+#include "kernels.h"
+
+using namespace std;
+namespace utf8 {
+
+/*!
+  \defgroup column Column Functions
+  Validation and conversion of columns of strings.
+
+  A column is stored in one buffer, together with an offsets array that has
+  one more element than the number of rows. Row `i` is made of the elements
+  between `offsets[i]` and `offsets[i+1]` of the buffer. This is the layout
+  used by Apache Arrow for string arrays. The first offset doesn't have to be
+  0, so slices of a column can be processed.
+
+  Conversion results are placed in one output buffer with a new offsets
+  array, starting at 0. Invalid encodings are replaced with
+  utf8::REPLACEMENT_CHARACTER regardless of error handling mode; these
+  functions never throw utf8::exception. If an errors vector is given, it
+  receives one entry for each invalid row with the position of the first
+  invalid encoding in that row.
+
+  The total size of output must fit in an `int32_t` offset. If it doesn't,
+  conversion stops before the row that would overflow: the functions return
+  `false` and the output offsets array has fewer than `rows+1` elements.
+  @{
+*/
+
+static const size_t no_error = (size_t)-1;
+
+/*
+  Decode a UTF-8 row and append it to a UTF-16 or UTF-32 string.
+  Return position of first invalid encoding or `no_error`.
+*/
+template <bool utf16, class S>
+static size_t decode_row (const char* s, const char* end, S& out, const detail::kernels& k)
+{
+  const char* start = s;
+  size_t err = no_error;
+  while (s < end)
+  {
+    size_t n = k.ascii_prefix (s, end - s);
+    out.append (s, s + n);
+    s += n;
+    if (s == end)
+      break;
+
+    const char* at = s;
+    bool valid;
+    char32_t c = detail::decode (s, end, valid);
+    if (!valid && err == no_error)
+      err = at - start;
+    if (!utf16 || c < 0x10000)
+      out.push_back ((typename S::value_type)c);
+    else
+    {
+      c -= 0x10000;
+      out.push_back ((typename S::value_type)((c >> 10) + 0xD800));
+      out.push_back ((typename S::value_type)((c & 0x3FF) + 0xDC00));
+    }
+  }
+  return err;
+}
+
+/*
+  Encode a UTF-16 or UTF-32 row as UTF-8 and append it to a string.
+  Return position of first invalid character or `no_error`.
+*/
+template <bool utf16, class T>
+static size_t encode_row (const T* s, const T* end, std::string& out)
+{
+  const T* start = s;
+  size_t err = no_error;
+  while (s < end)
+  {
+    const T* at = s;
+    char32_t c = (char32_t)*s++;
+    if (c < 0x80)
+    {
+      out.push_back ((char)c);
+      continue;
+    }
+    if (utf16 && 0xD800 <= c && c < 0xDC00)
+    {
+      //high surrogate must be followed by a low one
+      if (s < end && 0xDC00 <= (char32_t)*s && (char32_t)*s <= 0xDFFF)
+        c = (((c - 0xD800) << 10) | ((char32_t)*s++ - 0xDC00)) + 0x10000;
+    }
+    char buf[4];
+    int n = detail::encode (c, buf);
+    if (!n)
+    {
+      if (err == no_error)
+        err = at - start;
+      n = detail::encode (REPLACEMENT_CHARACTER, buf);
+    }
+    out.append (buf, n);
+  }
+  return err;
+}
+
+/*
+  Common part of column conversions. `row` function converts one row and
+  returns the position of the first error.
+*/
+template <class S, class F>
+static bool convert (size_t rows, const int32_t* offsets, S& out,
+                     std::vector<int32_t>& out_offsets, std::vector<row_error>* errors, F row)
+{
+  out.clear ();
+  out_offsets.resize (rows + 1);
+  out_offsets[0] = 0;
+  if (errors)
+    errors->clear ();
+
+  bool ok = true;
+  for (size_t i = 0; i < rows; i++)
+  {
+    size_t err = row (offsets[i], offsets[i + 1], out);
+    if (out.size () > (size_t)INT32_MAX)
+    {
+      //output offsets would overflow; keep only complete rows
+      out.resize (out_offsets[i]);
+      out_offsets.resize (i + 1);
+      return false;
+    }
+    if (err != no_error)
+    {
+      ok = false;
+      if (errors)
+        errors->push_back ({ i, err });
+    }
+    out_offsets[i + 1] = (int32_t)out.size ();
+  }
+  return ok;
+}
+
+/*!
+  Check if all rows of a column are valid UTF-8 strings
+  \param data     column data
+  \param offsets  column offsets (`rows+1` elements)
+  \param rows     number of rows
+  \param errors   pointer to vector that receives invalid rows or `nullptr`
+  \return `true` if all rows are valid
+*/
+bool valid_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::vector<row_error>* errors)
+{
+  auto& k = detail::cpu_kernels ();
+  if (errors)
+    errors->clear ();
+
+  //all ASCII column is valid
+  size_t total = offsets[rows] - offsets[0];
+  if (k.ascii_prefix (data + offsets[0], total) == total)
+    return true;
+
+  bool ok = true;
+  for (size_t i = 0; i < rows; i++)
+  {
+    const char* start = data + offsets[i];
+    const char* end = data + offsets[i + 1];
+    const char* s = start;
+    while (s < end)
+    {
+      s += k.ascii_prefix (s, end - s);
+      if (s == end)
+        break;
+      const char* at = s;
+      bool valid;
+      detail::decode (s, end, valid);
+      if (!valid)
+      {
+        ok = false;
+        if (errors)
+          errors->push_back ({ i, (size_t)(at - start) });
+        break;
+      }
+    }
+  }
+  return ok;
+}
+
+/*!
+  Count characters in each row of a UTF-8 column
+  \param data     column data
+  \param offsets  column offsets (`rows+1` elements)
+  \param rows     number of rows
+  \param lengths  vector that receives number of characters of each row
+  \return total number of characters
+
+  Like utf8::length(), this function counts the bytes that are not
+  continuation bytes; it doesn't validate the strings.
+*/
+size_t length_column (const char* data, const int32_t* offsets, size_t rows,
+                      std::vector<size_t>& lengths)
+{
+  auto& k = detail::cpu_kernels ();
+  lengths.resize (rows);
+  size_t total = 0;
+  for (size_t i = 0; i < rows; i++)
+  {
+    lengths[i] = k.count_chars (data + offsets[i], offsets[i + 1] - offsets[i]);
+    total += lengths[i];
+  }
+  return total;
+}
+
+/*!
+  Convert a UTF-8 column to wide characters
+  \param data         column data
+  \param offsets      column offsets (`rows+1` elements)
+  \param rows         number of rows
+  \param out          converted data
+  \param out_offsets  offsets of converted rows
+  \param errors       pointer to vector that receives invalid rows or `nullptr`
+  \return `true` if all rows are valid
+*/
+bool widen_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::wstring& out, std::vector<int32_t>& out_offsets,
+                   std::vector<row_error>* errors)
+{
+  auto& k = detail::cpu_kernels ();
+  size_t total = offsets[rows] - offsets[0];
+  const char* first = data + offsets[0];
+  if (k.ascii_prefix (first, total) == total)
+  {
+    //all ASCII column: same offsets, characters are copied
+    out.assign (first, first + total);
+    out_offsets.resize (rows + 1);
+    for (size_t i = 0; i <= rows; i++)
+      out_offsets[i] = offsets[i] - offsets[0];
+    if (errors)
+      errors->clear ();
+    return true;
+  }
+
+  out.reserve (k.count_chars (first, total));
+  return convert (rows, offsets, out, out_offsets, errors,
+    [&] (int32_t from, int32_t to, std::wstring& s) {
+      return decode_row<true> (data + from, data + to, s, k);
+    });
+}
+
+/*!
+  Convert a UTF-8 column to UTF-32
+  \param data         column data
+  \param offsets      column offsets (`rows+1` elements)
+  \param rows         number of rows
+  \param out          converted data
+  \param out_offsets  offsets of converted rows
+  \param errors       pointer to vector that receives invalid rows or `nullptr`
+  \return `true` if all rows are valid
+*/
+bool runes_column (const char* data, const int32_t* offsets, size_t rows,
+                   std::u32string& out, std::vector<int32_t>& out_offsets,
+                   std::vector<row_error>* errors)
+{
+  auto& k = detail::cpu_kernels ();
+  out.reserve (k.count_chars (data + offsets[0], offsets[rows] - offsets[0]));
+  return convert (rows, offsets, out, out_offsets, errors,
+    [&] (int32_t from, int32_t to, std::u32string& s) {
+      return decode_row<false> (data + from, data + to, s, k);
+    });
+}
+
+/*!
+  Convert a wide character column to UTF-8
+  \param data         column data
+  \param offsets      column offsets (`rows+1` elements)
+  \param rows         number of rows
+  \param out          converted data
+  \param out_offsets  offsets of converted rows
+  \param errors       pointer to vector that receives invalid rows or `nullptr`
+  \return `true` if all rows are valid
+*/
+bool narrow_column (const wchar_t* data, const int32_t* offsets, size_t rows,
+                    std::string& out, std::vector<int32_t>& out_offsets,
+                    std::vector<row_error>* errors)
+{
+  out.reserve (offsets[rows] - offsets[0]);
+  return convert (rows, offsets, out, out_offsets, errors,
+    [&] (int32_t from, int32_t to, std::string& s) {
+      return encode_row<true> (data + from, data + to, s);
+    });
+}
+
+/*!
+  Convert a UTF-32 column to UTF-8
+  \param data         column data
+  \param offsets      column offsets (`rows+1` elements)
+  \param rows         number of rows
+  \param out          converted data
+  \param out_offsets  offsets of converted rows
+  \param errors       pointer to vector that receives invalid rows or `nullptr`
+  \return `true` if all rows are valid
+*/
+bool narrow_column (const char32_t* data, const int32_t* offsets, size_t rows,
+                    std::string& out, std::vector<int32_t>& out_offsets,
+                    std::vector<row_error>* errors)
+{
+  out.reserve (offsets[rows] - offsets[0]);
+  return convert (rows, offsets, out, out_offsets, errors,
+    [&] (int32_t from, int32_t to, std::string& s) {
+      return encode_row<false> (data + from, data + to, s);
+    });
+}
+
+/// @}
+
+} //namespace utf8
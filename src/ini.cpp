@@ -14,13 +14,27 @@
 #include <cstring>
 #include <math.h>        // for atof
 #include <assert.h>
+#include <ctype.h>
 #include <utf8/utf8.h>
 #include <functional>
 #include <filesystem>
 #include <thread>
+#include <charconv>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+#include "internal.h"
 
-/// Maximum line length for a line in an INI file
-#define INI_BUFFERSIZE  1024
 using namespace std;
 
 namespace utf8 {
@@ -54,6 +68,7 @@ namespace utf8 {
   The only changes compared to the Windows API are:
   - line length defaults to 1024 (the INI_BUFFER_SIZE value) while Windows API limits it to 256 characters
   - files without a path are in current directory while Windows API places them in Windows folder
+  - section and key names are case-insensitive for all Unicode letters, not only for ASCII ones
 */
 
 static int enum_keys (FILE* fp, const char *section, std::function<void (const char*)> fun);
@@ -61,55 +76,13 @@ static int enum_sections (FILE* fp, std::function<void (const char*)> fun);
 static bool findsection (const char *section, FILE *rf, FILE *wf, char *buffer, size_t bsize);
 static bool putkey (const char *key, const char *value, const char *section, const char *filename);
 static bool getkey (FILE* fp, const char* section, const char* key, char* buffer, size_t BufferSize);
+static bool findkey (FILE* fp, const char* section, const char* key, char* buffer, size_t bsize, std::string_view& value);
 static void writesection (const char* Section, FILE *fp);
 static void writekey (const char* key, const char* value, FILE *fp);
 
-static bool tmp_rename (const std::string& filename);
 static bool same_file (const std::string& f1, const std::string& f2);
+static bool copy_range (FILE* in, long begin, long end, FILE* out);
 
-//case insensitive compare functions have different names in VS and GCC
-#ifdef _WIN32
-#define icompare _stricmp
-#define icomparen _strnicmp
-#else
-#define icompare strcasecmp
-#define icomparen strncasecmp
-#endif
-
-
-//----------------------------------------------------------------------------
-//  Some string manipulation functions.
-//  Template-ized to allow for const/non-const arguments
-
-// Skip leading spaces and non-printing characters
-template <class T> static T* skipleading (T* str)
-{
-  assert (str);
-  while (*str > 0 && *str <= ' ')
-    str++;
-  return str;
-}
-
-// Return a pointer to the first trailing space character
-template <class T> static T* skiptrailing (T* str)
-{
-  assert (str);
-  T* tail = str;
-  unsigned char c;
-  while ((c = *str++) != 0)
-  {
-    if (c > ' ')
-      tail = str;
-  }
-  return tail;
-}
-
-// Return string's length not including any trailing spaces
-template <class T> static size_t trimmed_len (T* str)
-{
-  T* endp = skiptrailing<T> (str);
-  return endp - str;
-}
 
 // Trim a string to the last non-space character
 static char *trimtrailing (char *str)
@@ -119,38 +92,120 @@ static char *trimtrailing (char *str)
   return end;
 }
 
-//-----------------------------------------------------------------------------
-//  File manipulation functions 
-
-inline
-static FILE *openread (const std::string& fname)
+/// Return stamp of an opened file
+file_stamp get_stamp (FILE* fp)
 {
+  file_stamp st{ 0, 0, 0 };
 #ifdef _WIN32
-  return utf8::fopen (fname, "rb, ccs=UTF-8");
+  BY_HANDLE_FILE_INFORMATION info;
+  if (GetFileInformationByHandle ((HANDLE)_get_osfhandle (_fileno (fp)), &info))
+  {
+    st.id = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    st.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    st.mtime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+  }
 #else
-  return fopen (fname.c_str (), "rb");
+  struct stat sb;
+  if (fstat (fileno (fp), &sb) == 0)
+  {
+    st.id = (uint64_t)sb.st_ino;
+    st.size = (uint64_t)sb.st_size;
+# ifdef __APPLE__
+    st.mtime = (uint64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+# else
+    st.mtime = (uint64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+# endif
+  }
 #endif
+  return st;
 }
 
-inline
-static FILE *openwrite (const std::string& fname)
+/// Return size and modification time of a file. File id is not set.
+bool get_stamp (const std::string& filename, file_stamp& st)
 {
+  st.id = 0;
 #ifdef _WIN32
-  return utf8::fopen (fname, "wb, ccs=UTF-8");
+  WIN32_FILE_ATTRIBUTE_DATA info;
+  if (!GetFileAttributesExW (scoped_wide (filename).c_str (), GetFileExInfoStandard, &info))
+    return false;
+  st.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+  st.mtime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
 #else
-  return fopen (fname.c_str (), "wb");
+  struct stat sb;
+  if (stat (filename.c_str (), &sb))
+    return false;
+  st.size = (uint64_t)sb.st_size;
+# ifdef __APPLE__
+  st.mtime = (uint64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+# else
+  st.mtime = (uint64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+# endif
 #endif
+  return true;
+}
+
+/// Parse an INI file and build the lookup index
+void IniFile::index::build (FILE* fp, const file_stamp& st)
+{
+  char buffer[INI_BUFFERSIZE];
+  const char *name, *end;
+  long offset = 0;
+  uint32_t sect_hash = 0;
+  bool in_section = false;  //inside first section with this hash
+  span* current = nullptr;  //location of current section
+
+  sections.clear ();
+  keys.clear ();
+  spans.clear ();
+  stamp = st;
+  if (build_parallel (fp))
+  {
+    valid = true;
+    return;
+  }
+  while (read_line (buffer, sizeof (buffer), fp))
+  {
+    long line_offset = offset;
+    offset += (long)strlen (buffer);
 
+    if (*skipleading (buffer) == '[')
+    {
+      in_section = false;
+      if (current)
+      {
+        current->end = line_offset;
+        current = nullptr;
+      }
+      if ((name = section_name (buffer, end)) != NULL)
+      {
+        sect_hash = fold_hash (name, end);
+        auto ins = sections.emplace (sect_hash, false);
+        if (ins.second)
+        {
+          in_section = true;
+          current = &spans.emplace (sect_hash, span{ line_offset, offset, -1 }).first->second;
+        }
+        else
+          ins.first->second = true; //repeated section or hash collision
+      }
+    }
+    else if (in_section && (name = key_name (buffer, end)) != NULL)
+      keys.emplace (combine (sect_hash, fold_hash (name, end)), line_offset);
+  }
+  valid = true;
 }
 
 /*
-  Get a temporary file name to copy to.
-  Use the existing name and append a '~' character at the end.
+  Return the compiled image used instead of the file or NULL if there is none.
+  A stale image is discarded and, in shared mode, a current one is attached.
 */
-inline
-static std::string tempname (const std::string& source)
+ini_image* IniFile::index::current_image (const std::string& filename)
 {
-  return source + '~';
+  if (image && !image->fresh (filename))
+    image.reset (); //stale image; go back to text file
+  if (!image && shared)
+    image = shared->attach (filename);
+  return image.get ();
 }
 
 //-----------------------------------------------------------------------------
@@ -174,6 +229,7 @@ IniFile::IniFile (const std::string& file)
 #else
   , filename{ std::filesystem::absolute (file) }
 #endif
+  , idx{ std::make_unique<index> () }
 {
 }
 
@@ -185,6 +241,7 @@ IniFile::IniFile ()
 #else
   , filename (tmpnam(NULL))
 #endif
+  , idx{ std::make_unique<index> () }
 {
 }
 
@@ -192,14 +249,19 @@ IniFile::IniFile ()
 IniFile::IniFile (const IniFile& p)
   : filename {p.filename}
   , temp_file {false}
+  , idx{ std::make_unique<index> () }
 {
 }
 
 /// Destructor. If this was a temporary file it is deleted now.
 IniFile::~IniFile()
 {
+  stop_writers ();
   if (temp_file)
+  {
     std::filesystem::remove (filename);
+    std::filesystem::remove (journal_name (filename));
+  }
 }
 
 /*!
@@ -210,8 +272,12 @@ IniFile::~IniFile()
 */
 void IniFile::File (const std::string& fname)
 {
+  stop_writers ();
   if (temp_file)
+  {
     std::filesystem::remove (filename);
+    std::filesystem::remove (journal_name (filename));
+  }
 
   if (!fname.empty())
   {
@@ -229,6 +295,7 @@ void IniFile::File (const std::string& fname)
 #endif
     temp_file = true;
   }
+  invalidate ();
 }
 
 ///  Assignment operator performs a file copy of the passed object.
@@ -240,9 +307,271 @@ IniFile& IniFile::operator = (const IniFile& p)
 #else
   std::filesystem::copy (p.filename, filename, std::filesystem::copy_options::overwrite_existing);
 #endif
+  invalidate ();
   return *this;
 }
 
+/// Write pending changes and stop asynchronous and journal modes
+void IniFile::stop_writers ()
+{
+  if (idx->async)
+  {
+    std::unique_ptr<async_writer> w;
+    {
+      std::lock_guard<std::mutex> l (idx->lock);
+      w = std::move (idx->async);
+    }
+    w->flush ();
+  }
+  if (idx->writer)
+  {
+    idx->writer.reset ();
+    stats_scope timer (idx->counters, IniStats::compact, filename);
+    compact_journal (filename);
+  }
+}
+
+/// Discard lookup index and compiled image after the file has been changed
+void IniFile::invalidate ()
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  idx->valid = false;
+  idx->image.reset ();
+}
+
+/*!
+  Find a key and return a view of its value.
+  \param  section   section name
+  \param  key       key name
+  \param  buffer    line reading buffer
+  \param  bsize     size of line reading buffer
+  \param  value     key value
+
+  \return true if key was found; false otherwise
+
+  The returned value points inside the line reading buffer. The lookup index is
+  rebuilt if the file has changed since it was last parsed.
+*/
+bool IniFile::readkey (const std::string& section, const std::string& key,
+                       char* buffer, size_t bsize, std::string_view& value) const
+{
+  stats_scope timer (idx->counters, IniStats::read, filename);
+  std::lock_guard<std::mutex> l (idx->lock);
+  if (idx->async)
+  {
+    //pending changes take precedence over journal and file content
+    int ret = idx->async->find (section.c_str (), key.c_str (), buffer, bsize, value);
+    if (ret >= 0)
+      return (ret == 1);
+  }
+  if (idx->journal.refresh (filename))
+  {
+    //changes in journal take precedence over file content
+    int ret = idx->journal.changes.find (section.c_str (), key.c_str (), value);
+    if (ret >= 0)
+    {
+      if (!ret)
+        return false; //deleted key
+      size_t len = min (value.size (), bsize - 1);
+      memcpy (buffer, value.data (), len);
+      buffer[len] = 0;
+      value = string_view (buffer, len);
+      return true;
+    }
+  }
+  if (auto img = idx->current_image (filename))
+    return img->findkey (section.c_str (), key.c_str (), buffer, bsize, value);
+
+  file_stamp st;
+  FILE* fp = openread (filename, &st);
+  if (!fp)
+    return false;
+
+  if (!idx->valid || !(idx->stamp == st))
+  {
+    idx->build (fp, st);
+    fseek (fp, 0, SEEK_SET);
+  }
+
+  const char* sn = skipleading (section.c_str ());
+  const char* kn = skipleading (key.c_str ());
+  const char *se = skiptrailing (sn), *ke = skiptrailing (kn);
+  uint32_t sect_hash = fold_hash (sn, se);
+  bool found = false;
+
+  auto ps = idx->sections.find (sect_hash);
+  if (ps != idx->sections.end () && !ps->second)
+  {
+    auto pk = idx->keys.find (index::combine (sect_hash, fold_hash (kn, ke)));
+    if (pk != idx->keys.end ())
+    {
+      //check that the line at this offset is indeed our key
+      const char *name, *end;
+      char* vs;
+      if (!fseek (fp, pk->second, SEEK_SET)
+        && read_line (buffer, (int)bsize, fp)
+        && (name = key_name (buffer, end)) != NULL
+        && fold_equal (name, end, kn, ke))
+      {
+        vs = skipleading (strchr (buffer, '=') + 1);
+        value = string_view (vs, skiptrailing (vs) - vs);
+        fclose (fp);
+        return true;
+      }
+    }
+    else
+    {
+      //section is indexed but the key is not there
+      fclose (fp);
+      return false;
+    }
+  }
+  else if (ps == idx->sections.end ())
+  {
+    fclose (fp); //no such section
+    return false;
+  }
+
+  //hash collision -> scan the file
+  fseek (fp, 0, SEEK_SET);
+  found = findkey (fp, section.c_str (), key.c_str (), buffer, bsize, value);
+  fclose (fp);
+  return found;
+}
+
+/*!
+  Enumerate the keys of a section.
+  \param section   section name
+  \param fun       function called for each key name
+  \return number of keys or -1 if file cannot be opened
+*/
+int IniFile::list_keys (const std::string& section, std::function<void (const char*)> fun) const
+{
+  stats_scope timer (idx->counters, IniStats::enumerate, filename);
+  std::lock_guard<std::mutex> l (idx->lock);
+  auto file_keys = [this, &section](std::function<void (const char*)> f) -> int {
+    if (auto img = idx->current_image (filename))
+      return img->enum_keys (section.c_str (), f);
+    FILE* fp = openread (filename);
+    if (!fp)
+      return -1;
+    int cnt = enum_keys (fp, section.c_str (), f);
+    fclose (fp);
+    return cnt;
+  };
+
+  bool journal = idx->journal.refresh (filename);
+  bool async = idx->async && !idx->async->empty ();
+  if (!journal && !async)
+    return file_keys (fun);
+
+  //merge keys from file with changes in journal and pending changes
+  vector<string> base, merged;
+  auto collect = [&merged](const char* k) {merged.push_back (k); };
+  bool found = file_keys ([&base](const char* k) {base.push_back (k); }) >= 0;
+  int cnt = (int)base.size ();
+  if (journal)
+  {
+    cnt = idx->journal.changes.merge_keys (section.c_str (), base, async ? collect : fun);
+    base.swap (merged);
+  }
+  if (async)
+    cnt = idx->async->merge_keys (section.c_str (), base, fun);
+  return (found || cnt) ? cnt : -1;
+}
+
+/*!
+  Enumerate all sections.
+  \param fun       function called for each section name
+  \return number of sections or -1 if file cannot be opened
+*/
+int IniFile::list_sections (std::function<void (const char*)> fun) const
+{
+  stats_scope timer (idx->counters, IniStats::enumerate, filename);
+  std::lock_guard<std::mutex> l (idx->lock);
+  auto file_sections = [this](std::function<void (const char*)> f) -> int {
+    if (auto img = idx->current_image (filename))
+      return img->enum_sections (f);
+    FILE* fp = openread (filename);
+    if (!fp)
+      return -1;
+    int cnt = enum_sections (fp, f);
+    fclose (fp);
+    return cnt;
+  };
+
+  bool journal = idx->journal.refresh (filename);
+  bool async = idx->async && !idx->async->empty ();
+  if (!journal && !async)
+    return file_sections (fun);
+
+  //merge sections from file with changes in journal and pending changes
+  vector<string> base, merged;
+  auto collect = [&merged](const char* s) {merged.push_back (s); };
+  bool found = file_sections ([&base](const char* s) {base.push_back (s); }) >= 0;
+  int cnt = (int)base.size ();
+  if (journal)
+  {
+    cnt = idx->journal.changes.merge_sections (base, async ? collect : fun);
+    base.swap (merged);
+  }
+  if (async)
+    cnt = idx->async->merge_sections (base, fun);
+  return (found || cnt) ? cnt : -1;
+}
+
+/*!
+  The image contains all sections and keys of the INI file, a perfect hash
+  index for key lookup and a stamp of the INI file (size, modification time
+  and hash of content). It can be later used by LoadCompiled() function to
+  avoid parsing the INI file.
+
+  Pending asynchronous changes are written and any journal file is merged into
+  the INI file before compiling.
+
+  \param image_path  name of image file
+  \return            `true` if successful, `false` otherwise
+*/
+bool IniFile::Compile (const std::string& image_path) const
+{
+  stats_scope timer (idx->counters, IniStats::compile, filename);
+  if ((idx->async && !idx->async->flush ()) || !compact_journal (filename))
+    return false;
+  file_stamp st;
+  FILE* fp = openread (filename, &st);
+  if (!fp)
+    return false;
+  bool ret = ini_image::compile (fp, st, image_path);
+  fclose (fp);
+  return ret;
+}
+
+/*!
+  The image file is memory mapped and its stamp is checked against the INI file.
+  If the image is up to date, read operations (GetString, GetKeys, GetSections
+  and the like) use the image instead of parsing the INI file.
+
+  \param image_path  name of image file produced by Compile() function
+  \return            `true` if image is valid, `false` otherwise
+
+  Before each read operation, the size and modification time of INI file
+  are checked and, if the file has changed, the image is discarded and the
+  object falls back to parsing the text file. Writing to the file through this
+  object also makes the image stale.
+*/
+bool IniFile::LoadCompiled (const std::string& image_path)
+{
+  stats_scope timer (idx->counters, IniStats::compile, filename);
+  auto img = std::make_unique<ini_image> ();
+  bool ok = img->open (image_path, filename);
+  std::lock_guard<std::mutex> l (idx->lock);
+  if (ok)
+    idx->image = std::move (img);
+  else
+    idx->image.reset ();
+  return ok;
+}
+
 /*!
   Return \b true if specified key exists in the INI file.
 */
@@ -255,23 +584,66 @@ bool IniFile::HasKey (const std::string& key, const std::string& section) const
 /*!
   \param key      key name
   \param section  section name
-  \param defval   default value if key is missing
+  \param defval   default value if key is missing or empty
+
+  As with `atoi`, parsing stops at the first character that is not part of
+  the number.
 */
 int IniFile::GetInt (const std::string& key, const std::string& section, int defval) const
 {
-  char buffer[80];
-  return GetString (buffer, sizeof (buffer), key, section) ? atoi (buffer) : defval;
+  char buffer[INI_BUFFERSIZE];
+  string_view value;
+  if (!readkey (section, key, buffer, sizeof (buffer), value) || value.empty ())
+    return defval;
+
+  if (value[0] == '+')
+    value.remove_prefix (1);
+  int ival = 0;
+  from_chars (value.data (), value.data () + value.size (), ival);
+  return ival;
+}
+
+/*
+  Convert characters to a number using from_chars(). As with `strtod`,
+  floating point numbers can also be written in hexadecimal with a "0x" prefix.
+*/
+template <typename T>
+static from_chars_result to_number (const char* first, const char* last, T& value)
+{
+  if constexpr (std::is_floating_point_v<T>)
+  {
+    const char* p = (first < last && *first == '-') ? first + 1 : first;
+    if (last - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+      auto res = from_chars (p + 2, last, value, chars_format::hex);
+      if (res.ec == errc () && p != first)
+        value = -value;
+      return res;
+    }
+  }
+  return from_chars (first, last, value);
 }
 
 /*!
   \param key      key name
   \param section  section name
-  \param defval   default value if key is missing
+  \param defval   default value if key is missing or empty
+
+  As with `atof`, parsing stops at the first character that is not part of
+  the number.
 */
 double IniFile::GetDouble (const std::string& key, const std::string& section, double defval) const
 {
-  char value[80];
-  return GetString (value, sizeof (value), key, section) ? atof (value) : defval;
+  char buffer[INI_BUFFERSIZE];
+  string_view value;
+  if (!readkey (section, key, buffer, sizeof (buffer), value) || value.empty ())
+    return defval;
+
+  if (value[0] == '+')
+    value.remove_prefix (1);
+  double dval = 0.;
+  to_number (value.data (), value.data () + value.size (), dval);
+  return dval;
 }
 
 /*!
@@ -282,7 +654,7 @@ double IniFile::GetDouble (const std::string& key, const std::string& section, d
 */
 bool IniFile::PutInt (const std::string& key, long value, const std::string& section)
 {
-  return PutString (key, std::to_string (value), section);
+  return put_value (key, (int64_t)value, section);
 }
 
 
@@ -295,8 +667,226 @@ bool IniFile::PutInt (const std::string& key, long value, const std::string& sec
 */
 bool IniFile::PutDouble (const std::string& key, double value, const std::string& section, int dec)
 {
-  char buffer[80];
-  snprintf (buffer, sizeof(buffer), "%.*lf", dec, value);
+  char buffer[400]; //large enough for DBL_MAX in fixed format
+  auto res = to_chars (buffer, buffer + sizeof (buffer) - 1, value, chars_format::fixed, (dec < 0) ? 6 : dec);
+  if (res.ec != errc ())
+    return false;
+  *res.ptr = 0;
+  return PutString (key, buffer, section);
+}
+
+// Parse an integer or floating point value. The whole string must be consumed.
+template <typename T>
+static bool parse_number (string_view str, T& value)
+{
+  if (!str.empty () && str[0] == '+')
+    str.remove_prefix (1);
+  auto last = str.data () + str.size ();
+  auto res = to_number (str.data (), last, value);
+  return res.ec == errc () && res.ptr == last;
+}
+
+// Case insensitive comparison with a lowercase ASCII word
+static bool equal_word (string_view str, const char* word)
+{
+  size_t len = strlen (word);
+  if (str.size () != len)
+    return false;
+  for (size_t i = 0; i < len; i++)
+  {
+    if ((char)::tolower ((unsigned char)str[i]) != word[i])
+      return false;
+  }
+  return true;
+}
+
+/// Parse a signed integer key
+bool IniFile::get_value (const std::string& key, const std::string& section, int64_t& value) const
+{
+  char buffer[INI_BUFFERSIZE];
+  string_view str;
+  int64_t v;
+  if (!readkey (section, key, buffer, sizeof (buffer), str)
+   || !parse_number (str, v))
+    return false;
+  value = v;
+  return true;
+}
+
+/// Parse an unsigned integer key
+bool IniFile::get_value (const std::string& key, const std::string& section, uint64_t& value) const
+{
+  char buffer[INI_BUFFERSIZE];
+  string_view str;
+  uint64_t v;
+  if (!readkey (section, key, buffer, sizeof (buffer), str)
+   || !parse_number (str, v))
+    return false;
+  value = v;
+  return true;
+}
+
+/// Parse a floating point key
+bool IniFile::get_value (const std::string& key, const std::string& section, double& value) const
+{
+  char buffer[INI_BUFFERSIZE];
+  string_view str;
+  double v;
+  if (!readkey (section, key, buffer, sizeof (buffer), str)
+   || !parse_number (str, v))
+    return false;
+  value = v;
+  return true;
+}
+
+/// Parse a boolean key
+bool IniFile::get_value (const std::string& key, const std::string& section, bool& value) const
+{
+  char buffer[INI_BUFFERSIZE];
+  string_view str;
+  if (!readkey (section, key, buffer, sizeof (buffer), str))
+    return false;
+
+  if (equal_word (str, "on") || equal_word (str, "yes") || equal_word (str, "true") || str == "1")
+    value = true;
+  else if (equal_word (str, "off") || equal_word (str, "no") || equal_word (str, "false") || str == "0")
+    value = false;
+  else
+    return false;
+  return true;
+}
+
+// Multiply with overflow check
+static bool mul_checked (int64_t a, int64_t b, int64_t& r)
+{
+  if (b > 0 ? (a > INT64_MAX / b || a < INT64_MIN / b) : b < 0)
+    return false;
+  r = a * b;
+  return true;
+}
+
+/*
+  Convert `n` units of `unum/uden` seconds in ticks of `num/den` seconds,
+  rounded to nearest. Returns `false` if the result doesn't fit in an int64_t.
+*/
+static bool scale_ticks (int64_t n, intmax_t unum, intmax_t uden, intmax_t num, intmax_t den,
+                         int64_t& ticks)
+{
+  //ticks = n * (unum * den) / (uden * num) with the fraction reduced
+  intmax_t g1 = std::gcd (unum, num), g2 = std::gcd (den, uden);
+  int64_t a, b;
+  if (!mul_checked (unum / g1, den / g2, a) || !mul_checked (uden / g2, num / g1, b))
+    return false;
+
+  int64_t q = n / b, r = n % b;
+  int64_t whole, part;
+  if (!mul_checked (q, a, whole) || !mul_checked (r, a, part))
+    return false;
+  int64_t t = part / b, rem = part % b;
+  if (rem < 0)
+    rem = -rem;
+  if (rem && rem >= b - rem)
+    t += (n < 0) ? -1 : 1;  //round half away from zero
+  if ((t > 0 && whole > INT64_MAX - t) || (t < 0 && whole < INT64_MIN - t))
+    return false;
+  ticks = whole + t;
+  return true;
+}
+
+/*!
+  Parse a duration key.
+  \param key      key name
+  \param section  section name
+  \param value    duration expressed in units of num/den seconds
+  \param whole    set to `true` if the number is an integer and the duration
+                  in ticks, rounded to nearest, fits in `ticks`
+  \param ticks    rounded number of ticks, valid only if `whole` is `true`
+  \param num      numerator of duration period
+  \param den      denominator of duration period
+
+  Integer numbers are scaled with integer arithmetic, so that large tick counts
+  don't lose precision.
+*/
+bool IniFile::get_duration (const std::string& key, const std::string& section, double& value,
+                            bool& whole, int64_t& ticks, intmax_t num, intmax_t den) const
+{
+  static const struct {
+    const char* sfx;
+    intmax_t num;   //unit is num/den seconds
+    intmax_t den;
+  } units[] = {{"ns", 1, 1000000000}, {"us", 1, 1000000}, {"ms", 1, 1000}, {"s", 1, 1},
+               {"min", 60, 1}, {"h", 3600, 1}, {"d", 86400, 1}};
+
+  char buffer[INI_BUFFERSIZE];
+  string_view str;
+  if (!readkey (section, key, buffer, sizeof (buffer), str))
+    return false;
+
+  //split number and unit suffix
+  size_t pos = str.size ();
+  while (pos && ::isalpha ((unsigned char)str[pos - 1]))
+    --pos;
+  string_view sfx = str.substr (pos);
+  str = str.substr (0, pos);
+  while (!str.empty () && (unsigned char)str.back () <= ' ')
+    str.remove_suffix (1);
+
+  intmax_t unum = num, uden = den; //no suffix: number of ticks
+  if (!sfx.empty ())
+  {
+    auto u = begin (units);
+    while (u != end (units) && !equal_word (sfx, u->sfx))
+      ++u;
+    if (u == end (units))
+      return false;
+    unum = u->num;
+    uden = u->den;
+  }
+
+  int64_t n;
+  whole = parse_number (str, n) && scale_ticks (n, unum, uden, num, den, ticks);
+
+  double v;
+  if (!parse_number (str, v))
+    return false;
+  value = v * unum / uden * den / num;
+  return true;
+}
+
+/// Write a signed integer key with an optional suffix
+bool IniFile::put_value (const std::string& key, int64_t value, const std::string& section, const char* suffix)
+{
+  char buffer[40];
+  auto res = to_chars (buffer, buffer + sizeof (buffer) - 1, value);
+  if (res.ec != errc ())
+    return false;
+  *res.ptr = 0;
+  if (suffix)
+    strcat (buffer, suffix);
+  return PutString (key, buffer, section);
+}
+
+/// Write an unsigned integer key
+bool IniFile::put_value (const std::string& key, uint64_t value, const std::string& section)
+{
+  char buffer[40];
+  auto res = to_chars (buffer, buffer + sizeof (buffer) - 1, value);
+  if (res.ec != errc ())
+    return false;
+  *res.ptr = 0;
+  return PutString (key, buffer, section);
+}
+
+/// Write a floating point key with an optional suffix
+bool IniFile::put_value (const std::string& key, double value, const std::string& section, const char* suffix)
+{
+  char buffer[40];
+  auto res = to_chars (buffer, buffer + sizeof (buffer) - 5, value);
+  if (res.ec != errc ())
+    return false;
+  *res.ptr = 0;
+  if (suffix)
+    strcat (buffer, suffix);
   return PutString (key, buffer, section);
 }
 
@@ -411,7 +1001,7 @@ HFONT IniFile::GetFont (const std::string& key, const std::string& section, HFON
   else
     lfont.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
   if (ptr && *ptr)
-    wcscpy_s (lfont.lfFaceName, utf8::widen(++ptr).c_str() );
+    wcscpy_s (lfont.lfFaceName, utf8::scoped_wide (++ptr).c_str () );
   else
     wcscpy_s (lfont.lfFaceName, L"Courier");
   return CreateFontIndirectW (&lfont);
@@ -494,18 +1084,24 @@ bool IniFile::PutFont (const std::string& key, HFONT font, const std::string& se
 
   \param key      key name
   \param section  section name
-  \param defval   default value if key is missing
+  \param defval   default value if key is missing or empty
 */
 bool IniFile::GetBool (const std::string& key, const std::string& section, bool defval) const
 {
-  char buffer[80];
+  char buffer[INI_BUFFERSIZE];
+  string_view value;
 
-  if (!GetString (buffer, sizeof(buffer), key, section))
+  if (!readkey (section, key, buffer, sizeof (buffer), value) || value.empty ())
     return defval;
-  return (!icompare (buffer, "on") 
-       || !icompare (buffer, "yes") 
-       || !icompare (buffer, "true")
-       || (atoi (buffer) == 1));
+  int ival = 0;
+  if (value[0] == '+')
+    from_chars (value.data () + 1, value.data () + value.size (), ival);
+  else
+    from_chars (value.data (), value.data () + value.size (), ival);
+  return (equal_word (value, "on")
+       || equal_word (value, "yes")
+       || equal_word (value, "true")
+       || ival == 1);
 }
 
 /*!
@@ -537,27 +1133,35 @@ bool IniFile::PutBool (const std::string& key, bool value, const std::string& se
 bool IniFile::CopySection (const IniFile& from_file, const std::string& from_sect, const std::string& to_sect)
 {
   assert (!from_sect.empty());
-  char buffer[INI_BUFFERSIZE];
 
   //trivial case: same file, same section
   if (same_file(filename, from_file.filename) && (to_sect.empty() || from_sect == to_sect) )
     return true;
 
+  stats_scope timer (idx->counters, IniStats::copy, filename);
   string dest_sect = to_sect.empty () ? from_sect : to_sect;
+  if ((idx->async && !idx->async->flush ())
+   || (from_file.idx->async && !from_file.idx->async->flush ())
+   || !compact_journal (filename) || !compact_journal (from_file.filename))
+    return false;
 
   FILE *f_out = NULL;
   FILE *f_to = NULL;
-  FILE *f_from = openread (from_file.filename);
+  file_stamp from_st, to_st;
+  FILE *f_from = openread (from_file.filename, &from_st);
   if (f_from == NULL)
     return false;
 
   //locate [from section]
-  if (!findsection (from_sect.c_str (), f_from, NULL, buffer, sizeof (buffer)))
+  long from_line, from_body, from_end;
+  if (!from_file.locate (f_from, from_st, from_sect, from_line, from_body, from_end))
   {
     fclose (f_from);   // from_sect not found
     return true;
   }
+  invalidate ();
 
+  bool ok;
   if (!std::filesystem::exists (filename))
   {
     //if destination file doesn't exist create it now
@@ -567,59 +1171,122 @@ bool IniFile::CopySection (const IniFile& from_file, const std::string& from_sec
       fclose (f_from);
       return false;
     }
-    fputs ("\xEF\xBB\xBF\r\n", f_out); //write BOM mark
+    write_line ("\xEF\xBB\xBF\r\n", f_out); //write BOM mark
+    writesection (dest_sect.c_str (), f_out);
+    ok = copy_range (f_from, from_body, from_end, f_out);
+    fclose (f_from);
+    count (&stats_counters::rewrites);
+    return (fclose (f_out) == 0) && ok;
   }
-  else
+
+  //destination file exists -> copy to temporary
+  f_to = openread (filename, &to_st);
+  if (!f_to)
   {
-    //destination file exists -> copy to temporary
-    f_to = openread (filename);
-    if (!f_to)
-    {
-      fclose (f_from);
-      return false;
-    }
-    f_out = openwrite (tempname (filename));
-    if (!f_out)
-    {
-      fclose (f_from);
-      fclose (f_to);
-      return false;
-    }
-    //copy everything up to destination section
-    findsection (dest_sect.c_str (), f_to, f_out, buffer, sizeof (buffer));
+    fclose (f_from);
+    return false;
   }
+  f_out = openwrite (tempname (filename));
+  if (!f_out)
+  {
+    fclose (f_from);
+    fclose (f_to);
+    return false;
+  }
+
+  //copy everything up to destination section
+  long to_line, to_body, to_end;
+  bool found = locate (f_to, to_st, dest_sect, to_line, to_body, to_end);
+  ok = copy_range (f_to, 0, found ? to_line : -1, f_out);
   writesection (dest_sect.c_str (), f_out);
 
   //copy [from_section]
-  while (fgets (buffer, sizeof (buffer), f_from) && *skipleading (buffer) != '[')
-    fputs (buffer, f_out);
-
+  ok = ok && copy_range (f_from, from_body, from_end, f_out);
   fclose (f_from);
 
-  //copy any remaining content
-  if (f_to)
+  //skip over previous content of destination section and copy any remaining content
+  if (ok && found && to_end >= 0)
+  {
+    write_line ("\n", f_out); // keep trailing newline at end of section
+    ok = copy_range (f_to, to_end, -1, f_out);
+  }
+  fclose (f_to);
+  ok = (fclose (f_out) == 0) && ok;
+  if (!ok)
+  {
+    utf8::remove (tempname (filename));
+    return false;
+  }
+  count (&stats_counters::rewrites);
+  return tmp_rename (filename);
+}
+
+/*!
+  Locate a section in an opened file.
+  \param fp       file handle
+  \param st       stamp of the INI file
+  \param section  section name
+  \param line     offset of section line
+  \param body     offset of first line after section line
+  \param end      offset of end of section or -1 if section ends at end of file
+  \return         true if section was found
+
+  Offsets are found using the lookup index. If the index cannot distinguish
+  the section, the file is scanned.
+*/
+bool IniFile::locate (FILE* fp, const file_stamp& st, const std::string& section,
+                      long& line, long& body, long& end) const
+{
+  const char* sn = skipleading (section.c_str ());
+  uint32_t sect_hash = fold_hash (sn, skiptrailing (sn));
   {
-    char chr = 0;
-    //skip over previous content of destination section
-    while (fgets (buffer, sizeof (buffer), f_to)
-      && ((chr = *skipleading (buffer)) != '['))
-      ;
-    if (chr == '[')
+    std::lock_guard<std::mutex> l (idx->lock);
+    if (!idx->valid || !(idx->stamp == st))
     {
-      fputs ("\n", f_out); // keep trailing newline at end of section
-      fputs (buffer, f_out);
+      fseek (fp, 0, SEEK_SET);
+      idx->build (fp, st);
+    }
+    auto ps = idx->sections.find (sect_hash);
+    if (ps == idx->sections.end ())
+      return false;
+    if (!ps->second)
+    {
+      auto& s = idx->spans.at (sect_hash);
+      line = s.line;
+      body = s.body;
+      end = s.end;
+      return true;
     }
-    while (fgets (buffer, sizeof (buffer), f_to))
-      fputs (buffer, f_out);
-    fclose (f_to);
-    fclose (f_out);
-    return tmp_rename (filename);
   }
-  else
+
+  //hash collision -> scan the file
+  char buffer[INI_BUFFERSIZE];
+  const char *sp, *ep;
+  const char* se = skiptrailing (sn);
+  long offset = 0;
+  bool found = false;
+  fseek (fp, 0, SEEK_SET);
+  while (read_line (buffer, sizeof (buffer), fp))
   {
-    fclose (f_out);
-    return true;
+    long line_offset = offset;
+    offset += (long)strlen (buffer);
+    if (found)
+    {
+      if (*skipleading (buffer) == '[')
+      {
+        end = line_offset;
+        return true;
+      }
+    }
+    else if ((sp = section_name (buffer, ep)) != NULL && fold_equal (sp, ep, sn, se))
+    {
+      found = true;
+      line = line_offset;
+      body = offset;
+    }
   }
+  end = -1;
+  return found;
 }
 
 /*!
@@ -640,7 +1307,7 @@ bool IniFile::HasSection (const std::string& section)
 */
 bool IniFile::DeleteKey (const std::string& key, const std::string& section)
 {
-  return putkey (key.c_str (), NULL, section.c_str (), filename.c_str ());
+  return update (key.c_str (), NULL, section.c_str ());
 }
 
 /*!
@@ -648,7 +1315,326 @@ bool IniFile::DeleteKey (const std::string& key, const std::string& section)
 */
 bool IniFile::DeleteSection (const std::string& section)
 {
-  return putkey (NULL, NULL, section.c_str (), filename.c_str ());
+  return update (NULL, NULL, section.c_str ());
+}
+
+/*!
+  Write or delete a key or delete a section.
+  \param key      key name or NULL to delete the section
+  \param value    key value or NULL to delete the key
+  \param section  section name
+  \return         true if successful, false otherwise
+
+  In journal mode, key changes are appended to the journal file. Otherwise,
+  or if deleting a whole section, the journal is merged into the file and the
+  file is rewritten.
+*/
+bool IniFile::update (const char* key, const char* value, const char* section)
+{
+  stats_scope timer (idx->counters, IniStats::write, filename);
+  {
+    //writer cannot be replaced by EnableAsync or DisableAsync while in use
+    std::lock_guard<std::mutex> l (idx->lock);
+    if (idx->async)
+    {
+      if (key)
+      {
+        idx->async->add (ini_change (section, key, value));
+        return true;
+      }
+      if (!idx->async->flush ())
+        return false;
+    }
+  }
+  if (key && idx->writer)
+  {
+    ini_change chg (section, key, value);
+    char buffer[INI_BUFFERSIZE];
+    string_view current;
+    bool found = readkey (chg.section, chg.key, buffer, sizeof (buffer), current);
+    if (chg.erase ? !found : (found && current == chg.value))
+    {
+      count (&stats_counters::skipped_writes);
+      return true; //nothing changes
+    }
+    return idx->writer->append (chg);
+  }
+
+  bool ret = compact_journal (filename)
+          && putkey (key, value, section, filename.c_str ());
+  invalidate ();
+  return ret;
+}
+
+/*!
+  \param max_size  journal size that triggers a compaction
+  \param max_age   maximum time between first change and compaction
+
+  In journal mode, PutString(), DeleteKey() and the other functions that change
+  key values don't rewrite the INI file. Instead, each change is appended as one
+  line to a journal file that has the same name as the INI file with ".journal"
+  added at the end.
+
+  Read operations, from this or any other %IniFile object, merge the journal
+  over the content of the INI file. A background thread compacts the journal,
+  that is, it merges it into the INI file with a single rewrite, when the
+  journal becomes larger than \p max_size or older than \p max_age.
+
+  Operations that affect a whole section (DeleteSection, CopySection) compact
+  the journal first. The journal is also compacted when the object is destroyed
+  or when journal mode is disabled.
+
+  Journal appends and compactions are synchronized only between threads of the
+  same process.
+*/
+void IniFile::EnableJournal (size_t max_size, std::chrono::milliseconds max_age)
+{
+  idx->writer.reset ();
+  idx->writer = std::make_unique<journal_writer> (filename, max_size, max_age, idx->counters);
+}
+
+/*!
+  \return `true` if journal was merged into INI file, `false` otherwise
+*/
+bool IniFile::DisableJournal ()
+{
+  idx->writer.reset ();
+  return Compact ();
+}
+
+/*!
+  \return `true` if successful or there is no journal, `false` otherwise
+
+  This function can be called in normal mode too, to merge a journal left by
+  another object.
+*/
+bool IniFile::Compact ()
+{
+  stats_scope timer (idx->counters, IniStats::compact, filename);
+  bool ret = idx->writer ? idx->writer->compact () : compact_journal (filename);
+  invalidate ();
+  return ret;
+}
+
+/*!
+  \param debounce   time without new changes after which changes are written
+  \param max_delay  maximum time a change can wait before being written
+
+  In asynchronous mode, PutString(), DeleteKey() and the other functions that
+  change key values update only an in-memory list of pending changes and return
+  immediately. Read operations of this object see the pending changes.
+
+  A background thread writes all pending changes with a single rewrite of the
+  INI file when no new change has been made for \p debounce interval, but not
+  later than \p max_delay after the oldest pending change.
+
+  Use Flush() or FlushAsync() to make sure changes have been written. Pending
+  changes are also written before operations that affect a whole section
+  (DeleteSection, CopySection), when the object is destroyed or when the
+  asynchronous mode is disabled.
+
+  Other %IniFile objects see the changes only after they have been written.
+*/
+void IniFile::EnableAsync (std::chrono::milliseconds debounce, std::chrono::milliseconds max_delay)
+{
+  auto w = std::make_unique<async_writer> (filename, debounce, max_delay, idx->counters);
+  std::unique_ptr<async_writer> old;
+  {
+    std::lock_guard<std::mutex> l (idx->lock);
+    old = std::move (idx->async);
+    idx->async = std::move (w);
+  }
+  if (old)
+    old->flush ();
+}
+
+/*!
+  \return `true` if all pending changes have been written, `false` otherwise
+*/
+bool IniFile::DisableAsync ()
+{
+  std::unique_ptr<async_writer> w;
+  {
+    std::lock_guard<std::mutex> l (idx->lock);
+    w = std::move (idx->async);
+  }
+  return w ? w->flush () : true;
+}
+
+/*!
+  \return `true` if all pending changes have been written, `false` otherwise
+
+  The function blocks until all changes made before the call are written to
+  the INI file.
+*/
+bool IniFile::Flush ()
+{
+  return idx->async ? idx->async->flush () : true;
+}
+
+/*!
+  \return a future that becomes ready when all changes made before the call have
+           been written. Its value is `true` if successful.
+
+  If there are no pending changes, the future is ready immediately.
+*/
+std::future<bool> IniFile::FlushAsync ()
+{
+  if (idx->async)
+    return idx->async->flush_async ();
+
+  std::promise<bool> done;
+  done.set_value (true);
+  return done.get_future ();
+}
+
+/*!
+  \param name  name of shared memory segment
+  \return      `true` if a current image has been attached, `false` otherwise
+
+  In shared mode, the first process that reads the INI file publishes a compiled
+  image (see Compile()) of the file in a shared memory segment. Other processes
+  that use the same name attach to this image and read values directly from
+  it instead of parsing the file.
+
+  When the INI file changes, the next process that reads it publishes a new
+  image, with a new generation number, and the other processes switch to it.
+  Segments of older generations are unlinked; processes that still use them
+  keep them mapped until they switch.
+
+  \p name must be a valid POSIX shared memory name; a '/' is added in front if
+  missing. The function returns `false` if shared memory is not available
+  (on Windows) or if the image could not be published. In this case read
+  operations use the file and publishing is retried later.
+*/
+bool IniFile::EnableShared (const std::string& name)
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  idx->image.reset ();
+  idx->shared = std::make_unique<shared_snapshot> (name);
+  return idx->current_image (filename) != nullptr;
+}
+
+/// Stop using the image in shared memory
+void IniFile::DisableShared ()
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  idx->shared.reset ();
+  idx->image.reset ();
+}
+
+/*!
+  \param name  name of shared memory segment
+  \return      `true` if segments have been removed
+
+  The function removes the names of the shared memory segments used by
+  EnableShared(). Processes that have them mapped can still use them.
+*/
+bool IniFile::RemoveShared (const std::string& name)
+{
+  return shared_snapshot::remove (name);
+}
+
+/*!
+  Counters include operations performed by background threads on behalf of
+  this object. They are not copied when the object is copied.
+
+  Timing is done per public operation: if an operation performs other
+  operations (for instance a write in journal mode reads the current value),
+  the time is counted only for the outer one. I/O counters include all
+  operations.
+*/
+IniStats IniFile::stats () const
+{
+  return idx->counters.snapshot ();
+}
+
+/*!
+  Counters are the sums of counters of all %IniFile objects, including the
+  ones that have been destroyed.
+*/
+IniStats IniFile::global_stats ()
+{
+  return global_counters ().snapshot ();
+}
+
+static std::mutex callback_lock;
+static IniFile::stats_callback callback;
+static std::atomic<bool> has_callback{ false };
+
+/*!
+  \param cb   function called with file name, kind and duration of each
+              operation or an empty function to stop calling it
+
+  The function can be used to export timings to a monitoring system. It is
+  called after the operation has finished, on the thread that performed the
+  operation, which can be a background writer thread.
+*/
+void IniFile::set_stats_callback (stats_callback cb)
+{
+  std::lock_guard<std::mutex> l (callback_lock);
+  callback = std::move (cb);
+  has_callback = (bool)callback;
+}
+
+/// Return a copy of counter values
+IniStats stats_counters::snapshot () const
+{
+  IniStats st;
+  st.opens = opens;
+  st.bytes_read = bytes_read;
+  st.bytes_written = bytes_written;
+  st.rewrites = rewrites;
+  st.skipped_writes = skipped_writes;
+  st.rename_retries = rename_retries;
+  for (int i = 0; i < IniStats::op_count; i++)
+  {
+    st.calls[i] = calls[i];
+    st.time[i] = std::chrono::nanoseconds (nanos[i]);
+  }
+  return st;
+}
+
+stats_counters& global_counters ()
+{
+  static stats_counters counters;
+  return counters;
+}
+
+stats_scope::stats_scope (stats_counters& obj_, IniStats::op kind_, const std::string& file_)
+  : obj (current_counters () ? nullptr : &obj_)
+  , kind (kind_)
+  , file (file_)
+{
+  if (obj)
+  {
+    current_counters () = obj;
+    start = std::chrono::steady_clock::now ();
+  }
+}
+
+stats_scope::~stats_scope ()
+{
+  if (!obj)
+    return; //nested operation
+  auto duration = std::chrono::duration_cast<std::chrono::nanoseconds> (
+    std::chrono::steady_clock::now () - start);
+  current_counters () = nullptr;
+  stats_counters& all = global_counters ();
+  obj->calls[kind]++;
+  obj->nanos[kind] += duration.count ();
+  all.calls[kind]++;
+  all.nanos[kind] += duration.count ();
+  if (has_callback)
+  {
+    IniFile::stats_callback cb;
+    {
+      std::lock_guard<std::mutex> l (callback_lock);
+      cb = callback;
+    }
+    if (cb)
+      cb (file, kind, duration);
+  }
 }
 
 /*!
@@ -661,15 +1647,11 @@ bool IniFile::DeleteSection (const std::string& section)
 */
 int IniFile::GetKeys (char *keys, size_t sz, const std::string& section)
 {
-  FILE* fp;
-
   if (keys == 0 || sz == 0)
     return 0;
 
-  if (!(fp = openread(filename)))
-    return 0;
-
   int cnt = 0;
+  char* first = keys;
   sz -= 2;   //leave space for terminating NULL
 
   auto f = [&keys, &sz] (const char *k) 
@@ -680,9 +1662,12 @@ int IniFile::GetKeys (char *keys, size_t sz, const std::string& section)
       *keys++ = 0;
       sz -= l + 1;
     };
-  cnt = enum_keys (fp, section.c_str (), f);
+  if ((cnt = list_keys (section, f)) < 0)
+  {
+    *first = 0;
+    return 0;
+  }
   *keys++ = 0; // append one final null
-  fclose (fp);
   return cnt;
 }
 
@@ -695,17 +1680,13 @@ int IniFile::GetKeys (char *keys, size_t sz, const std::string& section)
 */
 size_t IniFile::GetKeys (std::deque<std::string>& keys, const std::string& section)
 {
-  FILE* fp;
-
-  if (!(fp = openread (filename)))
+  deque<string> found;
+  auto f = [&found](const char *key) {found.push_back (key); };
+  int cnt = list_keys (section, f);
+  if (cnt < 0)
     return 0;
 
-  keys.clear ();
-
-  auto f = [&keys](const char *key) {keys.push_back (key); };
-  int cnt = enum_keys (fp, section.c_str (), f);
-
-  fclose (fp);
+  keys = std::move (found);
   return cnt;
 }
 
@@ -719,22 +1700,17 @@ size_t IniFile::GetKeys (std::deque<std::string>& keys, const std::string& secti
 */
 size_t IniFile::GetString (char *value, size_t len, const std::string& key, const std::string& section, const std::string& defval) const
 {
-  FILE *fp;
-  bool found = false;
+  char buffer[INI_BUFFERSIZE];
+  string_view found;
 
   if (!value || !len)
     return 0;
-  fp = openread (filename);
-  if (fp) 
-  {
-    found = getkey (fp, section.c_str(), key.c_str(), value, len);
-    fclose(fp);
-  }
-  if (!found)
-  {
-    strncpy (value, defval.c_str (), len - 1);
-    value[len - 1] = 0;
-  }
+  if (!readkey (section, key, buffer, sizeof (buffer), found))
+    found = defval;
+
+  size_t sz = min (found.size (), len - 1);
+  memcpy (value, found.data (), sz);
+  value[sz] = 0;
   return strlen (value);
 }
 
@@ -746,16 +1722,11 @@ size_t IniFile::GetString (char *value, size_t len, const std::string& key, cons
 */
 std::string IniFile::GetString (const std::string& key, const std::string& section, const std::string& defval) const
 {
-  FILE *fp;
-  bool found = false;
   char buffer[INI_BUFFERSIZE];
-  fp = openread (filename);
-  if (fp)
-  {
-    found = getkey (fp, section.c_str(), key.c_str(), buffer, sizeof(buffer));
-    fclose (fp);
-  }
-  return found ? buffer : defval;
+  string_view value;
+  if (!readkey (section, key, buffer, sizeof (buffer), value))
+    return defval;
+  return std::string (value);
 }
 
 
@@ -767,7 +1738,7 @@ std::string IniFile::GetString (const std::string& key, const std::string& secti
 */
 bool IniFile::PutString (const std::string& key, const std::string& value, const std::string& section)
 {
-  return putkey (key.c_str (), value.c_str (), section.c_str (), filename.c_str ());
+  return update (key.c_str (), value.c_str (), section.c_str ());
 }
 
 /*!
@@ -788,9 +1759,6 @@ size_t IniFile::GetSections (char *sects, size_t sz)
   assert (sects);
   assert (sz);
 
-  FILE *fp = openread (filename);
-  int cnt = 0;
-
   auto f = [&sects, &sz](const char *s)
   {
     if (sz)
@@ -804,13 +1772,12 @@ size_t IniFile::GetSections (char *sects, size_t sz)
   };
 
   sz--; //leave space for final null
-  if (fp)
+  int cnt = list_sections (f);
+  if (cnt < 0)
   {
-    cnt = enum_sections (fp, f);
-    fclose (fp);
-  }
-  else
     *sects++ = 0;
+    cnt = 0;
+  }
   *sects = 0; //terminating null
   return cnt;
 }
@@ -823,17 +1790,156 @@ size_t IniFile::GetSections (char *sects, size_t sz)
 */
 size_t IniFile::GetSections (std::deque<std::string>& sects)
 {
-  FILE *fp = openread (filename);
-  int cnt = 0;
   auto f = [&sects](const char *s) {sects.push_back (s); };
 
   sects.clear ();
-  if (fp)
+  int cnt = list_sections (f);
+  return (cnt < 0) ? 0 : cnt;
+}
+
+//-----------------------------------------------------------------------------
+// Iterators over files mapped in memory
+
+/*!
+  Section names are views in the INI file mapped in memory. Names are found
+  while iterating, without allocating any memory.
+
+  \code
+    utf8::IniFile ini ("settings.ini");
+    for (auto name : ini.sections ())
+      std::cout << name << std::endl;
+  \endcode
+
+  Names are returned in the same way as GetSections() function returns them.
+  Pending asynchronous changes are written and any journal file is merged
+  into the INI file before mapping it.
+*/
+IniSections IniFile::sections () const
+{
+  stats_scope timer (idx->counters, IniStats::enumerate, filename);
+  IniSections range;
+  sync ();
+  auto m = std::make_shared<detail::mapping> ();
+  if (m->open (filename) && m->data ())
   {
-    cnt = enum_sections (fp, f);
-    fclose (fp);
+    range.first = m->data ();
+    range.last = range.first + m->size ();
+    range.map = std::move (m);
   }
-  return cnt;
+  return range;
+}
+
+/*!
+  \param section  section name
+
+  Keys and values are views in the INI file mapped in memory.
+
+  \code
+    utf8::IniFile ini ("settings.ini");
+    for (auto& [key, value] : ini.entries ("section"))
+      std::cout << key << '=' << value << std::endl;
+  \endcode
+
+  As in GetKeys() function, only the first section with the given name is used.
+  Keys and values have leading and trailing spaces removed. Pending asynchronous
+  changes are written and any journal file is merged into the INI file before
+  mapping it.
+*/
+IniEntries IniFile::entries (const std::string& section) const
+{
+  stats_scope timer (idx->counters, IniStats::enumerate, filename);
+  IniEntries range;
+  sync ();
+  auto m = std::make_shared<detail::mapping> ();
+  if (!m->open (filename) || !m->data ())
+    return range;
+
+  const char* sn = skipleading (section.c_str ());
+  const char* se = skiptrailing (sn);
+  const char* p = m->data ();
+  const char* last = p + m->size ();
+  string_view name;
+  for (; p < last; p = line_end (p, last))
+  {
+    if (!view_section (p, line_end (p, last), name))
+      continue;
+    const char* name_end = name.data () + name.size ();
+    if (fold_equal (skip_spaces (name.data (), name_end), name_end, sn, se))
+      break;
+  }
+  if (p == last)
+    return range; //section not found
+
+  range.first = p = line_end (p, last);
+  for (; p < last; p = line_end (p, last))
+  {
+    const char* eol = line_end (p, last);
+    const char* sp = skip_spaces (p, eol);
+    if (sp < eol && *sp == '[')
+      break;  //next section
+  }
+  range.last = p;
+  range.map = std::move (m);
+  return range;
+}
+
+/// Map a file in memory. UTF-16 files are transcoded to UTF-8.
+bool detail::mapping::open (const std::string& filename)
+{
+  text.clear ();
+  if (!file.open (filename))
+    return false;
+  bool big_endian;
+  if (utf16_bom ((const unsigned char*)file.data (), file.size (), big_endian))
+  {
+    utf16_to_utf8 (file.data () + 2, file.size () - 2, big_endian, text);
+    file.close ();
+  }
+  return true;
+}
+
+/// Write pending changes before reading the file directly
+void IniFile::sync () const
+{
+  if (idx->async)
+    idx->async->flush ();
+  compact_journal (filename);
+}
+
+IniSections::iterator::iterator (const char* first, const char* last_)
+  : pos {first}
+  , last {last_}
+{
+  for (; pos && pos < last; pos = line_end (pos, last))
+  {
+    if (view_section (pos, line_end (pos, last), name))
+      return;
+  }
+  pos = nullptr;
+}
+
+void IniSections::iterator::next ()
+{
+  if (pos)
+    *this = iterator (line_end (pos, last), last);
+}
+
+IniEntries::iterator::iterator (const char* first, const char* last_)
+  : pos {first}
+  , last {last_}
+{
+  for (; pos && pos < last; pos = line_end (pos, last))
+  {
+    if (view_entry (pos, line_end (pos, last), entry))
+      return;
+  }
+  pos = nullptr;
+}
+
+void IniEntries::iterator::next ()
+{
+  if (pos)
+    *this = iterator (line_end (pos, last), last);
 }
 
 // Invoke an enumeration function on each section of an INI file
@@ -842,7 +1948,7 @@ static int enum_sections (FILE *fp, std::function<void (const char *str)> func)
   char buffer[INI_BUFFERSIZE];
   int cnt = 0;
   char *sp, *ep;
-  while (fgets (buffer, sizeof (buffer), fp))
+  while (read_line (buffer, sizeof (buffer), fp))
   {
     sp = skipleading (buffer);
     if (*sp++ == '[' && (ep = strchr (sp, ']')))
@@ -867,7 +1973,7 @@ static int enum_keys (FILE* fp, const char *section, std::function<void(const ch
 
   //Start enumerating keys
   char *sp;
-  while (fgets (buffer, sizeof (buffer), fp) && *(sp = skipleading (buffer)) != '[')
+  while (read_line (buffer, sizeof (buffer), fp) && *(sp = skipleading (buffer)) != '[')
   {
     char *ep;
     if (*sp == ';' || !(ep=strchr (sp, '='))) //ignore comment or malformed lines
@@ -896,29 +2002,23 @@ static int enum_keys (FILE* fp, const char *section, std::function<void(const ch
 */
 static bool findsection (const char *section, FILE *rf, FILE *wf, char *buffer, size_t bsize)
 {
-  const char *sp;
-  size_t len;
+  const char *sp, *ep;
 
   assert (section);
   assert (rf);
 
   section = skipleading (section);
-  len = trimmed_len (section);
+  const char* section_end = skiptrailing (section);
 
   while (true)
   {
-    if (!fgets (buffer, (int)bsize, rf))
+    if (!read_line (buffer, (int)bsize, rf))
       return false;
-    sp = skipleading (buffer);
-    if (*sp == '[' && strchr(buffer, ']'))
-    {
-      sp = skipleading (sp + 1);
-      
-      if (!icomparen (sp, section, len))
-        return true;
-    }
+    if ((sp = section_name (buffer, ep)) != NULL
+      && fold_equal (sp, ep, section, section_end))
+      return true;
     if (wf)
-      fputs (buffer, wf);
+      write_line (buffer, wf);
   }
 }
 
@@ -942,7 +2042,6 @@ static bool putkey (const char *key, const char *value, const char *section, con
 
   char buffer[INI_BUFFERSIZE];
   const char* sp;
-  size_t len;
 
   assert (section);
 
@@ -954,10 +2053,11 @@ static bool putkey (const char *key, const char *value, const char *section, con
       if (!(wfp = openwrite (filename)))
         return false;
 
-      fputs ("\xEF\xBB\xBF\r\n", wfp); //write BOM mark
+      write_line ("\xEF\xBB\xBF\r\n", wfp); //write BOM mark
       writesection(section, wfp);
       writekey(key, value, wfp);
       fclose(wfp);
+      count (&stats_counters::rewrites);
     }
     return true;
   }
@@ -970,6 +2070,7 @@ static bool putkey (const char *key, const char *value, const char *section, con
     && !strcmp (buffer, value))
   {
     fclose (rfp);
+    count (&stats_counters::skipped_writes);
     return true;
   }
   // key not found, or different value -> proceed (but rewind the input file first)
@@ -994,15 +2095,16 @@ static bool putkey (const char *key, const char *value, const char *section, con
         *ep++ = '\n';
         *ep = 0;
       }
-      fputs (buffer, wfp); //write section line
+      write_line (buffer, wfp); //write section line
 
       //start searching for key
       key = skipleading (key);
-      len = trimmed_len (key);
-      while ( (sp=fgets (buffer, sizeof (buffer), rfp))  // not end of file
+      const char* key_end = skiptrailing (key);
+      const char *kp, *ke;
+      while ( (sp=read_line (buffer, sizeof (buffer), rfp))  // not end of file
            && *(sp = skipleading (buffer)) != '['   // not end of section
-           && (!strchr (buffer, '=') || icomparen (key, sp, len))) //key not found
-        fputs (buffer, wfp);
+           && (!(kp = key_name (buffer, ke)) || !fold_equal (kp, ke, key, key_end))) //key not found
+        write_line (buffer, wfp);
 
       if (value)
         writekey (key, value, wfp);
@@ -1011,18 +2113,18 @@ static bool putkey (const char *key, const char *value, const char *section, con
     else
     {
       //deleting the section -> skip all entries until next section or end of file 
-      while ((sp = fgets (buffer, sizeof (buffer), rfp)) && *(sp = skipleading (buffer)) != '[')
+      while ((sp = read_line (buffer, sizeof (buffer), rfp)) && *(sp = skipleading (buffer)) != '[')
         ;
     }
     if (sp && *sp == '[')
-      fputs (buffer, wfp); //write next section line
+      write_line (buffer, wfp); //write next section line
     // Copy the rest of the INI file
-    while (fgets (buffer, sizeof (buffer), rfp))
-      fputs (buffer, wfp);
+    while (read_line (buffer, sizeof (buffer), rfp))
+      write_line (buffer, wfp);
   }
   else if (key && value)
   {
-    fputs ("\n", wfp);  /* force a new line behind the last line of the INI file */
+    write_line ("\n", wfp);  /* force a new line behind the last line of the INI file */
     writesection (section, wfp);
     writekey (key, value, wfp);
   }
@@ -1032,10 +2134,12 @@ static bool putkey (const char *key, const char *value, const char *section, con
     fclose (rfp);
     fclose (wfp);
     std::filesystem::remove (tempname (filename));
+    count (&stats_counters::skipped_writes);
     return true;
   }
   fclose (rfp);
   fclose (wfp);
+  count (&stats_counters::rewrites);
   return tmp_rename (filename);  // clean up and rename
 }
 
@@ -1051,78 +2155,115 @@ static bool putkey (const char *key, const char *value, const char *section, con
 */
 static bool getkey(FILE *fp, const char *section, const char *key, char *val, size_t size)
 {
-  const char *sp;
-  char *vs, *ve;  //value start /end pointers
-  size_t len;
   char buffer[INI_BUFFERSIZE];
+  string_view value;
+
+  if (!findkey (fp, section, key, buffer, sizeof (buffer), value))
+    return false;
+
+  // Copy up to 'size' chars to buffer
+  size_t len = min (value.size (), size - 1);
+  memcpy (val, value.data (), len);
+  val[len] = 0;
+  return true;
+}
+
+/*!
+  Locate a key and return a view of its value.
+  \param  fp      input file
+  \param  section section name
+  \param  key     input key
+  \param  buffer  line reading buffer
+  \param  bsize   size of line reading buffer
+  \param  value   key value with leading and trailing spaces removed
+
+  \return true if key was found; false otherwise
+
+  The returned value points inside the line reading buffer.
+*/
+static bool findkey (FILE *fp, const char *section, const char *key, char *buffer, size_t bsize, string_view& value)
+{
+  const char *sp, *ep;
+  char *vs, *ve;  //value start /end pointers
   assert (fp);
   assert (section);
   assert (key);
   
   // Move through file 1 line at a time until the section is matched or EOF.
-  if (!findsection (section, fp, NULL, buffer, sizeof(buffer)))
+  if (!findsection (section, fp, NULL, buffer, bsize))
     return false;
 
   /* Now that the section has been found, find the entry.
      Stop searching upon leaving the section's area. */
   key = skipleading (key);
-  len = trimmed_len (key);
+  const char* key_end = skiptrailing (key);
   bool found = false;
   do 
   {
-    if (!fgets (buffer, sizeof (buffer), fp) || *(sp = skipleading (buffer)) == '[')
+    if (!read_line (buffer, (int)bsize, fp) || *skipleading (buffer) == '[')
       return false;
-    if (*sp == ';' || !(vs = strchr (buffer, '=')))  //Ignore comment or malformed lines
+    if (!(sp = key_name (buffer, ep)))  //Ignore comment or malformed lines
       continue;
-    found = !icomparen (sp, key, len);
+    found = fold_equal (sp, ep, key, key_end);
   } while (!found);
 
-  // Copy up to 'size' chars to buffer
-  assert (vs != NULL);
-  vs = skipleading(vs + 1);
+  vs = skipleading(strchr (buffer, '=') + 1);
   ve = skiptrailing (vs);
-  *ve = 0;
-  strncpy (val, vs, size-1);
-  val[size - 1] = 0;
+  value = string_view (vs, ve - vs);
   return true;
 }
 
-/// Writes a section entry
-static void writesection (const char* section, FILE *fp)
+/// Return a section line or an empty string if section name is empty
+std::string section_line (const char* section)
 {
   char buffer[INI_BUFFERSIZE];
   assert (section);
   section = skipleading (section);
-  if (strlen (section) > 0)
-  {
-    buffer[0] = '[';
-    strncpy (buffer + 1, section, sizeof (buffer) - 5 );
-    trimtrailing (buffer);
-    strcat (buffer, "]\r\n");
-    fputs (buffer, fp);
-  }
+  if (strlen (section) == 0)
+    return std::string ();
+
+  buffer[0] = '[';
+  strncpy (buffer + 1, section, sizeof (buffer) - 5 );
+  buffer[sizeof (buffer) - 4] = 0;
+  trimtrailing (buffer);
+  strcat (buffer, "]\r\n");
+  return buffer;
 }
 
-/// Writes a key entry
-static void writekey (const char* key, const char* value, FILE *fp)
+/// Return a key line
+std::string key_line (const char* key, const char* value)
 {
   char buffer[INI_BUFFERSIZE];
   char *p;
   key = skipleading (key);
   strncpy (buffer, key, sizeof (buffer) - 3);
+  buffer[sizeof (buffer) - 3] = 0;
   p = trimtrailing (buffer);
   *p++ = '=';
   strncpy (p, skipleading(value), sizeof (buffer) - (p - buffer) - 3);
+  buffer[sizeof (buffer) - 3] = 0;
   p = trimtrailing (p);
   *p++ = '\r';  *p++ = '\n';
   *p = 0;
-  fputs (buffer, fp);
+  return buffer;
+}
+
+/// Writes a section entry
+static void writesection (const char* section, FILE *fp)
+{
+  write_line (section_line (section).c_str (), fp);
+}
+
+/// Writes a key entry
+static void writekey (const char* key, const char* value, FILE *fp)
+{
+  write_line (key_line (key, value).c_str (), fp);
 }
 
 
 /// Renames the output (temporary) file to input file name.
 /// Previous input file is deleted.
-static bool tmp_rename (const std::string& filename)
+bool tmp_rename (const std::string& filename)
 {
   const int RETRIES = 50;
   int i;
@@ -1134,6 +2275,7 @@ static bool tmp_rename (const std::string& filename)
   i = 0;
   while (i++ < RETRIES && !utf8::remove(filename))
     std::this_thread::yield ();
+  count (&stats_counters::rename_retries, i - 1);
 
   if (i >= RETRIES)
     return false;
@@ -1141,10 +2283,220 @@ static bool tmp_rename (const std::string& filename)
   i = 0;
   while (i++ < RETRIES && !utf8::rename(tmpname, filename))
     std::this_thread::yield ();
+  count (&stats_counters::rename_retries, i - 1);
 
   return (i < RETRIES);
 }
 
+namespace {
+/*
+  Transcoded copies of UTF-16 INI files. Each entry maps a file name to the
+  stamp of the source file and the path of its UTF-8 translation. The copies
+  are removed when the program ends.
+*/
+struct utf16_cache {
+  struct entry {
+    file_stamp stamp;
+    std::filesystem::path path;
+  };
+
+  ~utf16_cache ()
+  {
+    std::error_code ec;
+    for (auto& f : files)
+      std::filesystem::remove (f.second.path, ec);
+  }
+
+  static utf16_cache& instance ()
+  {
+    static utf16_cache c;
+    return c;
+  }
+
+  // Create a new temporary file, opened for reading and writing.
+  static FILE* create (std::filesystem::path& path)
+  {
+    std::error_code ec;
+    auto dir = std::filesystem::temp_directory_path (ec);
+    if (ec)
+      return NULL;
+    std::random_device rd;
+    for (int i = 0; i < 16; i++)
+    {
+      char name[32];
+      snprintf (name, sizeof (name), "utf8ini-%08x%08x.tmp", rd (), rd ());
+      path = dir / name;
+#ifdef _WIN32
+      FILE* fp = _wfopen (path.c_str (), L"wb+x");
+#else
+      FILE* fp = fopen (path.c_str (), "wb+x");
+#endif
+      if (fp)
+      {
+        count (&stats_counters::opens);
+        return fp;
+      }
+    }
+    return NULL;
+  }
+
+  std::mutex lock;
+  std::unordered_map<std::string, entry> files;
+};
+}
+
+/*
+  Transcode a UTF-16 file to UTF-8 in blocks. Returns `true` if successful.
+  Memory use doesn't depend on file size.
+*/
+static bool transcode_utf16 (FILE* in, FILE* out, bool big_endian)
+{
+  std::vector<char> buf (64 * 1024);
+  std::string text;
+  size_t keep = 0, n;
+  while ((n = read_bytes (buf.data () + keep, 1, buf.size () - keep, in)) > 0)
+  {
+    n += keep;
+    text.clear ();
+    size_t used = utf16_to_utf8 (buf.data (), n, big_endian, text, false);
+    if (fwrite (text.data (), 1, text.size (), out) != text.size ())
+      return false;
+    keep = n - used;
+    memmove (buf.data (), buf.data () + used, keep);
+  }
+  if (ferror (in))
+    return false;
+  text.clear ();
+  utf16_to_utf8 (buf.data (), keep, big_endian, text);
+  return fwrite (text.data (), 1, text.size (), out) == text.size ();
+}
+
+/*!
+  Replace a UTF-16 file with a temporary file containing its UTF-8 translation.
+  \param fp          file positioned after the BOM. It is closed by this function.
+  \param fname       name of INI file
+  \param big_endian  `true` if file is UTF-16BE, `false` if it is UTF-16LE
+  \return            temporary file or NULL if an error occurred
+
+  The translation is kept and reused as long as the stamp of the INI file
+  doesn't change, so repeated reads don't transcode the file again.
+
+  The BOM is not part of the translated content. When the INI file is later
+  rewritten, it is written in UTF-8 encoding.
+*/
+FILE* open_utf16 (FILE* fp, const std::string& fname, bool big_endian)
+{
+  auto& cache = utf16_cache::instance ();
+  file_stamp st = get_stamp (fp);
+  {
+    std::lock_guard<std::mutex> l (cache.lock);
+    auto p = cache.files.find (fname);
+    if (p != cache.files.end () && p->second.stamp == st)
+    {
+#ifdef _WIN32
+      FILE* cached = _wfopen (p->second.path.c_str (), L"rb");
+#else
+      FILE* cached = fopen (p->second.path.c_str (), "rb");
+#endif
+      if (cached)
+      {
+        count (&stats_counters::opens);
+        fclose (fp);
+        return cached;
+      }
+    }
+  }
+
+  std::filesystem::path path;
+  FILE* tmp = utf16_cache::create (path);
+  bool ok = tmp && transcode_utf16 (fp, tmp, big_endian);
+  fclose (fp);
+  if (!ok || fflush (tmp) || fseek (tmp, 0, SEEK_SET))
+  {
+    if (tmp)
+    {
+      fclose (tmp);
+      std::error_code ec;
+      std::filesystem::remove (path, ec);
+    }
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> l (cache.lock);
+  auto& e = cache.files[fname];
+  if (!e.path.empty ())
+  {
+    std::error_code ec;
+    std::filesystem::remove (e.path, ec);
+  }
+  e = { st, path };
+  return tmp;
+}
+
+/*!
+  Copy a range of bytes from one file to another.
+  \param in     input file
+  \param begin  offset of first byte
+  \param end    offset of end of range or -1 to copy until end of file
+  \param out    output file
+  \return       true if successful
+
+  On Linux, data is copied by the kernel using copy_file_range() or sendfile().
+  Otherwise it is copied in large blocks.
+*/
+static bool copy_range (FILE* in, long begin, long end, FILE* out)
+{
+  if (end >= 0 && end <= begin)
+    return true;
+  if (fflush (out))
+    return false;
+  size_t len = (end < 0) ? SIZE_MAX : (size_t)(end - begin);
+
+#ifdef __linux__
+  int fdi = fileno (in), fdo = fileno (out);
+  off_t off = begin;
+  bool use_sendfile = false;
+  while (len)
+  {
+    size_t chunk = min (len, (size_t)0x40000000);
+    ssize_t n = use_sendfile ? sendfile (fdo, fdi, &off, chunk)
+                             : copy_file_range (fdi, &off, fdo, NULL, chunk, 0);
+    if (n < 0 && !use_sendfile && (errno == EXDEV || errno == ENOSYS
+      || errno == EINVAL || errno == EOPNOTSUPP))
+    {
+      use_sendfile = true;  //copy_file_range not supported for these files
+      continue;
+    }
+    if (n < 0)
+      break;  //try with read/write
+    if (n == 0)
+      return fseek (out, 0, SEEK_END) == 0;  //end of file
+    count (&stats_counters::bytes_read, n);
+    count (&stats_counters::bytes_written, n);
+    len -= n;
+  }
+  if (!len)
+    return fseek (out, 0, SEEK_END) == 0;
+  begin = (long)off;
+  if (fseek (out, 0, SEEK_END))
+    return false;
+#endif
+
+  std::vector<char> buf (65536);
+  if (fseek (in, begin, SEEK_SET))
+    return false;
+  while (len)
+  {
+    size_t n = read_bytes (buf.data (), 1, min (len, buf.size ()), in);
+    if (!n)
+      break;
+    if (write_bytes (buf.data (), 1, n, out) != n)
+      return false;
+    len -= n;
+  }
+  return !ferror (in);
+}
+
 /// Return true if 2 file names refer to the same file
 static bool same_file (const std::string& f1, const std::string& f2)
 {
@@ -0,0 +1,195 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file iniasync.cpp Background writing of INI file changes.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  Changes are kept in memory until the writer thread writes them to the file.
+  Changes are written when no new change was received for a 'debounce'
+  interval, but not later than 'max_delay' after the oldest pending change.
+  All pending changes are written with a single rewrite of the file.
+
+  Changes remain visible to readers while they are being written and they are
+  discarded only after the file has been successfully updated.
+*/
+
+namespace utf8 {
+
+async_writer::async_writer (const std::string& filename_, std::chrono::milliseconds debounce_,
+                            std::chrono::milliseconds max_delay_, stats_counters& counters_)
+  : filename (filename_)
+  , counters (counters_)
+  , debounce (debounce_)
+  , max_delay (max_delay_)
+{
+  worker = std::thread (&async_writer::run, this);
+}
+
+/// Write any pending changes and stop writer thread
+async_writer::~async_writer ()
+{
+  {
+    std::lock_guard<std::mutex> l (lock);
+    stop = true;
+  }
+  cv.notify_one ();
+  worker.join ();
+}
+
+/// Add a new change
+void async_writer::add (ini_change&& chg)
+{
+  std::lock_guard<std::mutex> l (lock);
+  last = std::chrono::steady_clock::now ();
+  if (pending.empty ())
+    first = last;
+  pending.add (std::move (chg));
+  queued++;
+  cv.notify_one ();
+}
+
+/// Return true if there are no pending changes
+bool async_writer::empty ()
+{
+  std::lock_guard<std::mutex> l (lock);
+  return pending.empty ();
+}
+
+/*
+  Find a pending change of a key. The value is copied in the buffer.
+  Returns 1 if the key has a new value, 0 if the key has been deleted and -1
+  if the key hasn't been changed.
+*/
+int async_writer::find (const char* section, const char* key, char* buffer, size_t bsize,
+                        std::string_view& value)
+{
+  std::lock_guard<std::mutex> l (lock);
+  int ret = pending.find (section, key, value);
+  if (ret == 1)
+  {
+    size_t len = min (value.size (), bsize - 1);
+    memcpy (buffer, value.data (), len);
+    buffer[len] = 0;
+    value = std::string_view (buffer, len);
+  }
+  return ret;
+}
+
+/// Merge keys of a section with pending changes
+int async_writer::merge_keys (const char* section, const std::vector<std::string>& base,
+                              std::function<void (const char*)> fun)
+{
+  std::lock_guard<std::mutex> l (lock);
+  return pending.merge_keys (section, base, fun);
+}
+
+/// Merge sections with pending changes
+int async_writer::merge_sections (const std::vector<std::string>& base,
+                                  std::function<void (const char*)> fun)
+{
+  std::lock_guard<std::mutex> l (lock);
+  return pending.merge_sections (base, fun);
+}
+
+/*
+  Request writing of all changes received so far. The future becomes ready
+  when the changes have been written. Its value is `true` if successful.
+*/
+std::future<bool> async_writer::flush_async ()
+{
+  std::promise<bool> done;
+  auto ret = done.get_future ();
+  std::lock_guard<std::mutex> l (lock);
+  if (pending.empty ())
+    done.set_value (true);
+  else
+  {
+    waiters.emplace_back (queued, std::move (done));
+    flush_now = true;
+    cv.notify_one ();
+  }
+  return ret;
+}
+
+/// Write all changes received so far and wait until they are written
+bool async_writer::flush ()
+{
+  return flush_async ().get ();
+}
+
+/// Writer thread
+void async_writer::run ()
+{
+  std::unique_lock<std::mutex> l (lock);
+  while (true)
+  {
+    if (pending.empty ())
+    {
+      if (stop)
+        break;
+      cv.wait (l);
+      continue;
+    }
+    auto deadline = std::min (last + debounce, first + max_delay);
+    if (!stop && !flush_now && std::chrono::steady_clock::now () < deadline)
+    {
+      cv.wait_until (l, deadline);
+      continue;
+    }
+
+    flush_now = false;
+    std::vector<ini_change> batch = pending.list ();
+    uint64_t target = queued;
+    l.unlock ();
+    bool ok;
+    {
+      stats_scope timer (counters, IniStats::flush, filename);
+      ok = compact_journal (filename) && apply_changes (filename, batch);
+    }
+    l.lock ();
+
+    if (ok)
+    {
+      //keep only changes received while writing
+      std::vector<ini_change> rest (pending.list ().begin () + batch.size (), pending.list ().end ());
+      pending.clear ();
+      for (auto& chg : rest)
+        pending.add (std::move (chg));
+      if (!pending.empty ())
+        first = std::chrono::steady_clock::now ();
+    }
+    else
+      first = last = std::chrono::steady_clock::now (); //retry after debounce (or max_delay if shorter)
+
+    for (auto w = waiters.begin (); w != waiters.end ();)
+    {
+      if (w->first <= target)
+      {
+        w->second.set_value (ok);
+        w = waiters.erase (w);
+      }
+      else
+        ++w;
+    }
+    if (!ok && stop)
+      break;  //give up
+  }
+  //signal any remaining waiters
+  for (auto& w : waiters)
+    w.second.set_value (pending.empty ());
+  waiters.clear ();
+}
+
+} //namespace utf8
@@ -0,0 +1,581 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file inidoc.cpp Implementation of IniDocument class
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  The text of the document is kept in an arena: a list of large memory chunks
+  that are filled sequentially and released only when the document is replaced
+  or destroyed. Lines are views into the arena; a changed line is a new string
+  in the arena, the old one is simply abandoned.
+
+  Lines are grouped in blocks. The first block contains the lines before the
+  first section; each of the following blocks starts with a line beginning with
+  '[' and contains all lines up to the next such line. This is the same way
+  putkey() finds the extent of a section.
+
+  Sections and keys are indexed by their case-folded names. As in IniFile, only
+  the first section with a given name and the first key with a given name in
+  that section are used.
+*/
+
+namespace utf8 {
+
+/// Size of arena chunks used for changed lines
+static const size_t CHUNK_SIZE = 4096;
+
+static const size_t NO_BLOCK = (size_t)-1;
+
+struct IniDocument::model {
+  /// Section line and content of a section
+  struct block {
+    std::vector<std::string_view> lines;  ///< lines of block; deleted lines are empty
+    std::unordered_map<std::u32string, size_t> keys; ///< folded key name -> line
+    bool erased = false;                  ///< section has been deleted
+  };
+
+  void clear ();
+  char* allocate (size_t size);
+  std::string_view store (std::string_view text);
+  void split (const char* first, const char* last);
+  void index_keys (block& b);
+  void index_sections ();
+  size_t find (const std::string& section) const;
+  const std::string_view* find (const std::string& section, const std::string& key) const;
+  void terminate (std::string_view& line);
+  bool change (const ini_change& chg);
+
+  std::vector<std::unique_ptr<char[]>> chunks;
+  char* avail = nullptr;        ///< free space in last chunk
+  size_t left = 0;              ///< size of free space
+  std::vector<block> blocks;
+  std::unordered_map<std::u32string, size_t> sections;  ///< folded section name -> block
+  bool exists = false;          ///< document has content from a file or text
+};
+
+// Case-folded form of a name without leading and trailing spaces
+static std::u32string folded (std::string_view name)
+{
+  const char* end = name.data () + name.size ();
+  const char* sp = skip_spaces (name.data (), end);
+  return fold_name (sp, trim_spaces (sp, end));
+}
+
+/// Remove all content
+void IniDocument::model::clear ()
+{
+  blocks.clear ();
+  sections.clear ();
+  chunks.clear ();
+  avail = nullptr;
+  left = 0;
+  exists = false;
+}
+
+/// Return space for a string in the arena
+char* IniDocument::model::allocate (size_t size)
+{
+  if (size > left)
+  {
+    size_t sz = std::max (size, CHUNK_SIZE);
+    chunks.emplace_back (new char[sz]);
+    avail = chunks.back ().get ();
+    left = sz;
+  }
+  char* p = avail;
+  avail += size;
+  left -= size;
+  return p;
+}
+
+/// Copy a string in the arena
+std::string_view IniDocument::model::store (std::string_view text)
+{
+  char* p = allocate (text.size ());
+  memcpy (p, text.data (), text.size ());
+  return std::string_view (p, text.size ());
+}
+
+/// Split text into lines and blocks and build the index
+void IniDocument::model::split (const char* first, const char* last)
+{
+  blocks.emplace_back ();
+  for (const char* p = first; p < last;)
+  {
+    const char* eol = line_end (p, last);
+    const char* sp = skip_spaces (p, eol);
+    if (sp < eol && *sp == '[')
+      blocks.emplace_back ();
+    blocks.back ().lines.emplace_back (p, eol - p);
+    p = eol;
+  }
+  for (size_t i = 1; i < blocks.size (); i++)
+    index_keys (blocks[i]);
+  index_sections ();
+}
+
+/// Rebuild the index of keys in a section
+void IniDocument::model::index_keys (block& b)
+{
+  b.keys.clear ();
+  IniEntry entry;
+  for (size_t j = 1; j < b.lines.size (); j++)
+  {
+    auto& l = b.lines[j];
+    if (!l.empty () && view_entry (l.data (), l.data () + l.size (), entry))
+      b.keys.emplace (folded (entry.key), j);
+  }
+}
+
+/// Rebuild the index of sections
+void IniDocument::model::index_sections ()
+{
+  sections.clear ();
+  std::string_view name;
+  for (size_t i = 1; i < blocks.size (); i++)
+  {
+    auto& l = blocks[i].lines[0];
+    if (!blocks[i].erased && view_section (l.data (), l.data () + l.size (), name))
+      sections.emplace (folded (name), i);
+  }
+}
+
+/// Return the block of a section or NO_BLOCK if section doesn't exist
+size_t IniDocument::model::find (const std::string& section) const
+{
+  auto p = sections.find (folded (section));
+  return (p == sections.end ()) ? NO_BLOCK : p->second;
+}
+
+/// Return the line of a key or NULL if key doesn't exist
+const std::string_view* IniDocument::model::find (const std::string& section,
+                                                   const std::string& key) const
+{
+  size_t i = find (section);
+  if (i == NO_BLOCK)
+    return nullptr;
+  auto p = blocks[i].keys.find (folded (key));
+  return (p == blocks[i].keys.end ()) ? nullptr : &blocks[i].lines[p->second];
+}
+
+/// Make sure a line is terminated with '\n'
+void IniDocument::model::terminate (std::string_view& line)
+{
+  if (!line.empty () && line.back () != '\n')
+    line = store (std::string (line) + '\n');
+}
+
+/*
+  Apply one change in the same way as putkey() function modifies a file.
+  Returns false if document has not been modified.
+*/
+bool IniDocument::model::change (const ini_change& chg)
+{
+  size_t i = find (chg.section);
+  if (i == NO_BLOCK)
+  {
+    //section not found
+    if (chg.erase)
+      return false;
+    if (!exists && blocks.size () <= 1 && (blocks.empty () || blocks[0].lines.empty ()))
+    {
+      //new file - write BOM mark
+      blocks.resize (1);
+      blocks[0].lines.push_back (store ("\xEF\xBB\xBF\r\n"));
+    }
+    else
+      blocks.back ().lines.push_back (store ("\n")); //force a new line behind the last line
+    exists = true;
+
+    block b;
+    b.lines.push_back (store (section_line (chg.section.c_str ())));
+    b.lines.push_back (store (key_line (chg.key.c_str (), chg.value.c_str ())));
+    b.keys.emplace (folded (chg.key), 1);
+    sections.emplace (folded (chg.section), blocks.size ());
+    blocks.push_back (std::move (b));
+    return true;
+  }
+
+  block& b = blocks[i];
+  auto k = b.keys.find (folded (chg.key));
+  if (k == b.keys.end ())
+  {
+    if (chg.erase)
+      return false;
+    // make sure section line and last line are terminated with '\n'
+    terminate (b.lines[0]);
+    auto last = std::find_if (b.lines.rbegin (), b.lines.rend (),
+                              [](const std::string_view& l) {return !l.empty (); });
+    terminate (*last);
+    b.keys.emplace (folded (chg.key), b.lines.size ());
+    b.lines.push_back (store (key_line (chg.key.c_str (), chg.value.c_str ())));
+    return true;
+  }
+
+  std::string_view& line = b.lines[k->second];
+  if (chg.erase)
+  {
+    //delete line and look for another key with the same name
+    line = std::string_view ();
+    index_keys (b);
+    return true;
+  }
+  IniEntry entry;
+  view_entry (line.data (), line.data () + line.size (), entry);
+  if (entry.value == chg.value)
+    return false; //same value
+  terminate (b.lines[0]);
+  line = store (key_line (chg.key.c_str (), chg.value.c_str ()));
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+IniDocument::IniDocument ()
+  : doc{ std::make_unique<model> () }
+{
+}
+
+/*!
+  \param filename   name of INI file
+
+  If the file cannot be read, the document is empty and saving it creates
+  a new file.
+*/
+IniDocument::IniDocument (const std::string& filename)
+  : doc{ std::make_unique<model> () }
+{
+  Load (filename);
+}
+
+IniDocument::IniDocument (const IniDocument& other)
+  : doc{ std::make_unique<model> () }
+{
+  Parse (other.str ());
+  doc->exists = other.doc->exists;
+}
+
+/// A moved-from document can only be assigned to or destroyed.
+IniDocument::IniDocument (IniDocument&& other) noexcept = default;
+
+IniDocument::~IniDocument () = default;
+
+IniDocument& IniDocument::operator= (const IniDocument& other)
+{
+  if (this != &other)
+  {
+    IniDocument tmp (other);
+    doc.swap (tmp.doc);
+  }
+  return *this;
+}
+
+IniDocument& IniDocument::operator= (IniDocument&& other) noexcept = default;
+
+/*!
+  \param filename   name of INI file
+  \return           `true` if successful, `false` otherwise
+
+  The whole file is read with a single read operation in the memory arena of
+  the document.
+*/
+bool IniDocument::Load (const std::string& filename)
+{
+  doc->clear ();
+  FILE* fp = openread (filename);
+  if (!fp)
+    return false;
+
+  bool ok = !fseek (fp, 0, SEEK_END);
+  long size = ok ? ftell (fp) : -1;
+  ok = size >= 0 && !fseek (fp, 0, SEEK_SET);
+  size_t n = 0;
+  char* buf = nullptr;
+  if (ok && size)
+  {
+    buf = doc->allocate ((size_t)size);
+    n = read_bytes (buf, 1, (size_t)size, fp);
+    ok = !ferror (fp);
+  }
+  fclose (fp);
+  if (!ok)
+    return false;
+
+  doc->split (buf, buf + n);
+  doc->exists = true;
+  return true;
+}
+
+/*!
+  \param text   content of an INI file
+*/
+void IniDocument::Parse (std::string_view text)
+{
+  doc->clear ();
+  std::string_view stored = doc->store (text);
+  doc->split (stored.data (), stored.data () + stored.size ());
+  doc->exists = true;
+}
+
+/*!
+  \param filename   name of INI file
+  \return           `true` if successful, `false` otherwise
+
+  If the file exists, the document is written to a temporary file that
+  replaces the original one, as IniFile functions do.
+*/
+bool IniDocument::Save (const std::string& filename) const
+{
+  bool exists = std::filesystem::exists (filename);
+  FILE* fp = openwrite (exists ? tempname (filename) : filename);
+  if (!fp)
+    return false;
+  for (auto& b : doc->blocks)
+  {
+    if (b.erased)
+      continue;
+    for (auto& l : b.lines)
+      write_bytes (l.data (), 1, l.size (), fp);
+  }
+  bool ok = !ferror (fp);
+  ok = (fclose (fp) == 0) && ok;
+  if (!ok)
+  {
+    if (exists)
+      utf8::remove (tempname (filename));
+    return false;
+  }
+  count (&stats_counters::rewrites);
+  return exists ? tmp_rename (filename) : true;
+}
+
+std::string IniDocument::str () const
+{
+  size_t size = 0;
+  for (auto& b : doc->blocks)
+  {
+    for (auto& l : b.lines)
+      size += b.erased ? 0 : l.size ();
+  }
+  std::string text;
+  text.reserve (size);
+  for (auto& b : doc->blocks)
+  {
+    if (b.erased)
+      continue;
+    for (auto& l : b.lines)
+      text.append (l);
+  }
+  return text;
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+  \param defval   default value
+  \return         key value or default value if key doesn't exist
+*/
+std::string IniDocument::GetString (const std::string& key, const std::string& section,
+                                    const std::string& defval) const
+{
+  auto line = doc->find (section, key);
+  if (!line)
+    return defval;
+  IniEntry entry;
+  view_entry (line->data (), line->data () + line->size (), entry);
+  return std::string (entry.value);
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+*/
+bool IniDocument::HasKey (const std::string& key, const std::string& section) const
+{
+  return doc->find (section, key) != nullptr;
+}
+
+/*!
+  \param section  section name
+*/
+bool IniDocument::HasSection (const std::string& section) const
+{
+  size_t i = doc->find (section);
+  return i != NO_BLOCK && !doc->blocks[i].keys.empty ();
+}
+
+/*!
+  \param key      key name
+  \param value    key value
+  \param section  section name
+  \return         always `true`
+*/
+bool IniDocument::PutString (const std::string& key, const std::string& value, const std::string& section)
+{
+  doc->change (ini_change (section.c_str (), key.c_str (), value.c_str ()));
+  return true;
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+  \return         always `true`
+*/
+bool IniDocument::DeleteKey (const std::string& key, const std::string& section)
+{
+  doc->change (ini_change (section.c_str (), key.c_str (), nullptr));
+  return true;
+}
+
+/*!
+  \param section  section name
+  \return         always `true`
+*/
+bool IniDocument::DeleteSection (const std::string& section)
+{
+  size_t i = doc->find (section);
+  if (i != NO_BLOCK)
+  {
+    doc->blocks[i].erased = true;
+    doc->index_sections ();
+  }
+  return true;
+}
+
+/*!
+  \param from_doc   source document
+  \param from_sect  source section
+  \param to_sect    destination section
+  \return           always `true`
+
+  If destination section name is missing, the function copies the section
+  with the same name. Previous content of destination section is replaced,
+  with the same result as IniFile::CopySection() function.
+*/
+bool IniDocument::CopySection (const IniDocument& from_doc, const std::string& from_sect,
+                               const std::string& to_sect)
+{
+  assert (!from_sect.empty ());
+
+  //trivial case: same document, same section
+  if (this == &from_doc && (to_sect.empty () || from_sect == to_sect))
+    return true;
+
+  size_t from = from_doc.doc->find (from_sect);
+  if (from == NO_BLOCK)
+    return true;  //from_sect not found
+
+  //copy lines first; source can be this document
+  auto& src = from_doc.doc->blocks[from].lines;
+  std::vector<std::string> body;
+  for (size_t j = 1; j < src.size (); j++)
+  {
+    if (!src[j].empty ())
+      body.emplace_back (src[j]);
+  }
+
+  string dest_sect = to_sect.empty () ? from_sect : to_sect;
+  size_t to = doc->find (dest_sect);
+  model::block b;
+  b.lines.push_back (doc->store (section_line (dest_sect.c_str ())));
+  for (auto& l : body)
+    b.lines.push_back (doc->store (l));
+
+  auto& blocks = doc->blocks;
+  if (to == NO_BLOCK)
+  {
+    if (!doc->exists && blocks.size () <= 1 && (blocks.empty () || blocks[0].lines.empty ()))
+    {
+      blocks.resize (1);
+      blocks[0].lines.push_back (doc->store ("\xEF\xBB\xBF\r\n")); //new file - write BOM mark
+    }
+    else
+    {
+      //make sure last line is terminated with '\n'
+      for (auto p = blocks.rbegin (); p != blocks.rend (); ++p)
+      {
+        auto last = std::find_if (p->lines.rbegin (), p->lines.rend (),
+                                  [](const std::string_view& l) {return !l.empty (); });
+        if (!p->erased && last != p->lines.rend ())
+        {
+          doc->terminate (*last);
+          break;
+        }
+      }
+    }
+    doc->exists = true;
+    doc->index_keys (b);
+    blocks.push_back (std::move (b));
+    doc->index_sections ();
+    return true;
+  }
+
+  //keep trailing newline at end of section if other sections follow
+  for (size_t i = to + 1; i < blocks.size (); i++)
+  {
+    if (!blocks[i].erased)
+    {
+      b.lines.push_back (doc->store ("\n"));
+      break;
+    }
+  }
+  doc->index_keys (b);
+  blocks[to] = std::move (b);
+  return true;
+}
+
+/*!
+  \param keys     deque of keys
+  \param section  section name
+  \return         number of keys in section
+*/
+size_t IniDocument::GetKeys (std::deque<std::string>& keys, const std::string& section) const
+{
+  keys.clear ();
+  size_t i = doc->find (section);
+  if (i == NO_BLOCK)
+    return 0;
+  IniEntry entry;
+  auto& lines = doc->blocks[i].lines;
+  for (size_t j = 1; j < lines.size (); j++)
+  {
+    auto& l = lines[j];
+    if (!l.empty () && view_entry (l.data (), l.data () + l.size (), entry))
+      keys.emplace_back (entry.key);
+  }
+  return keys.size ();
+}
+
+/*!
+  \param sections deque of sections
+  \return         number of sections found
+*/
+size_t IniDocument::GetSections (std::deque<std::string>& sections) const
+{
+  sections.clear ();
+  std::string_view name;
+  for (size_t i = 1; i < doc->blocks.size (); i++)
+  {
+    auto& b = doc->blocks[i];
+    if (!b.erased && view_section (b.lines[0].data (), b.lines[0].data () + b.lines[0].size (), name))
+      sections.emplace_back (name);
+  }
+  return sections.size ();
+}
+
+} //namespace utf8
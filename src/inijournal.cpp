@@ -0,0 +1,538 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file inijournal.cpp Pending changes and journal files of INI files.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  A journal file has the same name as the INI file with ".journal" appended.
+  It starts with a header line that identifies this journal instance and is
+  followed by one line for each change:
+    [section]key=value    - new key value
+    [section]key          - key deletion
+
+  A line that is not terminated by a newline character is incomplete (the
+  write has not finished yet) and it is ignored.
+
+  Compacting a journal applies all changes to the INI file, with a single
+  rewrite, and deletes the journal file. Because each change sets the final
+  state of a key, replaying a journal that has already been applied is
+  harmless.
+*/
+
+namespace utf8 {
+
+static const char JOURNAL_HEADER[] = "; journal ";
+static const size_t NO_INDEX = (size_t)-1;
+
+/// Mutex that serializes journal appends and compactions of a file in this process
+static std::mutex& journal_lock (const std::string& filename)
+{
+  static std::mutex locks[17];
+  return locks[std::hash<std::string>{}(filename) % 17];
+}
+
+/// Return header line of a new journal file
+static std::string journal_header ()
+{
+  std::random_device rd;
+  char buf[40];
+  snprintf (buf, sizeof (buf), "%s%08x%08x\n", JOURNAL_HEADER, rd (), rd ());
+  return buf;
+}
+
+/// Parse a journal record and add it to the list of changes
+static void parse_record (std::string& line, ini_changes& changes)
+{
+  if (!line.empty () && line.back () == '\r')
+    line.pop_back ();
+  size_t se, ke;
+  if (line.empty () || line[0] != '[' || (se = line.find (']')) == std::string::npos)
+    return;  //not a record
+  line[se] = 0;
+  ke = line.find ('=', se + 1);
+  if (ke != std::string::npos)
+    line[ke] = 0;
+  changes.add (ini_change (&line[1], &line[se + 1], (ke == std::string::npos) ? nullptr : &line[ke + 1]));
+}
+
+/// Name of journal file for an INI file
+std::string journal_name (const std::string& filename)
+{
+  return filename + ".journal";
+}
+
+//-----------------------------------------------------------------------------
+/*
+  Names are stored without leading and trailing spaces and the value is stored
+  as it will be found in the file after the change is applied.
+  If value is NULL, the change deletes the key.
+*/
+ini_change::ini_change (const char* sect, const char* k, const char* val)
+  : erase (val == nullptr)
+{
+  sect = skipleading (sect);
+  section.assign (sect, skiptrailing (sect));
+  k = skipleading (k);
+  key.assign (k, skiptrailing (k));
+  if (val)
+  {
+    std::string line = key_line (k, val);
+    const char* vs = skipleading (strchr (line.c_str (), '=') + 1);
+    value.assign (vs, skiptrailing (vs));
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Add a new change
+void ini_changes::add (ini_change&& chg)
+{
+  size_t i = changes.size ();
+  const char* sn = chg.section.c_str ();
+  const char* kn = chg.key.c_str ();
+  std::u32string fs = fold_name (sn, sn + chg.section.size ());
+  std::u32string fk = fs + U'\0' + fold_name (kn, kn + chg.key.size ());
+
+  auto p = keys.find (fk);
+  if (p == keys.end ())
+    keys.emplace (fk, key_state{ i, chg.erase ? NO_INDEX : i, chg.erase });
+  else
+  {
+    auto& st = p->second;
+    st.last = i;
+    if (chg.erase)
+    {
+      st.erased = true;
+      st.created = NO_INDEX;
+    }
+    else if (st.created == NO_INDEX)
+      st.created = i; //key deleted before; now it is added at the end of section
+  }
+  if (!chg.erase)
+    sections.emplace (fs, i); //a put creates the section if it doesn't exist
+  changes.push_back (std::move (chg));
+}
+
+/// Discard all changes
+void ini_changes::clear ()
+{
+  changes.clear ();
+  keys.clear ();
+  sections.clear ();
+}
+
+/*
+  Find the most recent change of a key.
+  Returns 1 if the key has a new value, 0 if the key has been deleted and -1
+  if the key hasn't been changed.
+*/
+int ini_changes::find (const char* section, const char* key, std::string_view& value) const
+{
+  if (changes.empty ())
+    return -1;
+  section = skipleading (section);
+  key = skipleading (key);
+  auto p = keys.find (fold_name (section, skiptrailing (section)) + U'\0'
+                      + fold_name (key, skiptrailing (key)));
+  if (p == keys.end ())
+    return -1;
+  const ini_change& chg = changes[p->second.last];
+  if (chg.erase)
+    return 0;
+  value = chg.value;
+  return 1;
+}
+
+/*
+  Invoke an enumeration function on the keys of a section after changes are
+  applied. Keys in 'base' are the keys found in the file, in file order.
+  Keys added by changes follow the keys that were already in the file, in the
+  order in which they were added.
+*/
+int ini_changes::merge_keys (const char* section, const std::vector<std::string>& base,
+                             std::function<void (const char*)> fun) const
+{
+  section = skipleading (section);
+  std::u32string prefix = fold_name (section, skiptrailing (section)) + U'\0';
+  std::unordered_set<std::u32string> present;
+  int cnt = 0;
+  for (auto& k : base)
+  {
+    std::u32string fk = prefix + fold_name (k.c_str (), k.c_str () + k.size ());
+    auto p = keys.find (fk);
+    if (p == keys.end ())
+      fun (k.c_str ());
+    else if (p->second.erased)
+      continue;   //key is gone or it has been moved at the end of section
+    else
+      fun (changes[p->second.last].key.c_str ()); //key line was rewritten
+    present.insert (fk);
+    cnt++;
+  }
+
+  std::vector<std::pair<size_t, size_t>> added; //(created, last) changes of new keys
+  for (auto& k : keys)
+  {
+    if (k.second.created != NO_INDEX && !present.count (k.first)
+     && !k.first.compare (0, prefix.size (), prefix))
+      added.emplace_back (k.second.created, k.second.last);
+  }
+  std::sort (added.begin (), added.end ());
+  for (auto& a : added)
+  {
+    fun (changes[a.second].key.c_str ());
+    cnt++;
+  }
+  return cnt;
+}
+
+/*
+  Invoke an enumeration function on all sections after changes are applied.
+  New sections follow the sections found in the file.
+*/
+int ini_changes::merge_sections (const std::vector<std::string>& base,
+                                 std::function<void (const char*)> fun) const
+{
+  std::unordered_set<std::u32string> present;
+  for (auto& s : base)
+  {
+    const char* sn = skipleading (s.c_str ());
+    present.insert (fold_name (sn, s.c_str () + s.size ()));
+    fun (s.c_str ());
+  }
+  int cnt = (int)base.size ();
+
+  std::vector<size_t> added;
+  for (auto& s : sections)
+  {
+    if (!present.count (s.first))
+      added.push_back (s.second);
+  }
+  std::sort (added.begin (), added.end ());
+  for (auto i : added)
+  {
+    if (!changes[i].section.empty ())
+    {
+      fun (changes[i].section.c_str ());
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+//-----------------------------------------------------------------------------
+/*
+  Apply one change to the lines of an INI file. Lines are modified in the same
+  way as putkey() function modifies the file.
+  Returns false if lines have not been modified.
+*/
+static bool apply_change (std::vector<std::string>& lines, const ini_change& chg, bool exists)
+{
+  const char *sp, *ep;
+  const char* section = chg.section.c_str ();
+  const char* section_end = section + chg.section.size ();
+  const char* key = chg.key.c_str ();
+  const char* key_end = key + chg.key.size ();
+
+  size_t i;
+  for (i = 0; i < lines.size (); i++)
+  {
+    if ((sp = section_name (lines[i].c_str (), ep)) != NULL
+      && fold_equal (sp, ep, section, section_end))
+      break;
+  }
+  if (i == lines.size ())
+  {
+    //section not found
+    if (chg.erase)
+      return false;
+    if (lines.empty () && !exists)
+      lines.push_back ("\xEF\xBB\xBF\r\n"); //new file - write BOM mark
+    else
+      lines.push_back ("\n"); //force a new line behind the last line
+    lines.push_back (section_line (section));
+    lines.push_back (key_line (key, chg.value.c_str ()));
+    return true;
+  }
+
+  // make sure section line is terminated with '\n'
+  if (lines[i].back () != '\n')
+    lines[i].push_back ('\n');
+
+  size_t j;
+  bool found = false;
+  for (j = i + 1; j < lines.size () && *skipleading (lines[j].c_str ()) != '['; j++)
+  {
+    if ((sp = key_name (lines[j].c_str (), ep)) != NULL
+      && (found = fold_equal (sp, ep, key, key_end)))
+      break;
+  }
+
+  if (!found)
+  {
+    if (chg.erase)
+      return false;
+    lines.insert (lines.begin () + j, key_line (key, chg.value.c_str ()));
+  }
+  else if (chg.erase)
+    lines.erase (lines.begin () + j);
+  else
+  {
+    const char* vs = skipleading (strchr (lines[j].c_str (), '=') + 1);
+    if (std::string_view (vs, skiptrailing (vs) - vs) == chg.value)
+      return false; //same value
+    lines[j] = key_line (key, chg.value.c_str ());
+  }
+  return true;
+}
+
+/*
+  Apply a list of changes to an INI file. The file is rewritten only once and
+  only if any of the changes modifies it.
+*/
+bool apply_changes (const std::string& filename, const std::vector<ini_change>& changes)
+{
+  char buffer[INI_BUFFERSIZE];
+  std::vector<std::string> lines;
+
+  FILE* fp = openread (filename);
+  bool exists = (fp != NULL);
+  if (fp)
+  {
+    while (read_line (buffer, sizeof (buffer), fp))
+      lines.push_back (buffer);
+    bool ok = !ferror (fp);
+    fclose (fp);
+    if (!ok)
+      return false;
+  }
+
+  bool modified = false;
+  for (auto& chg : changes)
+    modified = apply_change (lines, chg, exists) || modified;
+  if (!modified)
+  {
+    count (&stats_counters::skipped_writes);
+    return true;
+  }
+
+  FILE* out = openwrite (exists ? tempname (filename) : filename);
+  if (!out)
+    return false;
+  for (auto& l : lines)
+    write_line (l.c_str (), out);
+  bool ok = !ferror (out);
+  ok = (fclose (out) == 0) && ok;
+  if (!ok)
+    return false;
+  count (&stats_counters::rewrites);
+  return exists ? tmp_rename (filename) : true;
+}
+
+//-----------------------------------------------------------------------------
+/*
+  Bring the list of changes up to date with the journal file. Only the new
+  part of the journal is parsed unless the journal has been replaced by another
+  one.
+  Returns true if there are any changes.
+*/
+bool journal_state::refresh (const std::string& filename)
+{
+  std::string jname = journal_name (filename);
+  file_stamp st;
+  if (!get_stamp (jname, st))
+  {
+    //no journal
+    changes.clear ();
+    id.clear ();
+    offset = 0;
+    stamp = { 0, 0, 0 };
+    return false;
+  }
+  if (st == stamp)
+    return !changes.empty ();
+
+  char header[40];
+  FILE* fp = utf8::fopen (jname, "rb");
+  if (fp)
+    count (&stats_counters::opens);
+  if (!fp || !read_line (header, sizeof (header), fp)
+   || strncmp (header, JOURNAL_HEADER, sizeof (JOURNAL_HEADER) - 1))
+  {
+    //cannot read or not a journal
+    if (fp)
+      fclose (fp);
+    changes.clear ();
+    id.clear ();
+    offset = 0;
+    stamp = { 0, 0, 0 };
+    return false;
+  }
+  if (id != header || (uint64_t)offset > st.size)
+  {
+    //different journal
+    changes.clear ();
+    id = header;
+    offset = ftell (fp);
+  }
+  else
+    fseek (fp, offset, SEEK_SET);
+
+  std::string data;
+  char buf[4096];
+  size_t n;
+  while ((n = read_bytes (buf, 1, sizeof (buf), fp)) > 0)
+    data.append (buf, n);
+  fclose (fp);
+
+  size_t pos = 0, nl;
+  while ((nl = data.find ('\n', pos)) != std::string::npos)
+  {
+    std::string line = data.substr (pos, nl - pos);
+    parse_record (line, changes);
+    pos = nl + 1;
+  }
+  offset += (long)pos;  //incomplete last line is parsed next time
+  stamp = st;
+  return !changes.empty ();
+}
+
+/*
+  Apply the changes in journal file to the INI file and delete the journal.
+*/
+bool compact_journal (const std::string& filename)
+{
+  std::string jname = journal_name (filename);
+  file_stamp st;
+  if (!get_stamp (jname, st))
+    return true; //no journal
+
+  std::lock_guard<std::mutex> l (journal_lock (filename));
+  journal_state js;
+  js.refresh (filename);
+  if (!apply_changes (filename, js.changes.list ()))
+    return false;
+  return utf8::remove (jname);
+}
+
+//-----------------------------------------------------------------------------
+/*
+  The writer starts a background thread that compacts the journal when it
+  becomes larger than max_size or older than max_age.
+*/
+journal_writer::journal_writer (const std::string& filename_, size_t max_size_,
+                                std::chrono::milliseconds max_age_, stats_counters& counters_)
+  : filename (filename_)
+  , counters (counters_)
+  , max_size (max_size_)
+  , max_age (max_age_)
+{
+  file_stamp st;
+  if (get_stamp (journal_name (filename), st))
+  {
+    //journal left by a previous writer
+    pending = true;
+    full = (st.size >= max_size);
+    first = std::chrono::steady_clock::now ();
+  }
+  worker = std::thread (&journal_writer::run, this);
+}
+
+/// Stop the compaction thread. The journal is not compacted.
+journal_writer::~journal_writer ()
+{
+  {
+    std::lock_guard<std::mutex> l (lock);
+    stop = true;
+  }
+  cv.notify_one ();
+  worker.join ();
+}
+
+/// Append a change to the journal file
+bool journal_writer::append (const ini_change& chg)
+{
+  std::string rec = '[' + chg.section + ']' + chg.key;
+  if (!chg.erase)
+    rec += '=' + chg.value;
+  rec += '\n';
+
+  long size;
+  {
+    std::lock_guard<std::mutex> l (journal_lock (filename));
+    FILE* fp = utf8::fopen (journal_name (filename), "ab");
+    if (!fp)
+      return false;
+    count (&stats_counters::opens);
+    fseek (fp, 0, SEEK_END);
+    if (ftell (fp) == 0)
+      write_line (journal_header ().c_str (), fp);
+    write_line (rec.c_str (), fp);
+    size = ftell (fp);
+    bool ok = !ferror (fp);
+    if (fclose (fp) || !ok)
+      return false;
+  }
+
+  std::lock_guard<std::mutex> l (lock);
+  if (!pending)
+  {
+    pending = true;
+    first = std::chrono::steady_clock::now ();
+  }
+  if ((size_t)size >= max_size)
+    full = true;
+  cv.notify_one ();
+  return true;
+}
+
+/// Compact the journal now
+bool journal_writer::compact ()
+{
+  {
+    std::lock_guard<std::mutex> l (lock);
+    full = pending = false;
+  }
+  return compact_journal (filename);
+}
+
+/// Compaction thread
+void journal_writer::run ()
+{
+  std::unique_lock<std::mutex> l (lock);
+  while (!stop)
+  {
+    auto deadline = first + max_age;
+    if (full || (pending && std::chrono::steady_clock::now () >= deadline))
+    {
+      full = pending = false;
+      l.unlock ();
+      {
+        stats_scope timer (counters, IniStats::compact, filename);
+        compact_journal (filename);
+      }
+      l.lock ();
+    }
+    else if (pending)
+      cv.wait_until (l, deadline);
+    else
+      cv.wait (l);
+  }
+}
+
+} //namespace utf8
@@ -0,0 +1,699 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file inimage.cpp Compiled images of INI files.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  Layout of an image file:
+
+    img_header
+    img_section[nsections]  - all sections in file order
+    img_key[nkeys]          - keys of each section, in file order
+    uint32_t seeds[nbuckets]- displacement seeds of perfect hash
+    uint32_t slots[nslots]  - perfect hash table
+    char strings[]          - sorted table of unique, null-terminated strings
+
+  All offsets are from the beginning of the image. Numbers are in the byte order
+  of the machine that produced the image; images are rejected if the byte order
+  doesn't match.
+
+  The perfect hash table contains the first occurrence of each section and
+  the first occurrence of each key in that section. Other occurrences are
+  only kept for enumeration, just like the text file where only the first
+  matching section and key are found.
+*/
+
+namespace utf8 {
+
+static const char IMG_MAGIC[8] = { 'U', 'T', 'F', '8', 'I', 'N', 'I', '\x1a' };
+static const uint32_t IMG_VERSION = 1;
+static const uint32_t IMG_BYTE_ORDER = 0x01020304;
+
+static const uint32_t NO_ENTRY = 0xffffffff;      ///< empty hash slot
+static const uint32_t SECTION_FLAG = 0x80000000;  ///< hash slot refers to a section
+
+/// Separator between section and key names in key hash (not a valid code point)
+static const char32_t KEY_SEPARATOR = 0xffffffff;
+
+struct img_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t image_size;
+  uint64_t src_size;        ///< size of INI file
+  uint64_t src_mtime;       ///< modification time of INI file
+  uint64_t src_hash;        ///< hash of INI file content
+  uint32_t nsections;
+  uint32_t nkeys;
+  uint32_t nbuckets;
+  uint32_t nslots;
+  uint32_t sections;        ///< offset of sections array
+  uint32_t keys;            ///< offset of keys array
+  uint32_t seeds;           ///< offset of seeds array
+  uint32_t slots;           ///< offset of hash table
+  uint32_t strings;         ///< offset of string table
+  uint32_t strings_size;
+};
+
+struct img_section {
+  uint32_t name;            ///< name as returned by enumeration
+  uint32_t first_key;       ///< index of first key
+  uint32_t nkeys;           ///< number of keys
+};
+
+struct img_key {
+  uint32_t section;         ///< index of section
+  uint32_t name;            ///< key name
+  uint32_t value;           ///< key value
+};
+
+//-----------------------------------------------------------------------------
+// Hash functions
+
+static const uint64_t FNV64_BASIS = 14695981039346656037ull;
+static const uint64_t FNV64_PRIME = 1099511628211ull;
+
+// Add case-folded name to a 64-bit FNV-1a hash
+static uint64_t fold_hash64 (const char* name, const char* end, uint64_t h = FNV64_BASIS)
+{
+  while (name < end)
+  {
+    h ^= fold_next (name);
+    h *= FNV64_PRIME;
+  }
+  return h;
+}
+
+// Hash of a key is the hash of section name continued with the key name
+static uint64_t key_hash64 (uint64_t sect_hash, const char* name, const char* end)
+{
+  sect_hash ^= KEY_SEPARATOR;
+  sect_hash *= FNV64_PRIME;
+  return fold_hash64 (name, end, sect_hash);
+}
+
+// Hash of file content
+static uint64_t content_hash (FILE* fp)
+{
+  char buf[4096];
+  size_t n;
+  uint64_t h = FNV64_BASIS;
+  while ((n = read_bytes (buf, 1, sizeof (buf), fp)) > 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      h ^= (unsigned char)buf[i];
+      h *= FNV64_PRIME;
+    }
+  }
+  return h;
+}
+
+// splitmix64 finalizer
+static uint64_t mix (uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+}
+
+static inline uint32_t bucket_of (uint64_t h, uint32_t nbuckets)
+{
+  return (uint32_t)((h >> 32) % nbuckets);
+}
+
+static inline uint32_t slot_of (uint64_t h, uint32_t seed, uint32_t nslots)
+{
+  return (uint32_t)(mix (h ^ (seed * 0x9e3779b97f4a7c15ull)) % nslots);
+}
+
+/*
+  Build a perfect hash table using the "hash and displace" method: hashes are
+  distributed into buckets and, starting with the largest bucket, a seed is
+  searched that places all hashes in the bucket in free slots.
+  Returns false if hashes are not unique.
+*/
+static bool build_perfect_hash (const vector<uint64_t>& hashes,
+                                vector<uint32_t>& seeds, vector<uint32_t>& slots)
+{
+  const uint32_t MAX_SEED = 1 << 16;
+  uint32_t n = (uint32_t)hashes.size ();
+  uint32_t nslots = n + n / 8 + 1;
+  uint32_t nbuckets = n / 4 + 1;
+
+  vector<uint64_t> sorted (hashes);
+  sort (sorted.begin (), sorted.end ());
+  if (adjacent_find (sorted.begin (), sorted.end ()) != sorted.end ())
+    return false;
+
+  while (true)
+  {
+    vector<vector<uint32_t>> buckets (nbuckets);
+    for (uint32_t i = 0; i < n; i++)
+      buckets[bucket_of (hashes[i], nbuckets)].push_back (i);
+
+    vector<uint32_t> order (nbuckets);
+    for (uint32_t i = 0; i < nbuckets; i++)
+      order[i] = i;
+    stable_sort (order.begin (), order.end (),
+      [&buckets](uint32_t b1, uint32_t b2) {return buckets[b1].size () > buckets[b2].size (); });
+
+    seeds.assign (nbuckets, 0);
+    slots.assign (nslots, NO_ENTRY);
+    vector<uint32_t> placed;
+    bool ok = true;
+    for (auto b : order)
+    {
+      if (buckets[b].empty ())
+        break;
+      uint32_t seed;
+      for (seed = 0; seed < MAX_SEED; seed++)
+      {
+        placed.clear ();
+        for (auto e : buckets[b])
+        {
+          uint32_t s = slot_of (hashes[e], seed, nslots);
+          if (slots[s] != NO_ENTRY || find (placed.begin (), placed.end (), s) != placed.end ())
+            break;
+          placed.push_back (s);
+        }
+        if (placed.size () == buckets[b].size ())
+          break;
+      }
+      if (seed == MAX_SEED)
+      {
+        ok = false;
+        break;
+      }
+      seeds[b] = seed;
+      for (size_t i = 0; i < placed.size (); i++)
+        slots[placed[i]] = buckets[b][i];
+    }
+    if (ok)
+      return true;
+
+    //could not place a bucket; retry with a sparser table
+    nslots += nslots / 4 + 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+/*
+  Parse INI file and build its image in memory.
+*/
+bool ini_image::build (FILE* fp, const file_stamp& stamp, std::string& image)
+{
+  struct sect_info {
+    string name;
+    vector<size_t> keys;
+  };
+  struct key_info {
+    uint32_t section;
+    string name;
+    string value;
+  };
+  vector<sect_info> sects;
+  vector<key_info> keys;
+  vector<uint64_t> hashes;   //hash of each indexed entry
+  vector<uint32_t> entries;  //section or key index (with SECTION_FLAG) for each hash
+  unordered_map<uint64_t, uint32_t> first_sect; //hash -> first section with that name
+
+  uint64_t src_hash = content_hash (fp);
+  if (ferror (fp) || fseek (fp, 0, SEEK_SET))
+    return false;
+
+  char buffer[INI_BUFFERSIZE];
+  const char *name, *end;
+  char *sp, *ep;
+  bool in_section = false;   //inside a section
+  bool indexed = false;      //section is the first with this name
+  uint64_t sect_hash = 0;
+  unordered_map<uint64_t, uint32_t> sect_keys;  //hashes of keys in current section
+  while (read_line (buffer, sizeof (buffer), fp))
+  {
+    sp = skipleading (buffer);
+    if (*sp == '[')
+    {
+      in_section = indexed = false;
+      if ((ep = strchr (sp + 1, ']')) != NULL)
+      {
+        //same name as in enum_sections
+        *ep = 0;
+        *skiptrailing (sp + 1) = 0;
+        sects.push_back ({ sp + 1, {} });
+        in_section = true;
+
+        name = skipleading (sp + 1);
+        sect_hash = fold_hash64 (name, name + strlen (name));
+        auto p = first_sect.emplace (sect_hash, (uint32_t)(sects.size () - 1));
+        if (p.second)
+        {
+          indexed = true;
+          hashes.push_back (sect_hash);
+          entries.push_back ((uint32_t)(sects.size () - 1) | SECTION_FLAG);
+          sect_keys.clear ();
+        }
+        else
+        {
+          const char* other = skipleading (sects[p.first->second].name.c_str ());
+          if (!fold_equal (name, name + strlen (name), other, other + strlen (other)))
+            return false;  //different sections with same hash
+        }
+      }
+    }
+    else if (in_section && (name = key_name (buffer, end)) != NULL)
+    {
+      char* vs = skipleading (strchr (buffer, '=') + 1);
+      *skiptrailing (vs) = 0;
+      keys.push_back ({ (uint32_t)(sects.size () - 1), string (name, end), vs });
+      sects.back ().keys.push_back (keys.size () - 1);
+      if (!indexed)
+        continue;
+      uint64_t h = key_hash64 (sect_hash, name, end);
+      auto p = sect_keys.emplace (h, (uint32_t)(keys.size () - 1));
+      if (p.second)
+      {
+        hashes.push_back (h);
+        entries.push_back ((uint32_t)(keys.size () - 1));
+      }
+      else
+      {
+        const string& other = keys[p.first->second].name;
+        if (!fold_equal (name, end, other.c_str (), other.c_str () + other.size ()))
+          return false;  //different keys with same hash
+      }
+    }
+  }
+  if (ferror (fp))
+    return false;
+
+  //sorted string table
+  vector<const string*> strs;
+  for (auto& s : sects)
+    strs.push_back (&s.name);
+  for (auto& k : keys)
+  {
+    strs.push_back (&k.name);
+    strs.push_back (&k.value);
+  }
+  sort (strs.begin (), strs.end (), [](const string* s1, const string* s2) {return *s1 < *s2; });
+  string table;
+  std::map<string, uint32_t> offsets;
+  for (auto s : strs)
+  {
+    if (!table.empty () && offsets.count (*s))
+      continue;
+    offsets[*s] = (uint32_t)table.size ();
+    table.append (*s);
+    table.push_back (0);
+  }
+
+  //perfect hash table
+  vector<uint32_t> seeds, slots;
+  if (!build_perfect_hash (hashes, seeds, slots))
+    return false;
+  for (auto& s : slots)
+  {
+    if (s != NO_ENTRY)
+      s = entries[s];
+  }
+
+  img_header hdr;
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, IMG_MAGIC, sizeof (hdr.magic));
+  hdr.version = IMG_VERSION;
+  hdr.byte_order = IMG_BYTE_ORDER;
+  hdr.src_size = stamp.size;
+  hdr.src_mtime = stamp.mtime;
+  hdr.src_hash = src_hash;
+  hdr.nsections = (uint32_t)sects.size ();
+  hdr.nkeys = (uint32_t)keys.size ();
+  hdr.nbuckets = (uint32_t)seeds.size ();
+  hdr.nslots = (uint32_t)slots.size ();
+  hdr.sections = sizeof (img_header);
+  hdr.keys = hdr.sections + hdr.nsections * sizeof (img_section);
+  hdr.seeds = hdr.keys + hdr.nkeys * sizeof (img_key);
+  hdr.slots = hdr.seeds + hdr.nbuckets * sizeof (uint32_t);
+  hdr.strings = hdr.slots + hdr.nslots * sizeof (uint32_t);
+  hdr.strings_size = (uint32_t)table.size ();
+  hdr.image_size = (uint64_t)hdr.strings + hdr.strings_size;
+
+  vector<img_section> isects;
+  uint32_t first = 0;
+  for (auto& s : sects)
+  {
+    isects.push_back ({ offsets[s.name], first, (uint32_t)s.keys.size () });
+    first += (uint32_t)s.keys.size ();
+  }
+  vector<img_key> ikeys;
+  for (auto& k : keys)
+    ikeys.push_back ({ k.section, offsets[k.name], offsets[k.value] });
+
+  image.clear ();
+  image.reserve ((size_t)hdr.image_size);
+  image.append ((const char*)&hdr, sizeof (hdr));
+  image.append ((const char*)isects.data (), isects.size () * sizeof (img_section));
+  image.append ((const char*)ikeys.data (), ikeys.size () * sizeof (img_key));
+  image.append ((const char*)seeds.data (), seeds.size () * sizeof (uint32_t));
+  image.append ((const char*)slots.data (), slots.size () * sizeof (uint32_t));
+  image.append (table);
+  return true;
+}
+
+/*
+  Parse INI file and write the image file.
+*/
+bool ini_image::compile (FILE* fp, const file_stamp& stamp, const std::string& image_path)
+{
+  string image;
+  if (!build (fp, stamp, image))
+    return false;
+
+  string tmpname = tempname (image_path);
+  FILE* out = utf8::fopen (tmpname, "wb");
+  if (!out)
+    return false;
+  count (&stats_counters::opens);
+  write_bytes (image.data (), 1, image.size (), out);
+  bool ok = !ferror (out);
+  ok = (fclose (out) == 0) && ok;
+  if (!ok)
+  {
+    utf8::remove (tmpname);
+    return false;
+  }
+  return tmp_rename (image_path);
+}
+
+/*
+  Map an image file and check that it matches the INI file.
+  The image is up to date if the size of INI file matches and either the
+  modification time matches or the content hash matches.
+*/
+bool ini_image::open (const std::string& image_path, const std::string& source)
+{
+  hdr = nullptr;
+  return map.open (image_path) && check (source);
+}
+
+/*
+  Map an image published in a shared memory segment and check that it matches
+  the INI file.
+*/
+bool ini_image::open_shared (const std::string& segment, const std::string& source)
+{
+  hdr = nullptr;
+  return map.open_shared (segment) && check (source);
+}
+
+/// Validate mapped image and check that it matches the INI file
+bool ini_image::check (const std::string& source)
+{
+  if (map.size () < sizeof (img_header))
+  {
+    map.close ();
+    return false;
+  }
+
+  auto h = (const img_header*)map.data ();
+  if (memcmp (h->magic, IMG_MAGIC, sizeof (h->magic))
+   || h->version != IMG_VERSION
+   || h->byte_order != IMG_BYTE_ORDER
+   || h->image_size != map.size ()
+   || h->sections != sizeof (img_header)
+   || h->keys != h->sections + (uint64_t)h->nsections * sizeof (img_section)
+   || h->seeds != h->keys + (uint64_t)h->nkeys * sizeof (img_key)
+   || h->slots != h->seeds + (uint64_t)h->nbuckets * sizeof (uint32_t)
+   || h->strings != h->slots + (uint64_t)h->nslots * sizeof (uint32_t)
+   || h->image_size != (uint64_t)h->strings + h->strings_size
+   || h->nbuckets == 0 || h->nslots == 0
+   || h->strings_size == 0 || map.data ()[map.size () - 1] != 0)
+  {
+    map.close ();
+    return false;
+  }
+
+  file_stamp st;
+  if (!get_stamp (source, st) || st.size != h->src_size)
+  {
+    map.close ();
+    return false;
+  }
+  if (st.mtime != h->src_mtime)
+  {
+    //file was touched; check if content is still the same
+    FILE* fp = openread (source);
+    bool same = fp && content_hash (fp) == h->src_hash && !ferror (fp);
+    if (fp)
+      fclose (fp);
+    if (!same)
+    {
+      map.close ();
+      return false;
+    }
+  }
+  hdr = h;
+  checked = st;
+  return true;
+}
+
+/// Return true if INI file has not changed since the image was validated
+bool ini_image::fresh (const std::string& source) const
+{
+  file_stamp st;
+  return hdr && get_stamp (source, st) && st == checked;
+}
+
+/// Return the string at a given offset in string table
+const char* ini_image::str (uint32_t offset) const
+{
+  return (offset < hdr->strings_size) ? map.data () + hdr->strings + offset : "";
+}
+
+/// Return the hash table entry for a given hash
+uint32_t ini_image::lookup (uint64_t hash) const
+{
+  auto seeds = (const uint32_t*)(map.data () + hdr->seeds);
+  auto slots = (const uint32_t*)(map.data () + hdr->slots);
+  uint32_t seed = seeds[bucket_of (hash, hdr->nbuckets)];
+  return slots[slot_of (hash, seed, hdr->nslots)];
+}
+
+/// Return index of first section with given name or NO_ENTRY if not found
+uint32_t ini_image::find_section (const char* name, const char* end) const
+{
+  uint32_t e = lookup (fold_hash64 (name, end));
+  if (e == NO_ENTRY || !(e & SECTION_FLAG) || (e &= ~SECTION_FLAG) >= hdr->nsections)
+    return NO_ENTRY;
+
+  auto sects = (const img_section*)(map.data () + hdr->sections);
+  const char* sn = skipleading (str (sects[e].name));
+  if (!fold_equal (sn, sn + strlen (sn), name, end))
+    return NO_ENTRY;
+  return e;
+}
+
+/*
+  Find a key in the image. The value is copied in the buffer and the returned
+  view points inside the buffer.
+*/
+bool ini_image::findkey (const char* section, const char* key,
+                         char* buffer, size_t bsize, std::string_view& value) const
+{
+  section = skipleading (section);
+  key = skipleading (key);
+  const char* section_end = skiptrailing (section);
+  const char* key_end = skiptrailing (key);
+  uint32_t sidx = find_section (section, section_end);
+  if (sidx == NO_ENTRY)
+    return false;
+
+  uint64_t h = key_hash64 (fold_hash64 (section, section_end), key, key_end);
+  uint32_t e = lookup (h);
+  if (e == NO_ENTRY || (e & SECTION_FLAG) || e >= hdr->nkeys)
+    return false;
+
+  auto keys = (const img_key*)(map.data () + hdr->keys);
+  const char* kn = str (keys[e].name);
+  if (keys[e].section != sidx || !fold_equal (kn, kn + strlen (kn), key, key_end))
+    return false;
+
+  const char* v = str (keys[e].value);
+  size_t len = min (strlen (v), bsize - 1);
+  memcpy (buffer, v, len);
+  buffer[len] = 0;
+  value = string_view (buffer, len);
+  return true;
+}
+
+/// Invoke an enumeration function on each key in a section
+int ini_image::enum_keys (const char* section, std::function<void (const char*)> fun) const
+{
+  section = skipleading (section);
+  uint32_t sidx = find_section (section, skiptrailing (section));
+  if (sidx == NO_ENTRY)
+    return 0;
+
+  auto sects = (const img_section*)(map.data () + hdr->sections);
+  auto keys = (const img_key*)(map.data () + hdr->keys);
+  uint32_t first = sects[sidx].first_key;
+  uint32_t cnt = sects[sidx].nkeys;
+  if (first > hdr->nkeys || cnt > hdr->nkeys - first)
+    return 0;
+  for (uint32_t i = 0; i < cnt; i++)
+    fun (str (keys[first + i].name));
+  return (int)cnt;
+}
+
+/// Invoke an enumeration function on each section
+int ini_image::enum_sections (std::function<void (const char*)> fun) const
+{
+  auto sects = (const img_section*)(map.data () + hdr->sections);
+  for (uint32_t i = 0; i < hdr->nsections; i++)
+    fun (str (sects[i].name));
+  return (int)hdr->nsections;
+}
+
+//-----------------------------------------------------------------------------
+// Map an opened file in memory
+#ifdef _WIN32
+static bool map_file (HANDLE file, const char*& ptr, size_t& sz)
+{
+  LARGE_INTEGER fsize;
+  if (!GetFileSizeEx (file, &fsize) || (uint64_t)fsize.QuadPart > SIZE_MAX)
+    return false;
+  if (fsize.QuadPart)
+  {
+    HANDLE mapping = CreateFileMappingW (file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+    {
+      ptr = (const char*)MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle (mapping);
+    }
+    if (!ptr)
+      return false;
+  }
+  sz = (size_t)fsize.QuadPart;
+  return true;
+}
+#else
+static bool map_file (int fd, const char*& ptr, size_t& sz)
+{
+  struct stat sb;
+  if (fstat (fd, &sb))
+    return false;
+  if (sb.st_size)
+  {
+    void* p = mmap (NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      return false;
+    ptr = (const char*)p;
+  }
+  sz = (size_t)sb.st_size;
+  return true;
+}
+#endif
+
+/*
+  Map a file in memory. An empty file is mapped successfully but data() returns
+  NULL.
+*/
+bool mapped_file::open (const std::string& filename)
+{
+  close ();
+#ifdef _WIN32
+  HANDLE file = CreateFileW (scoped_wide (filename).c_str (), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+    NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  bool ok = map_file (file, ptr, sz);
+  CloseHandle (file);
+#else
+  int fd = ::open (filename.c_str (), O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool ok = map_file (fd, ptr, sz);
+  ::close (fd);
+#endif
+  if (ok)
+    count (&stats_counters::opens);
+  return ok;
+}
+
+/*
+  Map a shared memory segment. Shared memory segments are available only on
+  POSIX systems.
+*/
+bool mapped_file::open_shared (const std::string& name)
+{
+  close ();
+#ifdef _WIN32
+  return false;
+#else
+  int fd = shm_open (name.c_str (), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  bool ok = map_file (fd, ptr, sz);
+  ::close (fd);
+  return ok;
+#endif
+}
+
+/*
+  Map in memory a file opened for reading. The file remains open and its
+  position is not changed.
+*/
+bool mapped_file::open (FILE* fp)
+{
+  close ();
+#ifdef _WIN32
+  return map_file ((HANDLE)_get_osfhandle (_fileno (fp)), ptr, sz);
+#else
+  return map_file (fileno (fp), ptr, sz);
+#endif
+}
+
+/// Unmap file
+void mapped_file::close ()
+{
+  if (ptr)
+  {
+#ifdef _WIN32
+    UnmapViewOfFile (ptr);
+#else
+    munmap ((void*)ptr, sz);
+#endif
+  }
+  ptr = nullptr;
+  sz = 0;
+}
+
+} //namespace utf8
@@ -0,0 +1,166 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file iniparallel.cpp Parallel parsing of large INI files.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  Large files are mapped in memory and split in chunks at line boundaries.
+  Each chunk is parsed by a separate thread into a list of the section and key
+  lines it contains, with their names already folded and hashed. Hashing
+  names is the expensive part of parsing, and it is done in parallel.
+
+  A chunk doesn't know in what section it starts. The lists are merged in file
+  order, keeping track of the current section the same way as the sequential
+  parser does, so keys at the beginning of a chunk are assigned to the section
+  that started in a previous chunk.
+*/
+
+namespace utf8 {
+
+/// Files smaller than this are parsed sequentially
+static const size_t PARALLEL_MIN_SIZE = 8 * 1024 * 1024;
+
+/// Minimum size of a chunk parsed by one thread
+static const size_t CHUNK_MIN_SIZE = 2 * 1024 * 1024;
+
+/// Section or key line found in a chunk
+struct line_info {
+  enum kind : uint8_t {
+    section,    ///< section line
+    bracket,    ///< line starting with '[' that is not a valid section line
+    key         ///< key line
+  };
+  long offset;  ///< offset of line
+  long next;    ///< offset of next line
+  uint32_t hash;  ///< hash of folded section or key name
+  kind type;
+};
+
+// Parse a chunk of the file
+static void parse_chunk (const char* base, const char* first, const char* last,
+                         std::vector<line_info>& lines)
+{
+  std::string_view name;
+  IniEntry entry;
+  for (const char* p = first; p < last;)
+  {
+    const char* eol = line_end (p, last);
+    const char* sp = skip_spaces (p, eol);
+    long offset = (long)(p - base);
+    if (sp < eol && *sp == '[')
+    {
+      if (view_section (p, eol, name))
+      {
+        const char* ns = skip_spaces (name.data (), name.data () + name.size ());
+        lines.push_back ({ offset, (long)(eol - base),
+                           fold_hash (ns, name.data () + name.size ()), line_info::section });
+      }
+      else
+        lines.push_back ({ offset, (long)(eol - base), 0, line_info::bracket });
+    }
+    else if (view_entry (p, eol, entry))
+      lines.push_back ({ offset, (long)(eol - base),
+                         fold_hash (entry.key.data (), entry.key.data () + entry.key.size ()),
+                         line_info::key });
+    p = eol;
+  }
+}
+
+/*!
+  Build the index using multiple threads.
+  \param fp   INI file
+  \return     `false` if the file is too small or cannot be mapped in memory.
+
+  The result is the same as the one of the sequential parser, except for lines
+  longer than the line buffer (INI_BUFFERSIZE) that are parsed as one line.
+*/
+bool IniFile::index::build_parallel (FILE* fp)
+{
+  unsigned int ncpu = std::thread::hardware_concurrency ();
+  if (stamp.size < PARALLEL_MIN_SIZE || ncpu < 2)
+    return false;
+
+  mapped_file file;
+  if (!file.open (fp) || !file.data () || file.size () > (size_t)std::numeric_limits<long>::max ())
+    return false;
+
+  //split in chunks at line boundaries
+  const char* base = file.data ();
+  const char* last = base + file.size ();
+  size_t nchunks = std::min ((size_t)ncpu, file.size () / CHUNK_MIN_SIZE);
+  std::vector<const char*> limits{ base };
+  for (size_t i = 1; i < nchunks; i++)
+  {
+    const char* p = std::max (limits.back (), base + file.size () / nchunks * i);
+    p = line_end (p, last);
+    if (p < last && p > limits.back ())
+      limits.push_back (p);
+  }
+  limits.push_back (last);
+
+  std::vector<std::vector<line_info>> chunks (limits.size () - 1);
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks.size (); i++)
+    workers.emplace_back (parse_chunk, base, limits[i], limits[i + 1], std::ref (chunks[i]));
+  parse_chunk (base, limits[0], limits[1], chunks[0]);
+  for (auto& w : workers)
+    w.join ();
+
+  //merge chunks in file order
+  size_t nkeys = 0;
+  for (auto& c : chunks)
+    nkeys += c.size ();
+  keys.reserve (nkeys);
+
+  uint32_t sect_hash = 0;
+  bool in_section = false;  //inside first section with this hash
+  span* current = nullptr;  //location of current section
+  for (auto& c : chunks)
+  {
+    for (auto& l : c)
+    {
+      if (l.type == line_info::key)
+      {
+        if (in_section)
+          keys.emplace (combine (sect_hash, l.hash), l.offset);
+        continue;
+      }
+
+      in_section = false;
+      if (current)
+      {
+        current->end = l.offset;
+        current = nullptr;
+      }
+      if (l.type == line_info::section)
+      {
+        sect_hash = l.hash;
+        auto ins = sections.emplace (sect_hash, false);
+        if (ins.second)
+        {
+          in_section = true;
+          current = &spans.emplace (sect_hash, span{ l.offset, l.next, -1 }).first->second;
+        }
+        else
+          ins.first->second = true; //repeated section or hash collision
+      }
+    }
+  }
+  return true;
+}
+
+} //namespace utf8
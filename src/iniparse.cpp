@@ -0,0 +1,191 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file iniparse.cpp Event driven parser of INI files.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <vector>
+
+#include "internal.h"
+
+using namespace std;
+
+namespace utf8 {
+
+/// Size of parsing buffer
+static const size_t PARSE_BLOCK_SIZE = 64 * 1024;
+
+// Parse one line and send it to the handler
+static bool parse_line (const char* line, const char* eol, size_t offset, IniHandler& handler)
+{
+  const char* sp = skip_spaces (line, eol);
+  if (sp == eol)
+    return true;  //empty line
+
+  std::string_view name;
+  IniEntry entry;
+  if (*sp == ';')
+  {
+    sp = skip_spaces (sp + 1, eol);
+    return handler.comment (std::string_view (sp, trim_spaces (sp, eol) - sp), offset);
+  }
+  if (*sp == '[')
+  {
+    if (!view_section (sp, eol, name))
+      return true;  //malformed section line
+    const char* ns = skip_spaces (name.data (), name.data () + name.size ());
+    return handler.section (std::string_view (ns, name.data () + name.size () - ns), offset);
+  }
+  if (view_entry (sp, eol, entry))
+    return handler.entry (entry.key, entry.value, offset);
+  return true;  //malformed line
+}
+
+/*
+  Parse text returned by `read` function. The function is called with a
+  buffer and its size and returns the number of bytes placed in buffer or 0
+  at end of text. Sets `error` flag if a read error occurred.
+*/
+template <class R>
+static bool parse_blocks (R read, bool& error, IniHandler& handler)
+{
+  std::vector<char> buffer (PARSE_BLOCK_SIZE);
+  size_t used = 0;      //bytes in buffer
+  size_t offset = 0;    //offset of buffer start
+  bool first = true;
+  bool eof = false;
+
+  while (!eof)
+  {
+    if (used == buffer.size ())
+      buffer.resize (buffer.size () * 2); //line longer than buffer
+    size_t n = read (buffer.data () + used, buffer.size () - used);
+    if (n == 0)
+    {
+      if (error)
+        return false;
+      eof = true;
+    }
+    used += n;
+
+    const char* p = buffer.data ();
+    const char* last = p + used;
+    if (first && used >= 3 && !memcmp (p, "\xEF\xBB\xBF", 3))
+      p += 3;
+    first = first && used < 3;
+
+    //parse complete lines; at end of file the last line doesn't need a '\n'
+    const char* eol;
+    while (p < last && ((eol = (const char*)memchr (p, '\n', last - p)) != NULL || eof))
+    {
+      eol = eol ? eol + 1 : last;
+      if (!parse_line (p, eol, offset + (p - buffer.data ()), handler))
+        return false;
+      p = eol;
+    }
+
+    //move incomplete line at the beginning of buffer
+    size_t done = p - buffer.data ();
+    memmove (buffer.data (), p, used - done);
+    used -= done;
+    offset += done;
+  }
+  return true;
+}
+
+/*!
+  \param source   INI file opened for reading
+  \param handler  receiver of parsing events
+  \return         `true` if the whole file was parsed, `false` if the handler
+                  stopped the parsing or if a read error occurred.
+
+  The file is read in blocks into a buffer that is reused for the whole file,
+  so parsing uses the same amount of memory regardless of the size of the file.
+  The buffer grows only if a line is longer than the buffer.
+
+  Section and key names and values have leading and trailing spaces removed.
+  Comments are lines starting with ';'; their text doesn't include the
+  semicolon and surrounding spaces. Empty and malformed lines are skipped.
+  A UTF-8 BOM at the beginning of file is ignored.
+
+  Offsets passed to the handler are positions of lines from the current
+  position of the file.
+*/
+bool ini_parse (FILE* source, IniHandler& handler)
+{
+  bool error = false;
+  return parse_blocks ([&] (char* buf, size_t size) {
+      size_t n = read_bytes (buf, 1, size, source);
+      error = (n == 0 && ferror (source));
+      return n;
+    }, error, handler);
+}
+
+/*!
+  \param filename name of INI file
+  \param handler  receiver of parsing events
+  \return         `true` if the whole file was parsed, `false` if the file
+                  could not be opened, the handler stopped the parsing or a
+                  read error occurred.
+
+  UTF-16 files are transcoded to UTF-8 block by block while parsing and
+  offsets refer to the transcoded text. Memory use doesn't depend on the size
+  of the file in either case.
+*/
+bool ini_parse (const std::string& filename, IniHandler& handler)
+{
+  FILE* fp = openraw (filename);
+  if (!fp)
+    return false;
+
+  bool ret;
+  unsigned char bom[2];
+  bool big_endian;
+  if (utf16_bom (bom, fread (bom, 1, sizeof (bom), fp), big_endian))
+  {
+    std::vector<char> raw (PARSE_BLOCK_SIZE);
+    size_t keep = 0;      //undecoded bytes at the beginning of raw buffer
+    std::string text;     //decoded text not yet passed to parser
+    size_t pos = 0;       //position of first byte not passed to parser
+    bool eof = false, error = false;
+
+    ret = parse_blocks ([&] (char* buf, size_t size) -> size_t {
+        while (pos == text.size () && !eof)
+        {
+          text.clear ();
+          pos = 0;
+          size_t n = read_bytes (raw.data () + keep, 1, raw.size () - keep, fp);
+          if (n == 0)
+          {
+            error = ferror (fp) != 0;
+            eof = true;
+            utf16_to_utf8 (raw.data (), keep, big_endian, text);
+            break;
+          }
+          n += keep;
+          size_t done = utf16_to_utf8 (raw.data (), n, big_endian, text, false);
+          keep = n - done;
+          memmove (raw.data (), raw.data () + done, keep);
+        }
+        size_t n = std::min (size, text.size () - pos);
+        memcpy (buf, text.data () + pos, n);
+        pos += n;
+        return n;
+      }, error, handler);
+  }
+  else
+  {
+    fseek (fp, 0, SEEK_SET);
+    ret = ini_parse (fp, handler);
+  }
+  fclose (fp);
+  return ret;
+}
+
+} //namespace utf8
@@ -0,0 +1,209 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file inishared.cpp Compiled images of INI files shared between processes.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <atomic>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  A shared snapshot uses a small control segment, with the same name as the
+  snapshot, that holds the current generation number. The compiled image of
+  each generation is in a separate segment named "<name>.<generation>".
+  Generation 0 means no image has been published yet.
+
+  To publish a new image, a process creates the segment of the next generation
+  (it fails if another process is already doing it), writes the image and then
+  advances the generation number with an atomic compare-and-swap. The segment
+  of the previous generation is unlinked.
+
+  Shared memory segments are available only on POSIX systems.
+*/
+
+namespace utf8 {
+
+/// Content of control segment
+struct shm_control {
+  std::atomic<uint64_t> generation;
+};
+
+static_assert (std::atomic<uint64_t>::is_always_lock_free,
+               "generation counter must be lock-free to live in shared memory");
+
+/// Time after which an unfinished publication is considered abandoned
+static const int ABANDONED_SECONDS = 30;
+
+/// Time to wait before trying again after a failure
+static const std::chrono::seconds RETRY_INTERVAL (1);
+
+// Return a valid shared memory name
+static std::string shm_name (const std::string& name)
+{
+  return (!name.empty () && name[0] == '/') ? name : '/' + name;
+}
+
+shared_snapshot::shared_snapshot (const std::string& name_)
+  : name (shm_name (name_))
+{
+}
+
+shared_snapshot::~shared_snapshot ()
+{
+#ifndef _WIN32
+  if (control)
+    munmap (control, sizeof (shm_control));
+#endif
+}
+
+/// Name of image segment of a generation
+std::string shared_snapshot::segment (uint64_t generation) const
+{
+  return name + '.' + std::to_string (generation);
+}
+
+/// Create or open the control segment
+bool shared_snapshot::open_control ()
+{
+#ifdef _WIN32
+  return false;
+#else
+  int fd = shm_open (name.c_str (), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+    return false;
+  struct stat sb;
+  //a new segment is filled with zeroes: generation 0
+  bool ok = !fstat (fd, &sb)
+    && ((size_t)sb.st_size >= sizeof (shm_control) || !ftruncate (fd, sizeof (shm_control)));
+  void* p = ok ? mmap (NULL, sizeof (shm_control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close (fd);
+  if (p == MAP_FAILED)
+    return false;
+  control = (shm_control*)p;
+  return true;
+#endif
+}
+
+/*
+  Compile the INI file and publish its image as the generation following
+  the given one.
+*/
+bool shared_snapshot::publish (const std::string& source, uint64_t generation)
+{
+#ifdef _WIN32
+  return false;
+#else
+  file_stamp st;
+  FILE* fp = openread (source, &st);
+  if (!fp)
+    return false;
+  std::string image;
+  bool ok = ini_image::build (fp, st, image);
+  fclose (fp);
+  if (!ok)
+    return false;
+
+  std::string seg = segment (generation + 1);
+  int fd = shm_open (seg.c_str (), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    struct stat sb;
+    if (errno == EEXIST && (fd = shm_open (seg.c_str (), O_RDONLY, 0)) >= 0)
+    {
+      //another process is publishing; remove the segment if it was abandoned
+      if (!fstat (fd, &sb) && time (NULL) - sb.st_mtime > ABANDONED_SECONDS
+       && control->generation.load () == generation)
+        shm_unlink (seg.c_str ());
+      close (fd);
+    }
+    return false;
+  }
+
+  void* p = MAP_FAILED;
+  if (!ftruncate (fd, image.size ()))
+    p = mmap (NULL, image.size (), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED)
+  {
+    shm_unlink (seg.c_str ());
+    return false;
+  }
+  memcpy (p, image.data (), image.size ());
+  munmap (p, image.size ());
+  count (&stats_counters::bytes_written, image.size ());
+
+  if (!control->generation.compare_exchange_strong (generation, generation + 1))
+  {
+    shm_unlink (seg.c_str ());
+    return false;
+  }
+  if (generation)
+    shm_unlink (segment (generation).c_str ());
+  return true;
+#endif
+}
+
+/*
+  Return the current image, publishing a new one if there is none or if
+  the INI file has changed.
+*/
+std::unique_ptr<ini_image> shared_snapshot::attach (const std::string& source)
+{
+  if (std::chrono::steady_clock::now () < retry
+   || (!control && !open_control ()))
+    return nullptr;
+
+  auto img = std::make_unique<ini_image> ();
+  uint64_t generation = control->generation.load ();
+  if (generation && img->open_shared (segment (generation), source))
+    return img;
+
+  //missing or stale image
+  if (publish (source, generation)
+   && img->open_shared (segment (control->generation.load ()), source))
+    return img;
+
+  retry = std::chrono::steady_clock::now () + RETRY_INTERVAL;
+  return nullptr;
+}
+
+/// Unlink control segment and image segment of current generation
+bool shared_snapshot::remove (const std::string& name)
+{
+#ifdef _WIN32
+  return false;
+#else
+  shared_snapshot snap (name);
+  int fd = shm_open (snap.name.c_str (), O_RDWR, 0);
+  if (fd < 0)
+    return false;
+  close (fd);
+  if (snap.open_control ())
+  {
+    uint64_t generation = snap.control->generation.load ();
+    if (generation)
+      shm_unlink (snap.segment (generation).c_str ());
+  }
+  return shm_unlink (snap.name.c_str ()) == 0;
+#endif
+}
+
+} //namespace utf8
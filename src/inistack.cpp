@@ -0,0 +1,259 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file inistack.cpp Implementation of IniStack class
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "internal.h"
+
+using namespace std;
+
+/*
+  Each layer keeps the values of its keys, indexed by the case-folded
+  "section\0key" string. The merged index has, for each key, a bit mask of the
+  layers that contain it and a pointer to the value in the top-most of them.
+
+  Before each lookup, the size and modification time of each file are checked.
+  A file that has changed is parsed again and only the keys it had before
+  and the keys it has now are updated in the merged index.
+*/
+
+namespace utf8 {
+
+/// Maximum number of layers (bits in a layer mask)
+static const size_t MAX_LAYERS = 64;
+
+struct IniStack::index {
+  /// One file of the stack
+  struct layer {
+    std::string filename;
+    file_stamp stamp{ 0, 0, 0 };
+    bool loaded = false;
+    std::unordered_map<std::u32string, std::string> values; ///< folded "section\0key" -> value
+  };
+
+  /// Entry in merged index
+  struct entry {
+    uint64_t layers = 0;                ///< layers that contain the key
+    const std::string* value = nullptr; ///< value in top-most layer
+  };
+
+  void refresh ();
+  void load (size_t i);
+  void update (const std::u32string& key, std::unordered_map<std::u32string, entry>::iterator p);
+  const std::string* find (const std::string& key, const std::string& section, int& layer);
+
+  std::mutex lock;
+  std::deque<layer> layers;
+  std::unordered_map<std::u32string, entry> merged;
+};
+
+// Case-folded "section\0key" string
+static std::u32string folded_key (std::string_view section, std::string_view key)
+{
+  std::u32string k = fold_name (section.data (), section.data () + section.size ());
+  k.push_back (U'\0');
+  k += fold_name (key.data (), key.data () + key.size ());
+  return k;
+}
+
+/// Collector of keys of a layer
+struct layer_loader : public IniHandler {
+  bool section (std::string_view name, size_t) override
+  {
+    std::u32string sect = fold_name (name.data (), name.data () + name.size ());
+    //as in IniFile, only the first section with a name is used
+    active = seen.insert (sect).second;
+    current = name;
+    return true;
+  }
+
+  bool entry (std::string_view key, std::string_view value, size_t) override
+  {
+    if (active)
+      values.emplace (folded_key (current, key), std::string (value));
+    return true;
+  }
+
+  std::unordered_map<std::u32string, std::string> values;
+  std::unordered_set<std::u32string> seen;
+  std::string current;
+  bool active = false;
+};
+
+/// Reparse files that have changed
+void IniStack::index::refresh ()
+{
+  for (size_t i = 0; i < layers.size (); i++)
+  {
+    file_stamp st{ 0, 0, 0 };
+    if (!get_stamp (layers[i].filename, st))
+      st = { 0, 0, 0 };
+    if (!layers[i].loaded || !(st == layers[i].stamp))
+    {
+      layers[i].stamp = st;
+      load (i);
+    }
+  }
+}
+
+/// Parse a layer and update merged index
+void IniStack::index::load (size_t i)
+{
+  layer_loader loader;
+  ini_parse (layers[i].filename, loader);
+
+  uint64_t bit = (uint64_t)1 << i;
+  auto old = std::move (layers[i].values);
+  layers[i].values = std::move (loader.values);
+  layers[i].loaded = true;
+  for (auto& v : old)
+  {
+    auto p = merged.find (v.first);
+    p->second.layers &= ~bit;
+    update (v.first, p);
+  }
+  for (auto& v : layers[i].values)
+  {
+    auto p = merged.emplace (v.first, entry ()).first;
+    p->second.layers |= bit;
+    update (v.first, p);
+  }
+}
+
+/// Find the winning layer of a key or remove the key if no layer has it
+void IniStack::index::update (const std::u32string& key,
+                              std::unordered_map<std::u32string, entry>::iterator p)
+{
+  if (!p->second.layers)
+  {
+    merged.erase (p);
+    return;
+  }
+  size_t top = layers.size ();
+  while (!(p->second.layers & ((uint64_t)1 << --top)))
+    ;
+  p->second.value = &layers[top].values.find (key)->second;
+}
+
+/// Return the value of a key and the layer that contains it
+const std::string* IniStack::index::find (const std::string& key, const std::string& section, int& layer)
+{
+  refresh ();
+  const char* sn = skipleading (section.c_str ());
+  const char* kn = skipleading (key.c_str ());
+  auto p = merged.find (folded_key (std::string_view (sn, skiptrailing (sn) - sn),
+                                    std::string_view (kn, skiptrailing (kn) - kn)));
+  if (p == merged.end ())
+  {
+    layer = -1;
+    return nullptr;
+  }
+  for (layer = (int)layers.size () - 1; !(p->second.layers & ((uint64_t)1 << layer)); layer--)
+    ;
+  return p->second.value;
+}
+
+//-----------------------------------------------------------------------------
+IniStack::IniStack ()
+  : idx{ std::make_unique<index> () }
+{
+}
+
+/*!
+  \param files  names of INI files, from the bottom layer to the top one
+*/
+IniStack::IniStack (std::initializer_list<std::string> files)
+  : idx{ std::make_unique<index> () }
+{
+  for (auto& f : files)
+    Push (f);
+}
+
+IniStack::~IniStack () = default;
+
+/*!
+  \param filename name of INI file
+  \return         `false` if there are too many layers (more than 64)
+
+  The file doesn't have to exist; a missing file is an empty layer. Files are
+  parsed when they are first needed.
+*/
+bool IniStack::Push (const std::string& filename)
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  if (idx->layers.size () == MAX_LAYERS)
+    return false;
+  idx->layers.emplace_back ();
+  idx->layers.back ().filename = filename;
+  return true;
+}
+
+/*!
+  \param file   INI file object
+  \return       `false` if there are too many layers (more than 64)
+
+  Only the file content is used. Pending asynchronous changes and journal files
+  of the object are not visible through the stack.
+*/
+bool IniStack::Push (const IniFile& file)
+{
+  return Push (file.File ());
+}
+
+size_t IniStack::Size () const
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  return idx->layers.size ();
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+  \param defval   default value
+  \return         value from the top-most layer that has the key or the
+                  default value if no layer has it
+*/
+std::string IniStack::GetString (const std::string& key, const std::string& section,
+                                 const std::string& defval) const
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  int layer;
+  auto value = idx->find (key, section, layer);
+  return value ? *value : defval;
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+*/
+bool IniStack::HasKey (const std::string& key, const std::string& section) const
+{
+  return Layer (key, section) >= 0;
+}
+
+/*!
+  \param key      key name
+  \param section  section name
+  \return         index of the top-most layer that has the key (0 is the bottom
+                  layer) or -1 if no layer has it
+*/
+int IniStack::Layer (const std::string& key, const std::string& section) const
+{
+  std::lock_guard<std::mutex> l (idx->lock);
+  int layer;
+  idx->find (key, section, layer);
+  return layer;
+}
+
+} //namespace utf8
@@ -0,0 +1,648 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file internal.h Definitions shared between INI file modules.
+/// This file is not part of the public interface of the library.
+#pragma once
+
+#include <utf8/utf8.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Maximum line length for a line in an INI file
+#define INI_BUFFERSIZE  1024
+
+namespace utf8 {
+
+//----------------------------------------------------------------------------
+//  Some string manipulation functions.
+//  Template-ized to allow for const/non-const arguments
+
+// Skip leading spaces and non-printing characters
+template <class T> inline T* skipleading (T* str)
+{
+  assert (str);
+  while (*str > 0 && *str <= ' ')
+    str++;
+  return str;
+}
+
+// Return a pointer to the first trailing space character
+template <class T> inline T* skiptrailing (T* str)
+{
+  assert (str);
+  T* tail = str;
+  unsigned char c;
+  while ((c = *str++) != 0)
+  {
+    if (c > ' ')
+      tail = str;
+  }
+  return tail;
+}
+
+//-----------------------------------------------------------------------------
+/*  Section and key names are case-insensitive. They are compared using the same
+    Unicode case folding tables as utf8::tolower() function, so that names
+    that differ only in case are equal in any script, not only in Latin. */
+
+// Decode a character of a name, fold it to lowercase and advance the pointer
+inline char32_t fold_next (const char*& p)
+{
+  unsigned char c = *p;
+  if (c < 0x80)
+  {
+    ++p;
+    return ('A' <= c && c <= 'Z') ? c + 0x20 : c;
+  }
+  //invalid encodings are folded to REPLACEMENT_CHARACTER; they never throw
+  auto mode = error_mode (action::replace);
+  char32_t r = next (p);
+  error_mode (mode);
+  return tolower (r);
+}
+
+// FNV-1a hash of case-folded name
+inline uint32_t fold_hash (const char* name, const char* end)
+{
+  uint32_t h = 2166136261u;
+  while (name < end)
+  {
+    h ^= fold_next (name);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Case-folded form of a name
+inline std::u32string fold_name (const char* name, const char* end)
+{
+  std::u32string folded;
+  while (name < end)
+    folded.push_back (fold_next (name));
+  return folded;
+}
+
+// Return true if two names are equal ignoring the case
+inline bool fold_equal (const char* n1, const char* e1, const char* n2, const char* e2)
+{
+  while (n1 < e1 && n2 < e2)
+  {
+    if (fold_next (n1) != fold_next (n2))
+      return false;
+  }
+  return n1 == e1 && n2 == e2;
+}
+
+/* Find the name in a section line. If line is a section line, returns a pointer
+   to the first character of section name and sets 'end' to the end of the name.
+   Otherwise returns NULL. */
+inline const char* section_name (const char* line, const char*& end)
+{
+  const char* sp = skipleading (line);
+  const char* ep;
+  if (*sp != '[' || !(ep = strchr (sp, ']')))
+    return NULL;
+  sp = skipleading (sp + 1);
+  end = (ep > sp) ? ep : sp;
+  while (end > sp && (unsigned char)*(end - 1) <= ' ')
+    --end;
+  return sp;
+}
+
+/* Find the key name in a line. Returns pointer to first character of key name and
+   sets 'end' to the end of the name or NULL if line is a comment or doesn't
+   have an '=' sign. */
+inline const char* key_name (const char* line, const char*& end)
+{
+  const char* sp = skipleading (line);
+  const char* ep;
+  if (*sp == ';' || !(ep = strchr (sp, '=')))
+    return NULL;
+  end = ep;
+  while (end > sp && (unsigned char)*(end - 1) <= ' ')
+    --end;
+  return sp;
+}
+
+//-----------------------------------------------------------------------------
+//  Lines that are not null-terminated (mapped files and IniDocument lines)
+
+// Return the beginning of next line
+inline const char* line_end (const char* p, const char* last)
+{
+  auto eol = (const char*)memchr (p, '\n', last - p);
+  return eol ? eol + 1 : last;
+}
+
+// Skip leading spaces (like skipleading) without going past the end of line
+inline const char* skip_spaces (const char* p, const char* eol)
+{
+  while (p < eol && *p > 0 && *p <= ' ')
+    p++;
+  return p;
+}
+
+// Remove trailing spaces (like skiptrailing)
+inline const char* trim_spaces (const char* begin, const char* end)
+{
+  while (end > begin && (unsigned char)*(end - 1) <= ' ')
+    --end;
+  return end;
+}
+
+/* If line is a section line, return the section name in the same way as
+   enum_sections() function. */
+inline bool view_section (const char* line, const char* eol, std::string_view& name)
+{
+  const char* sp = skip_spaces (line, eol);
+  const char* ep;
+  if (sp == eol || *sp != '[' || !(ep = (const char*)memchr (sp, ']', eol - sp)))
+    return false;
+  sp++;
+  name = std::string_view (sp, trim_spaces (sp, ep) - sp);
+  return true;
+}
+
+/* If line is a key line, return the key name and value in the same way as
+   enum_keys() and findkey() functions. */
+inline bool view_entry (const char* line, const char* eol, IniEntry& entry)
+{
+  const char* sp = skip_spaces (line, eol);
+  const char* ep;
+  if (sp == eol || *sp == ';' || !(ep = (const char*)memchr (sp, '=', eol - sp)))
+    return false;
+  entry.key = std::string_view (sp, trim_spaces (sp, ep) - sp);
+  const char* vs = skip_spaces (ep + 1, eol);
+  entry.value = std::string_view (vs, trim_spaces (vs, eol) - vs);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+//  Operation counters
+
+/// Counters of operations updated concurrently
+struct stats_counters {
+  std::atomic<uint64_t> opens{ 0 };
+  std::atomic<uint64_t> bytes_read{ 0 };
+  std::atomic<uint64_t> bytes_written{ 0 };
+  std::atomic<uint64_t> rewrites{ 0 };
+  std::atomic<uint64_t> skipped_writes{ 0 };
+  std::atomic<uint64_t> rename_retries{ 0 };
+  std::atomic<uint64_t> calls[IniStats::op_count] = {};
+  std::atomic<int64_t> nanos[IniStats::op_count] = {};
+
+  IniStats snapshot () const;
+};
+
+/// Counters of all operations in this process
+stats_counters& global_counters ();
+
+/// Counters of the object whose operation is in progress on this thread
+inline stats_counters*& current_counters ()
+{
+  static thread_local stats_counters* counters = nullptr;
+  return counters;
+}
+
+/// Increment a counter both for the current object and for the whole process
+inline void count (std::atomic<uint64_t> stats_counters::*field, uint64_t n = 1)
+{
+  global_counters ().*field += n;
+  if (auto c = current_counters ())
+    c->*field += n;
+}
+
+/*
+  Timer of an operation. Only the outermost operation on a thread is timed;
+  operations nested inside it are counted as part of the outer one.
+*/
+class stats_scope
+{
+public:
+  stats_scope (stats_counters& obj, IniStats::op kind, const std::string& file);
+  ~stats_scope ();
+
+private:
+  stats_counters* obj;  ///< NULL if this is a nested operation
+  IniStats::op kind;
+  const std::string& file;
+  std::chrono::steady_clock::time_point start;
+};
+
+// fgets() that counts bytes read
+inline char* read_line (char* buffer, int size, FILE* fp)
+{
+  char* ret = fgets (buffer, size, fp);
+  if (ret)
+    count (&stats_counters::bytes_read, strlen (ret));
+  return ret;
+}
+
+// fputs() that counts bytes written
+inline int write_line (const char* str, FILE* fp)
+{
+  int ret = fputs (str, fp);
+  if (ret >= 0)
+    count (&stats_counters::bytes_written, strlen (str));
+  return ret;
+}
+
+// fread() that counts bytes read
+inline size_t read_bytes (void* buffer, size_t size, size_t n, FILE* fp)
+{
+  size_t ret = fread (buffer, size, n, fp);
+  count (&stats_counters::bytes_read, ret * size);
+  return ret;
+}
+
+// fwrite() that counts bytes written
+inline size_t write_bytes (const void* buffer, size_t size, size_t n, FILE* fp)
+{
+  size_t ret = fwrite (buffer, size, n, fp);
+  count (&stats_counters::bytes_written, ret * size);
+  return ret;
+}
+
+//-----------------------------------------------------------------------------
+//  File manipulation functions 
+
+/// Identification of a file version: file id, size and modification time
+struct file_stamp {
+  uint64_t id;
+  uint64_t size;
+  uint64_t mtime;
+
+  bool operator== (const file_stamp& other) const
+  {
+    return id == other.id && size == other.size && mtime == other.mtime;
+  }
+};
+
+file_stamp get_stamp (FILE* fp);
+bool get_stamp (const std::string& filename, file_stamp& stamp);
+
+size_t utf16_to_utf8 (const char* data, size_t size, bool big_endian, std::string& out,
+                      bool final = true, bool strict = false);
+FILE* open_utf16 (FILE* fp, const std::string& fname, bool big_endian);
+
+// Return true if data starts with a UTF-16 BOM. Sets 'big_endian' flag.
+inline bool utf16_bom (const unsigned char* data, size_t size, bool& big_endian)
+{
+  if (size < 2 || !((data[0] == 0xFF && data[1] == 0xFE) || (data[0] == 0xFE && data[1] == 0xFF)))
+    return false;
+  big_endian = (data[0] == 0xFE);
+  return true;
+}
+
+// Open an INI file for reading without transcoding it
+inline
+FILE *openraw (const std::string& fname)
+{
+#ifdef _WIN32
+  FILE* fp = utf8::fopen (fname, "rb, ccs=UTF-8");
+#else
+  FILE* fp = fopen (fname.c_str (), "rb");
+#endif
+  if (fp)
+    count (&stats_counters::opens);
+  return fp;
+}
+
+/*
+  Open an INI file for reading. Files starting with a UTF-16 BOM are
+  transcoded to UTF-8 (see open_utf16); all other files are read as they are.
+  If `stamp` is not null, it receives the stamp of the INI file, not the one of
+  the transcoded temporary file.
+*/
+inline
+FILE *openread (const std::string& fname, file_stamp* stamp = nullptr)
+{
+  FILE* fp = openraw (fname);
+  if (fp)
+  {
+    if (stamp)
+      *stamp = get_stamp (fp);
+    unsigned char bom[2];
+    bool big_endian;
+    if (utf16_bom (bom, fread (bom, 1, sizeof (bom), fp), big_endian))
+      return open_utf16 (fp, fname, big_endian);
+    fseek (fp, 0, SEEK_SET);
+  }
+  return fp;
+}
+
+inline
+FILE *openwrite (const std::string& fname)
+{
+#ifdef _WIN32
+  FILE* fp = utf8::fopen (fname, "wb, ccs=UTF-8");
+#else
+  FILE* fp = fopen (fname.c_str (), "wb");
+#endif
+  if (fp)
+    count (&stats_counters::opens);
+  return fp;
+}
+
+/*
+  Get a temporary file name to copy to.
+  Use the existing name and append a '~' character at the end.
+*/
+inline
+std::string tempname (const std::string& source)
+{
+  return source + '~';
+}
+
+bool tmp_rename (const std::string& filename);
+std::string section_line (const char* section);
+std::string key_line (const char* key, const char* value);
+
+//-----------------------------------------------------------------------------
+//  Pending changes (see inijournal.cpp)
+
+/// Change of a key: a new value or a deletion
+struct ini_change {
+  std::string section;    ///< section name without leading and trailing spaces
+  std::string key;        ///< key name without leading and trailing spaces
+  std::string value;      ///< value as it will be read back from the file
+  bool erase;             ///< key is deleted
+
+  ini_change (const char* section, const char* key, const char* value);
+};
+
+/*
+  Changes layered over the content of an INI file.
+  Reading functions look first at the changes and only if a key hasn't been
+  changed, they look in the file.
+*/
+class ini_changes
+{
+public:
+  void add (ini_change&& chg);
+  void clear ();
+  bool empty () const
+    { return changes.empty (); }
+  const std::vector<ini_change>& list () const
+    { return changes; }
+
+  int find (const char* section, const char* key, std::string_view& value) const;
+  int merge_keys (const char* section, const std::vector<std::string>& base,
+                  std::function<void (const char*)> fun) const;
+  int merge_sections (const std::vector<std::string>& base,
+                      std::function<void (const char*)> fun) const;
+
+private:
+  struct key_state {
+    size_t last;          ///< index of last change
+    size_t created;       ///< index of change that added the key at the end of section
+    bool erased;          ///< key has been deleted at least once
+  };
+  std::vector<ini_change> changes;
+  std::unordered_map<std::u32string, key_state> keys;  ///< folded "section\0key" -> state
+  std::unordered_map<std::u32string, size_t> sections; ///< folded section -> first change
+};
+
+bool apply_changes (const std::string& filename, const std::vector<ini_change>& changes);
+
+//-----------------------------------------------------------------------------
+/// Background writer of changes (see iniasync.cpp)
+class async_writer
+{
+public:
+  async_writer (const std::string& filename, std::chrono::milliseconds debounce,
+                std::chrono::milliseconds max_delay, stats_counters& counters);
+  ~async_writer ();
+
+  void add (ini_change&& chg);
+  bool empty ();
+  int find (const char* section, const char* key, char* buffer, size_t bsize, std::string_view& value);
+  int merge_keys (const char* section, const std::vector<std::string>& base,
+                  std::function<void (const char*)> fun);
+  int merge_sections (const std::vector<std::string>& base, std::function<void (const char*)> fun);
+
+  std::future<bool> flush_async ();
+  bool flush ();
+
+private:
+  void run ();
+
+  std::string filename;
+  stats_counters& counters;
+  std::chrono::milliseconds debounce;
+  std::chrono::milliseconds max_delay;
+  std::mutex lock;
+  std::condition_variable cv;
+  ini_changes pending;    ///< changes not yet written, including the ones being written
+  uint64_t queued = 0;    ///< number of changes received
+  std::vector<std::pair<uint64_t, std::promise<bool>>> waiters; ///< flush requests
+  bool stop = false;
+  bool flush_now = false;
+  std::chrono::steady_clock::time_point first;  ///< time of oldest pending change
+  std::chrono::steady_clock::time_point last;   ///< time of newest pending change
+  std::thread worker;
+};
+
+//-----------------------------------------------------------------------------
+//  Journal files
+
+std::string journal_name (const std::string& filename);
+bool compact_journal (const std::string& filename);
+
+/// Parsed content of a journal file
+struct journal_state {
+  bool refresh (const std::string& filename);
+
+  ini_changes changes;
+  file_stamp stamp{ 0, 0, 0 };
+  std::string id;         ///< header of journal file
+  long offset = 0;        ///< end of parsed content
+};
+
+/// Writer of a journal file with background compaction
+class journal_writer
+{
+public:
+  journal_writer (const std::string& filename, size_t max_size, std::chrono::milliseconds max_age,
+                  stats_counters& counters);
+  ~journal_writer ();
+
+  bool append (const ini_change& chg);
+  bool compact ();
+
+private:
+  void run ();
+
+  std::string filename;
+  stats_counters& counters;
+  size_t max_size;
+  std::chrono::milliseconds max_age;
+  std::mutex lock;
+  std::condition_variable cv;
+  bool stop = false;
+  bool full = false;      ///< size threshold crossed
+  bool pending = false;   ///< journal has content
+  std::chrono::steady_clock::time_point first;  ///< time when journal was started
+  std::thread worker;
+};
+
+/// Read-only memory mapping of a file
+class mapped_file
+{
+public:
+  mapped_file () = default;
+  mapped_file (const mapped_file&) = delete;
+  mapped_file& operator= (const mapped_file&) = delete;
+  ~mapped_file ()
+    { close (); }
+
+  bool open (const std::string& filename);
+  bool open (FILE* fp);
+  bool open_shared (const std::string& name);
+  void close ();
+
+  /// Pointer to file content or NULL if file is empty
+  const char* data () const
+    { return ptr; }
+
+  /// Size of file
+  size_t size () const
+    { return sz; }
+
+private:
+  const char* ptr = nullptr;
+  size_t sz = 0;
+};
+
+/// \cond
+namespace detail {
+/// File mapping shared by IniSections and IniEntries ranges
+struct mapping {
+  bool open (const std::string& filename);
+
+  /// Pointer to file content or NULL if file is empty
+  const char* data () const
+    { return text.empty () ? file.data () : text.data (); }
+
+  /// Size of content
+  size_t size () const
+    { return text.empty () ? file.size () : text.size (); }
+
+  mapped_file file;
+  std::string text;       ///< content of UTF-16 files transcoded to UTF-8
+};
+}
+/// \endcond
+
+struct img_header;
+
+/// Compiled image of an INI file (see inimage.cpp)
+class ini_image
+{
+public:
+  static bool build (FILE* fp, const file_stamp& stamp, std::string& image);
+  static bool compile (FILE* fp, const file_stamp& stamp, const std::string& image_path);
+
+  bool open (const std::string& image_path, const std::string& source);
+  bool open_shared (const std::string& segment, const std::string& source);
+  bool fresh (const std::string& source) const;
+
+  bool findkey (const char* section, const char* key, char* buffer, size_t bsize, std::string_view& value) const;
+  int enum_keys (const char* section, std::function<void (const char*)> fun) const;
+  int enum_sections (std::function<void (const char*)> fun) const;
+
+private:
+  bool check (const std::string& source);
+  uint32_t lookup (uint64_t hash) const;
+  uint32_t find_section (const char* name, const char* end) const;
+  const char* str (uint32_t offset) const;
+
+  mapped_file map;
+  const img_header* hdr = nullptr;
+  file_stamp checked{ 0, 0, 0 };   ///< stamp of source file when image was validated
+};
+
+/// Compiled image published in shared memory (see inishared.cpp)
+class shared_snapshot
+{
+public:
+  shared_snapshot (const std::string& name);
+  ~shared_snapshot ();
+
+  std::unique_ptr<ini_image> attach (const std::string& source);
+  static bool remove (const std::string& name);
+
+private:
+  bool open_control ();
+  std::string segment (uint64_t generation) const;
+  bool publish (const std::string& source, uint64_t generation);
+
+  std::string name;
+  struct shm_control* control = nullptr;
+  std::chrono::steady_clock::time_point retry;  ///< time of next attempt after a failure
+};
+
+//-----------------------------------------------------------------------------
+/*
+  Lookup index of an INI file.
+
+  When the file is parsed, each section and key name is folded and hashed once.
+  The index maps the combined (section, key) hash to the file offset of the
+  key line. Finding a key takes one hash probe and reading one line from
+  the file.
+
+  As in the Windows API, only the first section with a given name is searched.
+  If two different section names have the same hash, the index cannot tell
+  them apart and the lookup falls back to scanning the file.
+
+  For each section the index keeps also the offsets of section line, of the
+  first line after it and of the end of section. This allows whole sections
+  to be copied as byte ranges.
+*/
+struct IniFile::index {
+  /// Location of a section in the file
+  struct span {
+    long line;            ///< offset of section line
+    long body;            ///< offset of first line after section line
+    long end;             ///< offset of next section line or -1 if section ends at EOF
+  };
+
+  static uint64_t combine (uint32_t sect_hash, uint32_t key_hash)
+  {
+    return ((uint64_t)sect_hash << 32) | key_hash;
+  }
+
+  void build (FILE* fp, const file_stamp& st);
+  bool build_parallel (FILE* fp);
+  ini_image* current_image (const std::string& filename);
+
+  std::mutex lock;
+  stats_counters counters;                   ///< operations performed by this object
+  bool valid = false;
+  file_stamp stamp{ 0, 0, 0 };
+  std::unordered_map<uint32_t, bool> sections; ///< section hash -> more than one section has this hash
+  std::unordered_map<uint64_t, long> keys;   ///< (section, key) hash -> key line offset
+  std::unordered_map<uint32_t, span> spans;  ///< section hash -> location of first section
+  std::unique_ptr<ini_image> image;          ///< compiled image used instead of the file
+  std::unique_ptr<shared_snapshot> shared;   ///< publisher of images in shared memory
+  journal_state journal;                     ///< changes found in journal file
+  std::unique_ptr<journal_writer> writer;    ///< journal writer if journal mode is enabled
+  std::unique_ptr<async_writer> async;       ///< background writer if asynchronous mode is enabled
+};
+
+} //namespace utf8
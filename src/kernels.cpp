@@ -0,0 +1,321 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file kernels.cpp Run-time selection of vectorized kernels.
+
+//Stop Visual Studio from nagging
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <utf8/utf8.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernels.h"
+
+#if UTF8_X86 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define UTF8_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if UTF8_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if UTF8_ARM64
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+/*
+  Kernels are small functions that process blocks of bytes. Each instruction set
+  has a table with its versions of the kernels. The first time a kernel is
+  needed, the processor is probed and the table of the best instruction set
+  it supports is selected. Kernels that use instructions that are not part of
+  the baseline of the target architecture are in separate files compiled with
+  the corresponding compiler options.
+
+  The environment variable UTF8_KERNELS can select a different instruction set
+  ("scalar", "sse2", "avx2" or "neon"). It is ignored if the processor
+  doesn't support the requested instruction set.
+*/
+
+namespace utf8 {
+namespace detail {
+
+// Scalar kernels ------------------------------------------------------------
+
+static size_t scalar_ascii_prefix (const char* s, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    uint64_t w;
+    memcpy (&w, s + i, 8);
+    if (w & 0x8080808080808080ULL)
+      break;
+  }
+  while (i < n && (unsigned char)s[i] < 0x80)
+    i++;
+  return i;
+}
+
+static size_t scalar_count_chars (const char* s, size_t n)
+{
+  size_t cont = 0;
+  for (size_t i = 0; i < n; i++)
+    cont += ((s[i] & 0xC0) == 0x80);
+  return n - cont;
+}
+
+static size_t scalar_narrow_ascii16 (const char* s, size_t n, bool big_endian, char* out)
+{
+  auto p = (const unsigned char*)s;
+  const int lo = big_endian ? 1 : 0;   //index of low byte of a code unit
+
+  //bits that must be 0 in four ASCII code units, in memory order
+  unsigned char bits[8];
+  for (int k = 0; k < 4; k++)
+  {
+    bits[2 * k + lo] = 0x80;
+    bits[2 * k + 1 - lo] = 0xFF;
+  }
+  uint64_t mask;
+  memcpy (&mask, bits, sizeof (mask));
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    uint64_t w;
+    memcpy (&w, p + 2 * i, 8);
+    if (w & mask)
+      break;
+    for (int k = 0; k < 4; k++)
+      out[i + k] = (char)p[2 * (i + k) + lo];
+  }
+  for (; i < n && p[2 * i + 1 - lo] == 0 && p[2 * i + lo] < 0x80; i++)
+    out[i] = (char)p[2 * i + lo];
+  return i;
+}
+
+static const kernels scalar { "scalar", scalar_ascii_prefix, scalar_count_chars, scalar_narrow_ascii16 };
+
+// SSE2 kernels --------------------------------------------------------------
+
+#if UTF8_SSE2
+static size_t sse2_ascii_prefix (const char* s, size_t n)
+{
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    int mask = _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i*)(s + i)));
+    if (mask)
+    {
+      while (!(mask & 1))
+      {
+        mask >>= 1;
+        i++;
+      }
+      return i;
+    }
+  }
+  while (i < n && (unsigned char)s[i] < 0x80)
+    i++;
+  return i;
+}
+
+static size_t sse2_count_chars (const char* s, size_t n)
+{
+  //continuation bytes (0x80 to 0xBF) are less than -64 as signed bytes
+  const __m128i limit = _mm_set1_epi8 (-64);
+  const __m128i zero = _mm_setzero_si128 ();
+  size_t cont = 0;
+  size_t i = 0;
+  while (i + 16 <= n)
+  {
+    //count in 8-bit lanes for at most 255 blocks
+    __m128i acc = zero;
+    for (int k = 0; k < 255 && i + 16 <= n; k++, i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)(s + i));
+      acc = _mm_sub_epi8 (acc, _mm_cmplt_epi8 (v, limit));
+    }
+    __m128i sums = _mm_sad_epu8 (acc, zero);
+    cont += (size_t)_mm_cvtsi128_si32 (sums) + (size_t)_mm_extract_epi16 (sums, 4);
+  }
+  for (; i < n; i++)
+    cont += ((s[i] & 0xC0) == 0x80);
+  return n - cont;
+}
+
+static size_t sse2_narrow_ascii16 (const char* s, size_t n, bool big_endian, char* out)
+{
+  const __m128i mask = _mm_set1_epi16 ((short)0xFF80);
+  const __m128i zero = _mm_setzero_si128 ();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128i v = _mm_loadu_si128 ((const __m128i*)(s + 2 * i));
+    if (big_endian)
+      v = _mm_or_si128 (_mm_srli_epi16 (v, 8), _mm_slli_epi16 (v, 8));
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (_mm_and_si128 (v, mask), zero)) != 0xFFFF)
+      break;
+    _mm_storel_epi64 ((__m128i*)(out + i), _mm_packus_epi16 (v, v));
+  }
+  return i + scalar_narrow_ascii16 (s + 2 * i, n - i, big_endian, out + i);
+}
+
+static const kernels sse2 { "sse2", sse2_ascii_prefix, sse2_count_chars, sse2_narrow_ascii16 };
+#endif
+
+// NEON kernels --------------------------------------------------------------
+
+#if UTF8_ARM64
+static size_t neon_ascii_prefix (const char* s, size_t n)
+{
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    if (vmaxvq_u8 (vld1q_u8 ((const uint8_t*)(s + i))) >= 0x80)
+      break;
+  }
+  while (i < n && (unsigned char)s[i] < 0x80)
+    i++;
+  return i;
+}
+
+static size_t neon_count_chars (const char* s, size_t n)
+{
+  const int8x16_t limit = vdupq_n_s8 (-64);
+  size_t cont = 0;
+  size_t i = 0;
+  while (i + 16 <= n)
+  {
+    //count in 8-bit lanes for at most 255 blocks
+    uint8x16_t acc = vdupq_n_u8 (0);
+    for (int k = 0; k < 255 && i + 16 <= n; k++, i += 16)
+    {
+      int8x16_t v = vld1q_s8 ((const int8_t*)(s + i));
+      acc = vsubq_u8 (acc, vcltq_s8 (v, limit));
+    }
+    cont += vaddlvq_u8 (acc);
+  }
+  for (; i < n; i++)
+    cont += ((s[i] & 0xC0) == 0x80);
+  return n - cont;
+}
+
+static size_t neon_narrow_ascii16 (const char* s, size_t n, bool big_endian, char* out)
+{
+  const uint16x8_t mask = vdupq_n_u16 (0xFF80);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    uint8x16_t b = vld1q_u8 ((const uint8_t*)(s + 2 * i));
+    if (big_endian)
+      b = vrev16q_u8 (b);
+    uint16x8_t v = vreinterpretq_u16_u8 (b);
+    if (vmaxvq_u16 (vandq_u16 (v, mask)))
+      break;
+    vst1_u8 ((uint8_t*)(out + i), vmovn_u16 (v));
+  }
+  return i + scalar_narrow_ascii16 (s + 2 * i, n - i, big_endian, out + i);
+}
+
+static const kernels neon { "neon", neon_ascii_prefix, neon_count_chars, neon_narrow_ascii16 };
+#endif
+
+// Selection -----------------------------------------------------------------
+
+#if UTF8_X86 && defined(UTF8_HAVE_AVX2)
+// Check if processor and operating system support AVX2
+static bool has_avx2 ()
+{
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid (regs, 0);
+  if (regs[0] < 7)
+    return false;
+  __cpuid (regs, 1);
+  bool osxsave = (regs[2] & (1 << 27)) != 0;
+  bool avx = (regs[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv (0) & 6) != 6) //XMM and YMM state enabled
+    return false;
+  __cpuidex (regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__)
+  return __builtin_cpu_supports ("avx2");
+#else
+  return false;
+#endif
+}
+#endif
+
+#if UTF8_ARM64
+// Check if processor supports Advanced SIMD (NEON)
+static bool has_neon ()
+{
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+  return (getauxval (AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+  return true;  //part of ARMv8-A baseline
+#endif
+}
+#endif
+
+// Return the best kernels supported by the processor
+static const kernels* probe ()
+{
+  const kernels* supported[4];
+  int n = 0;
+#if UTF8_X86 && defined(UTF8_HAVE_AVX2)
+  const kernels* avx2 = avx2_kernels ();
+  if (avx2 && has_avx2 ())
+    supported[n++] = avx2;
+#endif
+#if UTF8_SSE2
+  supported[n++] = &sse2;
+#endif
+#if UTF8_ARM64
+  if (has_neon ())
+    supported[n++] = &neon;
+#endif
+  supported[n++] = &scalar;
+
+  const char* request = getenv ("UTF8_KERNELS");
+  for (int i = 0; request && i < n; i++)
+  {
+    if (!strcmp (request, supported[i]->name))
+      return supported[i];
+  }
+  return supported[0];
+}
+
+/*!
+  The selection is done only once, the first time the function is called.
+*/
+const kernels& cpu_kernels ()
+{
+  static const kernels* selected = probe ();
+  return *selected;
+}
+
+} //namespace detail
+
+/*!
+  \return name of instruction set: "avx2", "sse2", "neon" or "scalar"
+
+  The instruction set is the best one supported by the processor, unless
+  a different one is selected with the `UTF8_KERNELS` environment variable.
+*/
+const char* cpu_target ()
+{
+  return detail::cpu_kernels ().name;
+}
+
+} //namespace utf8
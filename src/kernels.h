@@ -0,0 +1,51 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file kernels.h Vectorized kernels and their run-time selection.
+/// This file is not part of the public interface of the library.
+#pragma once
+
+/*
+  This file is also included by translation units compiled with special
+  instruction set options (kernels_avx2.cpp). It must not include standard
+  library headers with inline functions that could be compiled there using
+  instructions not available on all processors.
+*/
+#include <cstddef>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define UTF8_X86 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define UTF8_ARM64 1
+#endif
+
+namespace utf8 {
+namespace detail {
+
+/// Set of kernels for one instruction set
+struct kernels {
+  const char* name;     ///< name of instruction set
+
+  /// Return number of leading ASCII bytes in a buffer
+  size_t (*ascii_prefix) (const char* s, size_t n);
+
+  /// Return number of characters (bytes that are not continuation bytes) in a buffer
+  size_t (*count_chars) (const char* s, size_t n);
+
+  /// Copy leading ASCII characters of `n` UTF-16 code units (big or little
+  /// endian) to `out`. Return number of code units copied.
+  size_t (*narrow_ascii16) (const char* s, size_t n, bool big_endian, char* out);
+};
+
+/// Kernels selected for this processor
+const kernels& cpu_kernels ();
+
+#if UTF8_X86 && defined(UTF8_HAVE_AVX2)
+/// AVX2 kernels or NULL if the compiler could not generate them
+const kernels* avx2_kernels ();
+#endif
+
+} //namespace detail
+} //namespace utf8
@@ -0,0 +1,108 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*!
+  \file kernels_avx2.cpp AVX2 versions of vectorized kernels.
+
+  This file is compiled with AVX2 instructions enabled and UTF8_HAVE_AVX2
+  defined (see CMakeLists.txt).
+  The functions are called only if the processor supports AVX2.
+*/
+
+#include "kernels.h"
+
+#if UTF8_X86 && defined(UTF8_HAVE_AVX2) && (defined(__AVX2__) || defined(_MSC_VER))
+#include <immintrin.h>
+
+namespace utf8 {
+namespace detail {
+
+static size_t ascii_prefix (const char* s, size_t n)
+{
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+  {
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8 (_mm256_loadu_si256 ((const __m256i*)(s + i)));
+    if (mask)
+    {
+      while (!(mask & 1))
+      {
+        mask >>= 1;
+        i++;
+      }
+      return i;
+    }
+  }
+  while (i < n && (unsigned char)s[i] < 0x80)
+    i++;
+  return i;
+}
+
+static size_t count_chars (const char* s, size_t n)
+{
+  //continuation bytes (0x80 to 0xBF) are less than -64 as signed bytes
+  const __m256i limit = _mm256_set1_epi8 (-64);
+  const __m256i zero = _mm256_setzero_si256 ();
+  size_t cont = 0;
+  size_t i = 0;
+  while (i + 32 <= n)
+  {
+    //count in 8-bit lanes for at most 255 blocks
+    __m256i acc = zero;
+    for (int k = 0; k < 255 && i + 32 <= n; k++, i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i*)(s + i));
+      acc = _mm256_sub_epi8 (acc, _mm256_cmpgt_epi8 (limit, v));
+    }
+    unsigned long long sums[4];
+    _mm256_storeu_si256 ((__m256i*)sums, _mm256_sad_epu8 (acc, zero));
+    cont += (size_t)(sums[0] + sums[1] + sums[2] + sums[3]);
+  }
+  for (; i < n; i++)
+    cont += ((s[i] & 0xC0) == 0x80);
+  return n - cont;
+}
+
+static size_t narrow_ascii16 (const char* s, size_t n, bool big_endian, char* out)
+{
+  const __m256i mask = _mm256_set1_epi16 ((short)0xFF80);
+  const __m256i zero = _mm256_setzero_si256 ();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m256i v = _mm256_loadu_si256 ((const __m256i*)(s + 2 * i));
+    if (big_endian)
+      v = _mm256_or_si256 (_mm256_srli_epi16 (v, 8), _mm256_slli_epi16 (v, 8));
+    if ((unsigned int)_mm256_movemask_epi8 (_mm256_cmpeq_epi16 (_mm256_and_si256 (v, mask), zero)) != 0xFFFFFFFF)
+      break;
+    //pack works within 128-bit lanes; bring the two halves together
+    __m256i packed = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (v, v), 0xD8);
+    _mm_storeu_si128 ((__m128i*)(out + i), _mm256_castsi256_si128 (packed));
+  }
+  auto p = (const unsigned char*)s;
+  const int lo = big_endian ? 1 : 0;
+  for (; i < n && p[2 * i + 1 - lo] == 0 && p[2 * i + lo] < 0x80; i++)
+    out[i] = (char)p[2 * i + lo];
+  return i;
+}
+
+static const kernels avx2 { "avx2", ascii_prefix, count_chars, narrow_ascii16 };
+
+const kernels* avx2_kernels ()
+{
+  return &avx2;
+}
+
+} //namespace detail
+} //namespace utf8
+
+#elif UTF8_X86 && defined(UTF8_HAVE_AVX2)
+
+const utf8::detail::kernels* utf8::detail::avx2_kernels ()
+{
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file mapped.cpp Implementation of mapped_text class
+
+#include <utf8/utf8.h>
+#include <algorithm>
+
+#include "internal.h"
+#include "kernels.h"
+
+namespace utf8 {
+
+// Size of chunks validated by one thread
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+/*
+  Validation state of a chunk. A chunk contains the characters that start
+  between `i * CHUNK_SIZE` and `(i + 1) * CHUNK_SIZE`. Continuation bytes at the
+  beginning of a chunk are skipped; they belong to a character in the previous
+  chunk. The text is valid if all chunks are valid and each chunk begins
+  where the previous one ended.
+*/
+struct text_chunk {
+  enum { unknown, valid, invalid } state = unknown;
+  size_t begin = 0;   ///< offset of first character
+  size_t end = 0;     ///< offset after last character
+};
+
+struct mapped_text::impl {
+  mapped_file file;
+  std::string_view text;
+  bom_type bom = bom_type::none;
+  std::mutex lock;
+  std::vector<text_chunk> chunks;
+
+  void check (size_t i);
+  bool validate (size_t first, size_t last);
+};
+
+// Validate one chunk
+void mapped_text::impl::check (size_t i)
+{
+  auto& k = detail::cpu_kernels ();
+  const char* base = text.data ();
+  const char* last = base + text.size ();
+  const char* s = base + i * CHUNK_SIZE;
+  const char* lim = base + std::min ((i + 1) * CHUNK_SIZE, text.size ());
+
+  //skip continuation bytes of the last character in previous chunk
+  for (int n = 0; i && n < 3 && s < last && (*s & 0xC0) == 0x80; n++)
+    s++;
+
+  text_chunk& c = chunks[i];
+  c.begin = s - base;
+  c.state = text_chunk::valid;
+  while (s < lim)
+  {
+    s += k.ascii_prefix (s, lim - s);
+    if (s == lim)
+      break;
+    bool ok;
+    detail::decode (s, last, ok);
+    if (!ok)
+    {
+      c.state = text_chunk::invalid;
+      break;
+    }
+  }
+  c.end = s - base;
+}
+
+/*
+  Validate chunks from `first` to `last` (inclusive) that were not validated
+  before. Work is divided between multiple threads.
+*/
+bool mapped_text::impl::validate (size_t first, size_t last)
+{
+  std::lock_guard<std::mutex> guard (lock);
+  std::vector<size_t> pending;
+  for (size_t i = first; i <= last; i++)
+  {
+    if (chunks[i].state == text_chunk::unknown)
+      pending.push_back (i);
+  }
+
+  size_t nthreads = std::min ((size_t)std::thread::hardware_concurrency (), pending.size ());
+  auto work = [&] (size_t t) {
+    for (size_t j = t; j < pending.size (); j += nthreads)
+      check (pending[j]);
+  };
+  if (nthreads > 1)
+  {
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nthreads; t++)
+      workers.emplace_back (work, t);
+    work (0);
+    for (auto& w : workers)
+      w.join ();
+  }
+  else
+  {
+    for (auto i : pending)
+      check (i);
+  }
+
+  for (size_t i = first; i <= last; i++)
+  {
+    if (chunks[i].state != text_chunk::valid
+     || (i > first && chunks[i - 1].end != chunks[i].begin))
+      return false;
+  }
+  return true;
+}
+
+/// Create an object without a mapped file
+mapped_text::mapped_text () = default;
+
+/// Create an object and map a file
+/// \param filename UTF-8 encoded file name
+mapped_text::mapped_text (const std::string& filename)
+{
+  open (filename);
+}
+
+mapped_text::mapped_text (mapped_text&& other) noexcept = default;
+mapped_text& mapped_text::operator= (mapped_text&& other) noexcept = default;
+mapped_text::~mapped_text () = default;
+
+/*!
+  Map a file in memory
+  \param filename UTF-8 encoded file name
+  \return `true` if successful, `false` otherwise
+
+  If the file starts with a byte order mark, it is detected and excluded from
+  text view.
+*/
+bool mapped_text::open (const std::string& filename)
+{
+  close ();
+  auto m = std::make_unique<impl> ();
+  if (!m->file.open (filename))
+    return false;
+
+  std::string_view t (m->file.data (), m->file.size ());
+  static const struct {
+    std::string_view mark;
+    bom_type type;
+  } marks[] = {
+    { std::string_view ("\xEF\xBB\xBF", 3), bom_type::utf8 },
+    { std::string_view ("\xFF\xFE\x00\x00", 4), bom_type::utf32le },
+    { std::string_view ("\x00\x00\xFE\xFF", 4), bom_type::utf32be },
+    { std::string_view ("\xFF\xFE", 2), bom_type::utf16le },
+    { std::string_view ("\xFE\xFF", 2), bom_type::utf16be }
+  };
+  for (auto& b : marks)
+  {
+    if (t.substr (0, b.mark.size ()) == b.mark)
+    {
+      m->bom = b.type;
+      t.remove_prefix (b.mark.size ());
+      break;
+    }
+  }
+  m->text = t;
+  m->chunks.resize ((t.size () + CHUNK_SIZE - 1) / CHUNK_SIZE);
+  p = std::move (m);
+  return true;
+}
+
+/// Unmap file
+void mapped_text::close ()
+{
+  p.reset ();
+}
+
+/// Return text of file, without the BOM
+std::string_view mapped_text::view () const
+{
+  return p ? p->text : std::string_view ();
+}
+
+/// Return the byte order mark found at beginning of file
+mapped_text::bom_type mapped_text::bom () const
+{
+  return p ? p->bom : bom_type::none;
+}
+
+/*!
+  Check if the text is valid UTF-8
+  \return `true` if text is valid, `false` otherwise or if no file is mapped
+
+  The result is kept; subsequent calls don't validate the text again.
+  Text of a file with a UTF-16 or UTF-32 BOM is also validated as UTF-8.
+*/
+bool mapped_text::valid () const
+{
+  if (!p)
+    return false;
+  if (p->chunks.empty ())
+    return true;
+  return p->validate (0, p->chunks.size () - 1);
+}
+
+/*!
+  Check if a part of the text is valid UTF-8
+  \param pos  starting position
+  \param len  length of checked part
+  \return `true` if the characters that start in the given part are valid
+
+  Only the chunks containing the given part are validated.
+*/
+bool mapped_text::valid (size_t pos, size_t len) const
+{
+  if (!p)
+    return false;
+  if (pos >= p->text.size () || !len)
+    return true;
+  len = std::min (len, p->text.size () - pos);
+  return p->validate (pos / CHUNK_SIZE, (pos + len - 1) / CHUNK_SIZE);
+}
+
+} //namespace utf8
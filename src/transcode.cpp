@@ -0,0 +1,340 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/// \file transcode.cpp Implementation of transcoding_buf class
+
+#include <utf8/utf8.h>
+#include <algorithm>
+#include <cstring>
+
+#include "internal.h"
+#include "kernels.h"
+
+namespace utf8 {
+
+// Size of blocks exchanged with target stream buffer
+static const size_t BLOCK_SIZE = 64 * 1024;
+
+// Size of code unit in bytes
+static size_t unit_size (file_encoding enc)
+{
+  switch (enc)
+  {
+  case file_encoding::utf16le:
+  case file_encoding::utf16be:
+    return 2;
+  case file_encoding::utf32le:
+  case file_encoding::utf32be:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// Read a code unit
+static char32_t get_unit (const char* p, file_encoding enc)
+{
+  auto b = (const unsigned char*)p;
+  switch (enc)
+  {
+  case file_encoding::utf16le:
+    return b[0] | b[1] << 8;
+  case file_encoding::utf16be:
+    return b[0] << 8 | b[1];
+  case file_encoding::utf32le:
+    return b[0] | b[1] << 8 | b[2] << 16 | (char32_t)b[3] << 24;
+  case file_encoding::utf32be:
+    return (char32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+  default:
+    return b[0];
+  }
+}
+
+// Append a code unit
+static void put_unit (std::string& s, char32_t u, file_encoding enc)
+{
+  switch (enc)
+  {
+  case file_encoding::utf16le:
+    s.push_back ((char)u);
+    s.push_back ((char)(u >> 8));
+    break;
+  case file_encoding::utf16be:
+    s.push_back ((char)(u >> 8));
+    s.push_back ((char)u);
+    break;
+  case file_encoding::utf32le:
+    s.push_back ((char)u);
+    s.push_back ((char)(u >> 8));
+    s.push_back ((char)(u >> 16));
+    s.push_back ((char)(u >> 24));
+    break;
+  case file_encoding::utf32be:
+    s.push_back ((char)(u >> 24));
+    s.push_back ((char)(u >> 16));
+    s.push_back ((char)(u >> 8));
+    s.push_back ((char)u);
+    break;
+  default:
+    s.push_back ((char)u);
+  }
+}
+
+// Append UTF-8 encoding of a character
+static void put_utf8 (std::string& s, char32_t c, exception::cause err)
+{
+  if (c < 0x80)
+  {
+    s.push_back ((char)c);
+    return;
+  }
+  char buf[4];
+  int n = detail::encode (c, buf);
+  if (!n)
+    n = detail::encode (detail::throw_or_replace (err), buf);
+  s.append (buf, n);
+}
+
+/*!
+  Convert UTF-16 text to UTF-8
+  \param data        UTF-16 text
+  \param size        size of text in bytes
+  \param big_endian  `true` if text is UTF-16BE, `false` if it is UTF-16LE
+  \param out         string where UTF-8 text is appended
+  \param final       `true` if this is the end of text
+  \param strict      `true` to handle invalid code units according to error
+                     handling mode, `false` to replace them
+  \return            number of bytes converted
+
+  If text is not `final`, an incomplete code unit or surrogate pair at the end
+  is not converted; otherwise it is replaced.
+*/
+size_t utf16_to_utf8 (const char* data, size_t size, bool big_endian, std::string& out,
+                      bool final, bool strict)
+{
+  auto& k = detail::cpu_kernels ();
+  auto p = (const unsigned char*)data;
+  auto unit = [p, big_endian] (size_t i) -> char32_t {
+    return big_endian ? (p[2 * i] << 8 | p[2 * i + 1]) : (p[2 * i] | p[2 * i + 1] << 8);
+  };
+  auto invalid = [strict] () {
+    return strict ? detail::throw_or_replace (exception::invalid_wchar) : REPLACEMENT_CHARACTER;
+  };
+
+  size_t n = size / 2;
+  size_t i = 0;
+  out.reserve (out.size () + n);
+  while (i < n)
+  {
+    char32_t c = unit (i);
+    if (c < 0x80)
+    {
+      char buf[256];
+      size_t m = k.narrow_ascii16 (data + 2 * i, std::min (n - i, sizeof (buf)), big_endian, buf);
+      out.append (buf, m);
+      i += m;
+      continue;
+    }
+    if (0xD800 <= c && c < 0xDC00)
+    {
+      if (i + 1 == n && !final)
+        break;  //wait for the low surrogate
+      if (i + 1 < n && 0xDC00 <= unit (i + 1) && unit (i + 1) < 0xE000)
+      {
+        c = ((c - 0xD800) << 10 | (unit (i + 1) - 0xDC00)) + 0x10000;
+        i++;
+      }
+      else
+        c = invalid ();
+    }
+    else if (0xDC00 <= c && c < 0xE000)
+      c = invalid ();
+    i++;
+
+    char buf[4];
+    out.append (buf, detail::encode (c, buf));
+  }
+  if (i == n && final && (size & 1))
+  {
+    //incomplete code unit at end
+    char buf[4];
+    out.append (buf, detail::encode (invalid (), buf));
+    return size;
+  }
+  return 2 * i;
+}
+
+/*
+  Return end of complete UTF-8 sequences in a buffer. An incomplete sequence at
+  the end of buffer remains for the next flush.
+*/
+static const char* complete_end (const char* s, const char* end)
+{
+  const char* p = end;
+  int cont = 0;
+  while (p > s && cont < 3 && (p[-1] & 0xC0) == 0x80)
+  {
+    p--;
+    cont++;
+  }
+  if (p == s)
+    return end;
+
+  unsigned char lead = (unsigned char)p[-1];
+  int len = (lead & 0xE0) == 0xC0 ? 2
+          : (lead & 0xF0) == 0xE0 ? 3
+          : (lead & 0xF8) == 0xF0 ? 4 : 1;
+  return (len > cont + 1) ? p - 1 : end;
+}
+
+/*!
+  Create a transcoding buffer
+  \param target stream buffer with text in `enc` encoding
+  \param enc    encoding of target stream buffer
+*/
+transcoding_buf::transcoding_buf (std::streambuf* target, file_encoding enc)
+  : tgt (target)
+  , enc (enc)
+  , out (BLOCK_SIZE, 0)
+{
+  setp (&out[0], &out[0] + out.size ());
+}
+
+/// Write remaining characters to target stream buffer
+transcoding_buf::~transcoding_buf ()
+{
+  try {
+    if (flush (true))
+      tgt->pubsync ();
+  }
+  catch (...) {
+  }
+}
+
+/*
+  Convert complete code units from target to UTF-8 and append them to get area.
+  Return number of bytes used.
+*/
+size_t transcoding_buf::decode (const char* s, size_t n)
+{
+  size_t usz = unit_size (enc);
+  if (usz == 1)
+  {
+    in.append (s, n);
+    return n;
+  }
+  if (usz == 2)
+    return utf16_to_utf8 (s, n, enc == file_encoding::utf16be, in, false, true);
+
+  size_t i = 0;
+  for (; i + usz <= n; i += usz)
+    put_utf8 (in, get_unit (s + i, enc), exception::invalid_char32);
+  return i;
+}
+
+/// Fill get area with text converted from target stream buffer
+transcoding_buf::int_type transcoding_buf::underflow ()
+{
+  if (gptr () < egptr ())
+    return traits_type::to_int_type (*gptr ());
+
+  in.clear ();
+  while (in.empty ())
+  {
+    size_t have = raw.size ();
+    raw.resize (have + BLOCK_SIZE);
+    size_t n = (size_t)tgt->sgetn (&raw[have], BLOCK_SIZE);
+    raw.resize (have + n);
+    if (!n)
+    {
+      if (raw.empty ())
+      {
+        setg (nullptr, nullptr, nullptr);
+        return traits_type::eof ();
+      }
+      //incomplete code unit or surrogate pair at end of file
+      raw.clear ();
+      char32_t c = detail::throw_or_replace (unit_size (enc) == 2 ?
+        exception::invalid_wchar : exception::invalid_char32);
+      put_utf8 (in, c, exception::invalid_char32);
+      break;
+    }
+    raw.erase (0, decode (raw.data (), raw.size ()));
+  }
+  setg (&in[0], &in[0], &in[0] + in.size ());
+  return traits_type::to_int_type (*gptr ());
+}
+
+/*
+  Convert put area and send it to target stream buffer. If not `final`, an
+  incomplete UTF-8 sequence at the end remains in put area.
+*/
+bool transcoding_buf::flush (bool final)
+{
+  const char* s = pbase ();
+  const char* end = pptr ();
+  const char* stop = final ? end : complete_end (s, end);
+
+  std::string bytes;
+  if (unit_size (enc) == 1)
+    bytes.assign (s, stop);
+  else
+  {
+    auto& k = detail::cpu_kernels ();
+    bytes.reserve ((stop - s) * unit_size (enc));
+    while (s < stop)
+    {
+      size_t n = k.ascii_prefix (s, stop - s);
+      for (size_t i = 0; i < n; i++)
+        put_unit (bytes, (unsigned char)s[i], enc);
+      s += n;
+      if (s == stop)
+        break;
+
+      bool valid;
+      char32_t c = detail::decode (s, stop, valid);
+      if (!valid)
+        c = detail::throw_or_replace (exception::invalid_utf8);
+      if (unit_size (enc) == 2 && c >= 0x10000)
+      {
+        c -= 0x10000;
+        put_unit (bytes, (c >> 10) + 0xD800, enc);
+        put_unit (bytes, (c & 0x3FF) + 0xDC00, enc);
+      }
+      else
+        put_unit (bytes, c, enc);
+    }
+  }
+
+  //keep incomplete sequence for next time
+  size_t tail = end - stop;
+  memmove (&out[0], stop, tail);
+  setp (&out[0], &out[0] + out.size ());
+  pbump ((int)tail);
+
+  return bytes.empty ()
+      || tgt->sputn (bytes.data (), bytes.size ()) == (std::streamsize)bytes.size ();
+}
+
+/// Convert put area and send it to target stream buffer
+transcoding_buf::int_type transcoding_buf::overflow (int_type c)
+{
+  if (!flush (false))
+    return traits_type::eof ();
+  if (!traits_type::eq_int_type (c, traits_type::eof ()))
+  {
+    *pptr () = traits_type::to_char_type (c);
+    pbump (1);
+  }
+  return traits_type::not_eof (c);
+}
+
+/// Send converted text to target stream buffer
+int transcoding_buf::sync ()
+{
+  return (flush (false) && tgt->pubsync () == 0) ? 0 : -1;
+}
+
+} //namespace utf8
@@ -5,11 +5,23 @@
 
 /// \file utf8.cpp Basic UTF-8 Conversion functions
 
+//the library always has out-of-line versions of basic functions
+#undef UTF8_HEADER_ONLY
+#define UTF8_INLINE
+
 #include <utf8/utf8.h>
+#include <utf8/inlines.h>
+#include <memory>
 #include <vector>
 #include <cassert>
 #include <cstring>
 
+#include "kernels.h"
+
+#ifdef UTF8_STATS
+#include <atomic>
+#endif
+
 using namespace std;
 namespace utf8 {
 
@@ -27,10 +39,178 @@ action error_mode (action mode)
 }
 
 
-static void encode (char32_t c, std::string& s);
+/*
+  Conversion statistics.
+
+  Each thread updates its own block of counters; only the owner thread writes
+  to a block so updates don't need atomic read-modify-write operations.
+  Blocks are kept in a list that is never shrunk. When a thread ends, its block
+  is released with the counters intact and it can be reused by a new thread.
+  stats() function adds up the counters of all blocks without any lock.
+*/
+#ifdef UTF8_STATS
+namespace {
+
+struct counter_block {
+  std::atomic<uint64_t> bytes_in[conversion_stats::kind_count] = {};
+  std::atomic<uint64_t> bytes_out[conversion_stats::kind_count] = {};
+  std::atomic<uint64_t> replacements[4] = {};
+  std::atomic<uint64_t> exceptions[4] = {};
+  std::atomic<uint64_t> ascii_chars{ 0 };
+  std::atomic<uint64_t> multibyte_chars{ 0 };
+  std::atomic<bool> in_use{ true };
+  counter_block* next = nullptr;
+};
+
+std::atomic<counter_block*> blocks{ nullptr };
+std::atomic<bool> collecting{ false };
+thread_local bool paused = false;
+
+// Take a free block or add a new one to the list
+counter_block* acquire_block ()
+{
+  for (auto b = blocks.load (); b; b = b->next)
+  {
+    bool free = false;
+    if (!b->in_use.load (std::memory_order_relaxed) && b->in_use.compare_exchange_strong (free, true))
+      return b;
+  }
+  auto b = new counter_block;
+  b->next = blocks.load ();
+  while (!blocks.compare_exchange_weak (b->next, b))
+    ;
+  return b;
+}
+
+// Owner of the block of a thread
+struct block_owner {
+  block_owner () : block (acquire_block ()) {}
+  ~block_owner () { block->in_use.store (false); }
+  counter_block* block;
+};
+
+counter_block& my_block ()
+{
+  static thread_local block_owner owner;
+  return *owner.block;
+}
+
+// Add to a counter owned by this thread
+inline void add (std::atomic<uint64_t>& counter, uint64_t n)
+{
+  counter.store (counter.load (std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} //namespace
+#endif
+
+/*!
+  \param on   `true` to collect statistics, `false` to stop collecting them
+  \return     previous state
+
+  If the library was built without `UTF8_STATS` defined, the function has no
+  effect and it always returns `false`.
+*/
+bool collect_stats ([[maybe_unused]] bool on)
+{
+#ifdef UTF8_STATS
+  return collecting.exchange (on);
+#else
+  return false;
+#endif
+}
 
-inline char32_t throw_or_replace (exception::cause err)
+/*!
+  The counters are the sum of counters of all threads, including the ones
+  that have ended. They are accumulated since the beginning of the program,
+  while collection was turned on.
+*/
+conversion_stats stats ()
 {
+  conversion_stats st;
+#ifdef UTF8_STATS
+  for (auto b = blocks.load (); b; b = b->next)
+  {
+    for (int i = 0; i < conversion_stats::kind_count; i++)
+    {
+      st.bytes_in[i] += b->bytes_in[i].load (std::memory_order_relaxed);
+      st.bytes_out[i] += b->bytes_out[i].load (std::memory_order_relaxed);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+      st.replacements[i] += b->replacements[i].load (std::memory_order_relaxed);
+      st.exceptions[i] += b->exceptions[i].load (std::memory_order_relaxed);
+    }
+    st.ascii_chars += b->ascii_chars.load (std::memory_order_relaxed);
+    st.multibyte_chars += b->multibyte_chars.load (std::memory_order_relaxed);
+  }
+#endif
+  return st;
+}
+
+// Return `true` if statistics are collected. Always `false` if not compiled in.
+inline bool stats_on ()
+{
+#ifdef UTF8_STATS
+  return collecting.load (std::memory_order_relaxed) && !paused;
+#else
+  return false;
+#endif
+}
+
+/*
+  Count a conversion.
+  `text` and `len` are the UTF-8 side of the conversion and `other` is the size
+  in bytes of the UTF-16 or UTF-32 side.
+*/
+static void count_conversion ([[maybe_unused]] conversion_stats::kind k, [[maybe_unused]] const char* text,
+                              [[maybe_unused]] size_t len, [[maybe_unused]] size_t other)
+{
+#ifdef UTF8_STATS
+  size_t ascii = 0, chars = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    ascii += ((unsigned char)text[i] < 0x80);
+    chars += ((text[i] & 0xC0) != 0x80);
+  }
+  bool to_utf8 = (k == conversion_stats::wide_to_utf8 || k == conversion_stats::utf32_to_utf8);
+  auto& b = my_block ();
+  add (b.bytes_in[k], to_utf8 ? other : len);
+  add (b.bytes_out[k], to_utf8 ? len : other);
+  add (b.ascii_chars, ascii);
+  add (b.multibyte_chars, chars - ascii);
+#endif
+}
+
+// Count an invalid encoding
+static void count_error ([[maybe_unused]] exception::cause err, [[maybe_unused]] bool thrown)
+{
+#ifdef UTF8_STATS
+  auto& b = my_block ();
+  add (thrown ? b.exceptions[err] : b.replacements[err], 1);
+#endif
+}
+
+/// Stop counting statistics in this thread while the object exists
+struct stats_pause {
+#ifdef UTF8_STATS
+  stats_pause () : prev (paused) { paused = true; }
+  ~stats_pause () { paused = prev; }
+  bool prev;
+#endif
+};
+
+/*!
+  \param err   cause of error
+  \return      utf8::REPLACEMENT_CHARACTER if error handling mode is
+                action::replace
+
+  Called by decoding and encoding functions when they find an invalid encoding.
+*/
+char32_t detail::throw_or_replace (exception::cause err)
+{
+  if (stats_on ())
+    count_error (err, ermode == action::except);
   if (ermode == action::except)
     throw exception (err);
   else
@@ -42,98 +222,181 @@ inline char32_t throw_or_replace (exception::cause err)
   Basic conversion functions between UTF-8, UTF-16 and UTF-32
 */
 
-/*!
-  Conversion from wide character to UTF-8
+/*
+  Append UTF-8 encoding of a character to a string. Invalid characters are
+  handled according to error handling mode.
+*/
+template <class S>
+static void put (char32_t c, S& out)
+{
+  if (c < 0x80)
+  {
+    out.push_back ((char)c);
+    return;
+  }
+  char buf[4];
+  int n = detail::encode (c, buf);
+  if (!n)
+    n = detail::encode (detail::throw_or_replace (exception::cause::invalid_char32), buf);
+  out.append (buf, n);
+}
 
-  \param  s   input string
-  \param  nch number of character to convert or 0 if string is null-terminated
-  \return UTF-8 character string
+/*
+  Convert UTF-16 characters from `s` to `end` to UTF-8 and append them to `out`.
 */
-std::string narrow (const wchar_t* s, size_t nch)
+template <class S>
+static void from_utf16 (const wchar_t* s, const wchar_t* end, S& out)
 {
+  size_t in_size = (end - s) * sizeof (wchar_t);
+  size_t pos = out.size ();
 #if USE_WINDOWS_API
-  int nsz;
-  if (!s || !(nsz = WideCharToMultiByte (CP_UTF8, 0, s, (nch?(int)nch:-1), 0, 0, 0, 0)))
-    return string ();
-
-  string out (nsz, 0);
-  WideCharToMultiByte (CP_UTF8, 0, s, -1, &out[0], nsz, 0, 0);
-  if (!nch)
-    out.resize (nsz - 1); //output is null-terminated
+  int nsz = (s == end) ? 0 : WideCharToMultiByte (CP_UTF8, 0, s, (int)(end - s), 0, 0, 0, 0);
+  if (!nsz)
+    return;
+  out.resize (pos + nsz);
+  WideCharToMultiByte (CP_UTF8, 0, s, (int)(end - s), &out[pos], nsz, 0, 0);
 #else
-  std::string out;
-  if (!nch)
-    nch = wcslen (s);
-
-  while (nch)
+  while (s < end)
   {
     unsigned int c = (unsigned int)*s++;
     if (0xDBFF < c && c < 0xDFFF)
-      c = throw_or_replace (exception::cause::invalid_wchar); //missing hi-surrogate
-    else if (0xD7FF < c && c < 0xDC00)
+      c = detail::throw_or_replace (exception::cause::invalid_wchar); //missing hi-surrogate
+    else if (c > 0xD7FF && c < 0xDC00)
     {
       //got high surrogate, get the low one now
-      if (!nch)
-        c = throw_or_replace (exception::cause::invalid_wchar); //missing lo-surrogate
+      if (s == end)
+        c = detail::throw_or_replace (exception::cause::invalid_wchar); //missing lo-surrogate
       else
       {
         c -= 0xD800;
         unsigned int cl = (unsigned int)*s++;
-        --nch;
         if (cl < 0xDC00 || cl > 0xDFFF)
-          c = throw_or_replace (exception::cause::invalid_wchar); //not a lo-surrogate
+          c = detail::throw_or_replace (exception::cause::invalid_wchar); //not a lo-surrogate
         else
           c = ((c << 10) | (cl - 0xDC00)) + 0x10000;
       }
     }
-    encode (c, out);
-    --nch;
+    put (c, out);
   }
 #endif
-  return out;
+  if (stats_on ())
+    count_conversion (conversion_stats::wide_to_utf8, out.data () + pos, out.size () - pos, in_size);
 }
 
-/*!
-  Conversion from wide character to UTF-8
+/*
+  Convert UTF-32 characters from `s` to `end` to UTF-8 and append them to `out`.
+*/
+template <class S>
+static void from_utf32 (const char32_t* s, const char32_t* end, S& out)
+{
+  size_t in_size = (end - s) * sizeof (char32_t);
+  size_t pos = out.size ();
+  while (s < end)
+    put (*s++, out);
+  if (stats_on ())
+    count_conversion (conversion_stats::utf32_to_utf8, out.data () + pos, out.size () - pos, in_size);
+}
 
-  \param  ws input string
-  \return UTF-8 character string
+// Inputs larger than this are counted before reserving space for decoding
+static const size_t LARGE_INPUT = 64 * 1024;
+
+/*
+  Decode UTF-8 characters from `s` to `end` and append them to a UTF-16 or
+  UTF-32 string. Runs of ASCII characters are found by the vectorized kernel
+  and copied without decoding.
 */
-std::string narrow (const std::wstring& ws)
+template <bool utf16, class S>
+static void decode (const char* s, const char* end, S& out)
 {
-#if USE_WINDOWS_API
-  size_t nsz = WideCharToMultiByte (CP_UTF8, 0, ws.c_str(), (int)ws.size(), 0, 0, 0, 0);
-  if (!nsz)
-    return string ();
+  auto& k = detail::cpu_kernels ();
 
-  string out (nsz, 0);
-  WideCharToMultiByte (CP_UTF8, 0, ws.c_str (), (int)ws.size(), &out[0], (int)nsz, 0, 0);
-#else
-  std::string out;
-  auto in = ws.cbegin ();
-  while (in != ws.end ())
+  //Number of bytes is an upper bound for the number of code units. Only
+  //large inputs pay for an extra pass to avoid reserving too much.
+  size_t len = end - s;
+  out.reserve (out.size () + (len > LARGE_INPUT ? k.count_chars (s, len) : len));
+  while (s < end)
   {
-    unsigned int c = (unsigned int)*in++;
-    if (0xDBFF < c && c < 0xDFFF)
-      c = throw_or_replace(exception::cause::invalid_wchar); //missing hi-surrogate
-    else if (c > 0xD7FF && c < 0xDC00)
+    size_t n = k.ascii_prefix (s, end - s);
+    out.append (s, s + n);
+    s += n;
+    if (s == end)
+      break;
+
+    bool valid;
+    char32_t c = detail::decode (s, end, valid);
+    if (!valid)
+      c = detail::throw_or_replace (exception::cause::invalid_utf8);
+    if (!utf16 || c < 0x10000)
+      out.push_back ((typename S::value_type)c);
+    else
     {
-      //got high surrogate, get the low one now
-      if (in == ws.end ())
-        c = throw_or_replace(exception::cause::invalid_wchar); //missing lo-surrogate
-      else
-      {
-        c -= 0xD800;
-        unsigned int cl = (unsigned int)*in++;
-        if (cl < 0xDC00 || cl > 0xDFFF)
-          c = throw_or_replace(exception::cause::invalid_wchar); //not a lo-surrogate
-        else
-          c = ((c << 10) | (cl - 0xDC00)) + 0x10000;
-      }
+      c -= 0x10000;
+      out.push_back ((typename S::value_type)((c >> 10) + 0xD800));
+      out.push_back ((typename S::value_type)((c & 0x3FF) + 0xDC00));
     }
-    encode (c, out);
   }
+}
+
+/*
+  Convert UTF-8 characters from `s` to `end` to wide characters and append
+  them to `out`.
+*/
+template <class S>
+static void to_utf16 (const char* s, const char* end, S& out)
+{
+  size_t pos = out.size ();
+#if USE_WINDOWS_API
+  int wsz = (s == end) ? 0 : MultiByteToWideChar (CP_UTF8, 0, s, (int)(end - s), 0, 0);
+  if (!wsz)
+    return;
+  out.resize (pos + wsz);
+  MultiByteToWideChar (CP_UTF8, 0, s, (int)(end - s), &out[pos], wsz);
+#else
+  decode<true> (s, end, out);
 #endif
+  if (stats_on ())
+    count_conversion (conversion_stats::utf8_to_wide, s, end - s,
+                      (out.size () - pos) * sizeof (wchar_t));
+}
+
+/*
+  Convert UTF-8 characters from `s` to `end` to UTF-32 and append them to `out`.
+*/
+template <class S>
+static void to_utf32 (const char* s, const char* end, S& out)
+{
+  size_t pos = out.size ();
+  decode<false> (s, end, out);
+  if (stats_on ())
+    count_conversion (conversion_stats::utf8_to_utf32, s, end - s,
+                      (out.size () - pos) * sizeof (char32_t));
+}
+
+/*!
+  Conversion from wide character to UTF-8
+
+  \param  s   input string
+  \param  nch number of character to convert or 0 if string is null-terminated
+  \return UTF-8 character string
+*/
+std::string narrow (const wchar_t* s, size_t nch)
+{
+  string out;
+  if (s)
+    from_utf16 (s, s + (nch ? nch : wcslen (s)), out);
+  return out;
+}
+
+/*!
+  Conversion from wide character to UTF-8
+
+  \param  ws input string
+  \return UTF-8 character string
+*/
+std::string narrow (const std::wstring& ws)
+{
+  string out;
+  from_utf16 (ws.data (), ws.data () + ws.size (), out);
   return out;
 }
 
@@ -150,17 +413,13 @@ std::string narrow (const std::wstring& ws)
 std::string narrow (const char32_t* s, size_t nch)
 {
   string str;
-  const char32_t* p = s;
   if (!nch)
   {
     //null terminated; count characters now
-    while (*p++)
+    for (const char32_t* p = s; *p; p++)
       nch++;
-    p = s;
   }
-
-  for (; nch; nch--, p++)
-    encode (*p, str);
+  from_utf32 (s, s + nch, str);
   return str;
 }
 
@@ -176,8 +435,7 @@ std::string narrow (const char32_t* s, size_t nch)
 std::string narrow (const std::u32string& s)
 {
   string str;
-  for (auto p = s.begin (); p != s.end (); p++)
-    encode (*p, str);
+  from_utf32 (s.data (), s.data () + s.size (), str);
   return str;
 }
 
@@ -193,7 +451,7 @@ std::string narrow (const std::u32string& s)
 std::string narrow (char32_t r)
 {
   string str;
-  encode (r, str);
+  from_utf32 (&r, &r + 1, str);
   return str;
 }
 
@@ -206,34 +464,9 @@ std::string narrow (char32_t r)
 */
 std::wstring widen (const char* s, size_t nch)
 {
-#if USE_WINDOWS_API
-  size_t wsz;
-  if (!s || !(wsz = MultiByteToWideChar (CP_UTF8, 0, s, (nch?(int)nch:-1), 0, 0)))
-    return wstring ();
-
-  wstring out (wsz, 0);
-  MultiByteToWideChar (CP_UTF8, 0, s, -1, &out[0], (int)wsz);
-  if (!nch)
-    out.resize (wsz - 1); //output is null-terminated
-#else
   wstring out;
-
-  auto end = s + (nch ? nch : strlen (s));
-  while (s < end)
-  {
-    auto c = next (s);
-    if (c < 0x10000)
-      out.push_back ((wchar_t)c);
-    else
-    {
-      c -= 0x10000;
-      wchar_t sh = (wchar_t)((c >> 10) + 0xD800);
-      wchar_t sl = (wchar_t)((c & 0x3FF) + 0xDC00);
-      out.push_back (sh);
-      out.push_back (sl);
-    }
-  }
-#endif
+  if (s)
+    to_utf16 (s, s + (nch ? nch : strlen (s)), out);
   return out;
 }
 
@@ -245,31 +478,8 @@ std::wstring widen (const char* s, size_t nch)
 */
 std::wstring widen (const std::string& s)
 {
-#if USE_WINDOWS_API
-  size_t wsz = MultiByteToWideChar (CP_UTF8, 0, s.c_str(), (int)s.size(), 0, 0);
-  if (!wsz)
-    return wstring ();
-
-  wstring out (wsz, 0);
-  MultiByteToWideChar (CP_UTF8, 0, s.c_str (), (int)s.size(), &out[0], (int)wsz);
-#else
   wstring out;
-  auto in = s.cbegin ();
-  while (in != s.end ())
-  {
-    auto c = next (in, s.end());
-    if (c < 0x10000)
-      out.push_back ((wchar_t)c);
-    else
-    {
-      c -= 0x10000;
-      wchar_t sh = (wchar_t)((c >> 10) + 0xD800);
-      wchar_t sl = (wchar_t)((c & 0x3FF) + 0xDC00);
-      out.push_back (sh);
-      out.push_back (sl);
-    }
-  }
-#endif
+  to_utf16 (s.data (), s.data () + s.size (), out);
   return out;
 }
 
@@ -287,16 +497,7 @@ std::wstring widen (const std::string& s)
 std::u32string runes (const char* s, size_t nch)
 {
   u32string str;
-  if (!nch)
-    nch = strlen (s);
-
-  const char* end = s + nch;
-
-  while (s < end)
-  {
-    char32_t  r = next (s);
-    str.push_back (r);
-  }
+  to_utf32 (s, s + (nch ? nch : strlen (s)), str);
   return str;
 }
 
@@ -313,321 +514,219 @@ std::u32string runes (const char* s, size_t nch)
 std::u32string runes (const std::string& s)
 {
   u32string str;
-  auto ptr = s.cbegin ();
-  while (ptr != s.cend())
-  {
-    char32_t r = next (ptr, s.cend());
-    str.push_back (r);
-  }
+  to_utf32 (s.data (), s.data () + s.size (), str);
   return str;
 }
 
-
-/*!
-  Verifies if string is a valid UTF-8 string
-
-  \param s pointer to character string to verify
-  \param nch number of characters to verify or 0 if string is null-terminated
-  \return `true` if string is a valid UTF-8 encoded string, `false` otherwise
-*/
-bool valid_str (const char *s, size_t nch)
-{
-  if (!nch)
-    nch = strlen (s);
-
-  auto prev_mode = error_mode (action::replace);
-  const char* last = s + nch;
-  bool valid = true;
-  while (s < last && valid)
-    valid = (next (s) != REPLACEMENT_CHARACTER);
-  error_mode (prev_mode);
-  return (s == last);
-}
-
-/*!
-  Decodes a UTF-8 encoded character and advances iterator to next code point
-
-  \param ptr    Reference to iterator to be advanced
-  \param last   Iterator pointing to the end of range  
-  \return       decoded character
-
-  If the iterator points to an invalid UTF-8 encoding or is at end, the function
-  throws an exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending
-  on error handling mode. In any case, the iterator is advanced to beginning of
-  next character or end of string.
+/*
+  Thread-local scratch buffer used by scoped_wide objects. It is a stack of
+  blocks that are never moved or released. A string is never split between
+  blocks, so it remains valid while other strings are added after it.
 */
-char32_t next (std::string::const_iterator& ptr, const std::string::const_iterator last)
+struct scratch_block {
+  std::unique_ptr<wchar_t[]> data;
+  size_t size;
+};
+
+static thread_local struct {
+  std::vector<scratch_block> blocks;
+  size_t block = 0;   //current block
+  size_t used = 0;    //number of characters used in current block
+} scratch;
+
+// Allocate `n` characters from scratch buffer
+static wchar_t* scratch_alloc (size_t n)
 {
-  char32_t rune = 0;
-  if (ptr == last)
-    return throw_or_replace (utf8::exception::invalid_utf8);
-
-  if ((*ptr & 0x80) == 0)
-    return *ptr++;
-  else if ((*ptr & 0xC0) == 0x80)
+  auto& blocks = scratch.blocks;
+  if (!blocks.empty () && scratch.used + n <= blocks[scratch.block].size)
   {
-    do {
-      ++ptr;
-    } while (ptr != last && (*ptr & 0x80) == 0x80);
-    rune = throw_or_replace (utf8::exception::invalid_utf8);
+    wchar_t* p = blocks[scratch.block].data.get () + scratch.used;
+    scratch.used += n;
+    return p;
   }
-  else
+
+  //move to next block; blocks after the current one are free
+  size_t next = blocks.empty () ? 0 : scratch.block + 1;
+  if (next == blocks.size () || blocks[next].size < n)
   {
-    size_t cont = 0;
-    if ((*ptr & 0xE0) == 0xC0)
-    {
-      cont = 1;
-      rune = *ptr++ & 0x1f;
-    }
-    else if ((*ptr & 0xF0) == 0xE0)
-    {
-      cont = 2;
-      rune = *ptr++ & 0x0f;
-    }
-    else if ((*ptr & 0xF8) == 0xF0)
-    {
-      cont = 3;
-      rune = *ptr++ & 0x07;
-    }
+    size_t sz = std::max (n, blocks.empty () ? (size_t)1024 : 2 * blocks.back ().size);
+    scratch_block b{ std::unique_ptr<wchar_t[]> (new wchar_t[sz]), sz };
+    if (next == blocks.size ())
+      blocks.push_back (std::move (b));
     else
-    {
-      //code points > U+0x10FFFF are invalid
-      do {
-        ++ptr;
-      } while (ptr != last && (*ptr & 0xC0) == 0x80);
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
-    size_t i;
-    for (i=0; i<cont && ptr != last && (*ptr & 0xC0) == 0x80; i++)
-    {
-      rune <<= 6;
-      rune += *ptr++ & 0x3f;
-    }
-
-    //sanity checks
-    if (i != cont)
-    {
-      //short encoding
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
-    if (0xD800 <= rune && rune <= 0xdfff)
-    {
-      //surrogates (U+D000 to U+DFFF) are invalid
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
-
-    if (rune < 0x80
-      || (cont > 1 && rune < 0x800)
-      || (cont > 2 && rune < 0x10000))
-    {
-      //overlong encoding
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
+      blocks[next] = std::move (b);
   }
-  return rune;
+  scratch.block = next;
+  scratch.used = n;
+  return blocks[next].data.get ();
 }
 
-/*!
-  Decodes a UTF-8 encoded character and advances pointer to next character
-
-  \param ptr    <b>Reference</b> to character pointer to be advanced
-  \return       decoded character
-
-  If the string contains an invalid UTF-8 encoding, the function throws an 
-  exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending on error
-  handling mode. In any case, the pointer is advanced to beginning of next
-  character or end of string.
+/*
+  Output adapter for decoding functions. It writes to a buffer known to be
+  large enough for the result.
 */
-char32_t next (const char*& ptr)
-{
-  char32_t rune = 0;
-  if ((*ptr & 0x80) == 0)
-  {
-    if ((rune = *ptr) != 0)
-      ++ptr;
-  }
-  else if ((*ptr & 0xC0) == 0x80)
+struct wide_buffer {
+  typedef wchar_t value_type;
+  wchar_t* ptr;
+  size_t len;
+
+  size_t size () const { return len; }
+  void reserve (size_t) {}
+  void resize (size_t n) { len = n; }
+  wchar_t& operator[] (size_t i) { return ptr[i]; }
+  void push_back (wchar_t c) { ptr[len++] = c; }
+  void append (const char* b, const char* e)
   {
-    do {
-      ptr++;
-    } while (*ptr && (*ptr & 0x80) == 0x80);
-    return throw_or_replace (utf8::exception::invalid_utf8);
+    while (b != e)
+      ptr[len++] = (wchar_t)*b++;
   }
-  else
-  {
-    size_t cont = 0;
-    if ((*ptr & 0xE0) == 0xC0)
-    {
-      cont = 1;
-      rune = *ptr++ & 0x1f;
-    }
-    else if ((*ptr & 0xF0) == 0xE0)
-    {
-      cont = 2;
-      rune = *ptr++ & 0x0f;
-    }
-    else if ((*ptr & 0xF8) == 0xF0)
-    {
-      cont = 3;
-      rune = *ptr++ & 0x07;
-    }
-    else
-    {
-      do {
-        ptr++;
-      } while (*ptr && (*ptr & 0xC0) == 0x80);
-      //code points > U+0x10FFFF are invalid
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
-    size_t i;
-    for (i = 0; i < cont && (*ptr & 0xC0) == 0x80; i++)
-    {
-      rune <<= 6;
-      rune += *ptr++ & 0x3f;
-    }
-
-    //sanity checks
-    if (i != cont)
-      return throw_or_replace (utf8::exception::invalid_utf8); //short encoding
-    if (0xD800 <= rune && rune <= 0xdfff)
-    {
-      //surrogates (U+D000 to U+DFFF) are invalid
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
+};
 
-    if (rune < 0x80
-      || (cont > 1 && rune < 0x800)
-      || (cont > 2 && rune < 0x10000))
-    {
-      //overlong encoding
-      return throw_or_replace (utf8::exception::invalid_utf8);
-    }
-  }
-  return rune;
+/*!
+  Convert a UTF-8 string to wide characters
+  \param s   input string
+  \param nch number of characters to convert or 0 if string is null-terminated
+*/
+scoped_wide::scoped_wide (const char* s, size_t nch)
+{
+  convert (s, (s && !nch) ? strlen (s) : nch);
 }
 
 /*!
-  Decrements a character pointer to previous UTF-8 character
+  Convert a UTF-8 string to wide characters
+  \param s   input string
+*/
+scoped_wide::scoped_wide (const std::string& s)
+{
+  convert (s.data (), s.size ());
+}
 
-  \param ptr    <b>Reference</b> to character pointer to be decremented
-  \return       previous UTF-8 encoded character
+/// Release space in scratch buffer
+scoped_wide::~scoped_wide ()
+{
+  scratch.block = block;
+  scratch.used = used;
+}
 
-  If the string contains an invalid UTF-8 encoding, the function throws an 
-  exception  or returns utf8::REPLACEMENT_CHARACTER (0xfffd) depending on error
-  handling mode. In this case the pointer remains unchanged.
-*/
-char32_t prev (const char* & ptr)
+void scoped_wide::convert (const char* s, size_t nch)
 {
-  int cont = 0;
-  const char* in_ptr = ptr;
-  char32_t rune = 0;
-  unsigned char ch;
-  while (((ch = *--ptr) & 0xc0) == 0x80 && cont < 3)
-  {
-    rune += (char32_t)(ch & 0x3f) << cont++ * 6;
+  block = scratch.block;
+  used = scratch.used;
+
+  //each UTF-8 byte produces at most one UTF-16 character
+  wide_buffer out{ scratch_alloc (nch + 1), 0 };
+  try {
+    if (s)
+      to_utf16 (s, s + nch, out);
   }
-  if (cont == 3 && (ch & 0xF8) == 0xF0)
-    rune += (char32_t)(ch & 0x0f) << 18;
-  else if (cont == 2 && (ch & 0xF0) == 0xE0)
-    rune += (char32_t)(ch & 0x1f) << 12;
-  else if (cont == 1 && (ch & 0xE0) == 0xC0)
-    rune += (char32_t)(ch & 0x3f) << 6;
-  else if (cont == 0 && ch < 0x7f)
-    rune += ch;
-  else
-  {
-    ptr = in_ptr;
-    return throw_or_replace (utf8::exception::invalid_utf8);
+  catch (...) {
+    //destructor is not called; release space now
+    scratch.block = block;
+    scratch.used = used;
+    throw;
   }
-
-  if ((0xD800 <= rune && rune <= 0xdfff) //surrogate
-   || (cont > 0 && rune < 0x80)
-   || (cont > 1 && rune < 0x800)
-   || (cont > 2 && rune < 0x10000))  //overlong encoding
-  {
-    ptr = in_ptr;
-    return throw_or_replace (utf8::exception::invalid_utf8);
-  }
-
-  return rune;
+  str = out.ptr;
+  len = out.len;
+  str[len] = 0;
 }
 
 /*!
-  Decrements an iterator to previous UTF-8 character
+  \defgroup pmr Conversions with Polymorphic Allocators
+  Versions of conversion functions that allocate their result from a
+  `std::pmr::memory_resource`.
+
+  They produce the same results as the functions with the same name in the
+  `utf8` namespace, but the output string uses the memory resource given as
+  last argument. This allows conversion results to be placed in an arena
+  (for instance a `std::pmr::monotonic_buffer_resource`) and released
+  together with it:
+\code
+  char buffer[1024];
+  std::pmr::monotonic_buffer_resource arena (buffer, sizeof (buffer));
+  auto ws = utf8::pmr::widen (u8"ελληνικό", &arena);
+\endcode
+  @{
+*/
 
-  \param ptr    iterator to be decremented
-  \param first  iterator pointing to beginning of string
-  \return       previous UTF-8 encoded character
+/// Conversion from wide character to UTF-8
+/// \param s   input string
+/// \param mr  memory resource for result
+std::pmr::string pmr::narrow (std::wstring_view s, std::pmr::memory_resource* mr)
+{
+  std::pmr::string out (mr);
+  from_utf16 (s.data (), s.data () + s.size (), out);
+  return out;
+}
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and iterator remains unchanged.
-*/
-char32_t prev (std::string::const_iterator& ptr, const std::string::const_iterator first)
+/// Conversion from UTF-32 to UTF-8
+/// \param s   input string
+/// \param mr  memory resource for result
+std::pmr::string pmr::narrow (std::u32string_view s, std::pmr::memory_resource* mr)
 {
-  int cont = 0;
-  auto in_ptr = ptr;
-  char32_t rune = 0;
-  unsigned char ch;
-  while (((ch = *--ptr) & 0xc0) == 0x80 && cont < 3 && ptr > first)
-  {
-    rune += (char32_t)(ch & 0x3f) << cont++ * 6;
-  }
-  if (cont == 3 && (ch & 0xF8) == 0xF0)
-    rune += (char32_t)(ch & 0x0f) << 18;
-  else if (cont == 2 && (ch & 0xF0) == 0xE0)
-    rune += (char32_t)(ch & 0x1f) << 12;
-  else if (cont == 1 && (ch & 0xE0) == 0xC0)
-    rune += (char32_t)(ch & 0x3f) << 6;
-  else if (cont == 0 && ch < 0x7f)
-    rune += ch;
-  else
-  {
-    ptr = in_ptr;
-    return throw_or_replace (utf8::exception::invalid_utf8);
-  }
+  std::pmr::string out (mr);
+  from_utf32 (s.data (), s.data () + s.size (), out);
+  return out;
+}
 
-  if ((0xD800 <= rune && rune <= 0xdfff) //surrogate
-   || (cont > 0 && rune < 0x80)
-   || (cont > 1 && rune < 0x800)
-   || (cont > 2 && rune < 0x10000))  //overlong encoding
-  {
-    ptr = in_ptr;
-    return throw_or_replace (utf8::exception::invalid_utf8);
-  }
+/// Conversion of one UTF-32 character to UTF-8
+/// \param r   input character
+/// \param mr  memory resource for result
+std::pmr::string pmr::narrow (char32_t r, std::pmr::memory_resource* mr)
+{
+  std::pmr::string out (mr);
+  from_utf32 (&r, &r + 1, out);
+  return out;
+}
+
+/// Conversion from UTF-8 to wide character
+/// \param s   input string
+/// \param mr  memory resource for result
+std::pmr::wstring pmr::widen (std::string_view s, std::pmr::memory_resource* mr)
+{
+  std::pmr::wstring out (mr);
+  to_utf16 (s.data (), s.data () + s.size (), out);
+  return out;
+}
 
-  return rune;
+/// Conversion from UTF-8 to UTF-32
+/// \param s   input string
+/// \param mr  memory resource for result
+std::pmr::u32string pmr::runes (std::string_view s, std::pmr::memory_resource* mr)
+{
+  std::pmr::u32string out (mr);
+  to_utf32 (s.data (), s.data () + s.size (), out);
+  return out;
 }
 
-/*!
-  Counts number of characters in an UTF8 encoded string
+/// @}
 
-  \param s UTF8-encoded string
-  \return number of characters in string
+/*!
+  Verifies if string is a valid UTF-8 string
 
-  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html
+  \param s pointer to character string to verify
+  \param nch number of characters to verify or 0 if string is null-terminated
+  \return `true` if string is a valid UTF-8 encoded string, `false` otherwise
 */
-size_t length (const std::string& s)
+bool valid_str (const char *s, size_t nch)
 {
-  size_t nc = 0;
-  auto p = s.begin ();
-  while (p != s.end ())
-  {
-    if ((*p++ & 0xC0) != 0x80)
-      nc++;
-  }
-  return nc;
-}
+  if (!nch)
+    nch = strlen (s);
 
-/// \copydoc utf8::length()
-size_t length (const char* s)
-{
-  size_t nc = 0;
-  while (*s)
+  auto prev_mode = error_mode (action::replace);
+#ifdef UTF8_STATS
+  stats_pause pause; //failed checks are not replacements
+#endif
+  auto& k = detail::cpu_kernels ();
+  const char* last = s + nch;
+  bool valid = true;
+  while (s < last && valid)
   {
-    if ((*s++ & 0xC0) != 0x80)
-      nc++;
+    s += k.ascii_prefix (s, last - s);
+    if (s < last)
+      valid = (next (s) != REPLACEMENT_CHARACTER);
   }
-  return nc;
+  error_mode (prev_mode);
+  return (s == last);
 }
 
 /*!
@@ -657,78 +756,6 @@ size_t length (const char* s)
 
 */
 
-/*!
-  Check if character is space or tab
-  \param r character to check
-  \return `true` if character is `\t` (0x09) or is in the "Space_Separator" (Zs)
-          category, `false` otherwise.
-
-  See [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
-  for a list of characters in the Zs (Space_Separator) category. The function adds
-  HORIZONTAL_TAB (0x09 or '\\t') to the space separator category for compatibility
-  with standard `isblank (char c)` C function.
-*/
-bool isblank (char32_t r)
-{
-  const char32_t blanktab[]{ 0x09, 0x20, 0xA0, 0x1680, 0x2000, 0x2001, 0x2002,
-    0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A, 0x202f, 0x205f, 0x3000 };
-
-  auto f = lower_bound (begin (blanktab), end (blanktab), r);
-  return (f != end (blanktab) && *f == r);
-}
-
-/*!
-  Check if character is white space.
-  \param r character to check
-  \return `true` if character is white space, `false` otherwise
-
-  Returns `true` if Unicode character has the "White_Space=yes" property in the
-  [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
-*/
-bool isspace (char32_t r)
-{
-  const char32_t spacetab[]{ 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x20, 0x85, 0xA0, 0x1680,
-    0x2000, 0x2001, 0x2002, 0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A,
-    0x2028, 0x2029, 0x202f, 0x205f, 0x3000 };
-
-  auto f = lower_bound (begin (spacetab), end (spacetab), r);
-  return (f != end (spacetab) && *f == r);
-}
-
-
-// ----------------------- Low level internal functions -----------------------
-
-/// Encode a character and append it to a string
-void encode (char32_t c, std::string& s)
-{
-  if (c <= 0x7f)
-    s.push_back ((char)c);
-  else if (c <= 0x7ff)
-  {
-    s.push_back (0xC0 | c >> 6);
-    s.push_back (0x80 | c & 0x3f);
-  }
-  else if (c <= 0xFFFF)
-  {
-    if (c >= 0xD800 && c <= 0xdfff)
-      c= throw_or_replace(exception::cause::invalid_char32);
-
-    s.push_back (0xE0 | c >> 12);
-    s.push_back (0x80 | c >> 6 & 0x3f);
-    s.push_back (0x80 | c & 0x3f);
-  }
-  else if (c <= 0x10ffff)
-  {
-    s.push_back (0xF0 | c >> 18);
-    s.push_back (0x80 | c >> 12 & 0x3f);
-    s.push_back (0x80 | c >> 6 & 0x3f);
-    s.push_back (0x80 | c & 0x3f);
-  }
-  else if (ermode == action::except)
-    throw exception (exception::cause::invalid_char32);
-  else
-    s.append ("\xEF\xBF\xBD"); //append replacement character
-}
 
 
 /*!
@@ -41,7 +41,7 @@ bool find_first (const std::string& name, find_data& fdat)
 {
   WIN32_FIND_DATAW wfd;
   memset (&wfd, 0, sizeof (wfd));
-  fdat.handle = FindFirstFileW (widen (name).c_str (), &wfd);
+  fdat.handle = FindFirstFileW (scoped_wide (name).c_str (), &wfd);
   if (fdat.handle != INVALID_HANDLE_VALUE)
   {
     copy_fdat (wfd, fdat);
@@ -107,7 +107,7 @@ void find_close (find_data& fdat)
 int MessageBox (HWND hWnd, const std::string& text, const std::string& caption,
   unsigned int type)
 {
-  return ::MessageBoxW (hWnd, widen (text).c_str (), widen (caption).c_str (), type);
+  return ::MessageBoxW (hWnd, scoped_wide (text).c_str (), scoped_wide (caption).c_str (), type);
 }
 
 /*!
@@ -120,7 +120,7 @@ int MessageBox (HWND hWnd, const std::string& text, const std::string& caption,
 */
 bool CopyFile (const std::string& from, const std::string& to, bool fail_exist)
 {
-  return ::CopyFileW (widen (from).c_str (), widen (to).c_str (), fail_exist);
+  return ::CopyFileW (scoped_wide (from).c_str (), scoped_wide (to).c_str (), fail_exist);
 }
 
 /*!
@@ -155,10 +155,10 @@ std::string LoadString (UINT id, HINSTANCE hInst)
 HINSTANCE ShellExecute (const std::string& file, const std::string& verb, const std::string& parameters, const std::string& directory, HWND hWnd, int show)
 {
   return ShellExecuteW (hWnd,
-    (verb.empty () ? NULL : utf8::widen (verb).c_str ()),
-    utf8::widen (file).c_str (),
-    utf8::widen(parameters).c_str(),
-    utf8::widen (directory).c_str (),
+    (verb.empty () ? NULL : utf8::scoped_wide (verb).c_str ()),
+    utf8::scoped_wide (file).c_str (),
+    utf8::scoped_wide (parameters).c_str (),
+    utf8::scoped_wide (directory).c_str (),
     show);
 }
 
@@ -263,14 +263,14 @@ std::string GetModuleFileName (HMODULE hModule)
 */
 bool symlink (const char* path, const char* link, bool directory)
 {
-  return CreateSymbolicLinkW (widen (link).c_str (), widen (path).c_str (),
+  return CreateSymbolicLinkW (scoped_wide (link).c_str (), scoped_wide (path).c_str (),
     (directory ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0) | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE) != 0;
 }
 
 /// \copydoc utf8::symlink()
 bool symlink (const std::string& path, const std::string& link, bool directory)
 {
-  return CreateSymbolicLinkW (widen (link).c_str (), widen (path).c_str (),
+  return CreateSymbolicLinkW (scoped_wide (link).c_str (), scoped_wide (path).c_str (),
     (directory ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0) | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE) != 0;
 }
 
@@ -354,7 +354,7 @@ bool makepath (std::string& path, const std::string& drive, const std::string& d
   const std::string& fname, const std::string& ext)
 {
   wchar_t wpath[_MAX_PATH];
-  if (_wmakepath_s (wpath, widen (drive).c_str (), widen (dir).c_str (), widen (fname).c_str (), widen (ext).c_str ()))
+  if (_wmakepath_s (wpath, scoped_wide (drive).c_str (), scoped_wide (dir).c_str (), scoped_wide (fname).c_str (), scoped_wide (ext).c_str ()))
     return false;
 
   path = narrow (wpath);
@@ -368,7 +368,7 @@ bool makepath (std::string& path, const std::string& drive, const std::string& d
 std::string fullpath (const std::string& relpath)
 {
   wchar_t wpath[_MAX_PATH];
-  if (_wfullpath (wpath, widen (relpath).c_str (), _MAX_PATH))
+  if (_wfullpath (wpath, scoped_wide (relpath).c_str (), _MAX_PATH))
     return narrow (wpath);
   else
     return std::string ();
@@ -9,6 +9,8 @@
 
 #include <thread>
 #include <chrono>
+#include <filesystem>
+#include <vector>
 
 using namespace std;
 using namespace chrono_literals;
@@ -522,6 +524,31 @@ SUITE (IniTests)
     utf8::remove ("test2.ini");
   }
 
+  TEST (CopySection_content)
+  {
+    FILE* f = utf8::fopen ("test1.ini", "wb");
+    fputs ("[a]\nk1=v1\n; comment\nk2=v2\n[b]\nx=1\n", f);
+    fclose (f);
+    f = utf8::fopen ("test2.ini", "wb");
+    fputs ("[p]\np=1\n[ A ]\nold=1\n[q]\nq=1\n", f);
+    fclose (f);
+
+    utf8::IniFile f1 ("test1.ini");
+    utf8::IniFile f2 ("test2.ini");
+    CHECK (f2.CopySection (f1, "a"));
+
+    //untouched parts of destination file are copied as they are
+    char buf[256];
+    f = utf8::fopen ("test2.ini", "rb");
+    size_t n = fread (buf, 1, sizeof (buf) - 1, f);
+    fclose (f);
+    buf[n] = 0;
+    CHECK_EQUAL ("[p]\np=1\n[a]\r\nk1=v1\n; comment\nk2=v2\n\n[q]\nq=1\n", buf);
+
+    utf8::remove ("test1.ini");
+    utf8::remove ("test2.ini");
+  }
+
   TEST (Delete_section)
   {
     utf8::IniFile f1 ("test1.ini");
@@ -557,4 +584,792 @@ SUITE (IniTests)
     CHECK_EQUAL ("f1_val11", f1.GetString ("key1", "section1"));
     utf8::remove ("test1.ini");
   }
+  TEST (Typed_values)
+  {
+    enum class color { red, green, blue };
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+
+    CHECK (test.PutValue ("int64", INT64_MIN, "typed"));
+    CHECK (test.PutValue ("uint64", UINT64_MAX, "typed"));
+    CHECK (test.PutValue ("double", 0.1, "typed"));
+    CHECK (test.PutValue ("bool", true, "typed"));
+    CHECK (test.PutValue ("enum", color::blue, "typed"));
+    CHECK (test.PutValue ("duration", 1500ms, "typed"));
+
+    int64_t i64 = 0;
+    CHECK (test.GetValue ("int64", "typed", i64));
+    CHECK_EQUAL (INT64_MIN, i64);
+    uint64_t u64 = 0;
+    CHECK (test.GetValue ("uint64", "typed", u64));
+    CHECK_EQUAL (UINT64_MAX, u64);
+    double d = 0;
+    CHECK (test.GetValue ("double", "typed", d));
+    CHECK_EQUAL (0.1, d);
+    CHECK_EQUAL ("0.1", test.GetString ("double", "typed"));
+    bool b = false;
+    CHECK (test.GetValue ("bool", "typed", b));
+    CHECK (b);
+    color c = color::red;
+    CHECK (test.GetValue ("enum", "typed", c));
+    CHECK (c == color::blue);
+    CHECK_EQUAL ("1500ms", test.GetString ("duration", "typed"));
+    chrono::seconds secs{};
+    chrono::milliseconds msecs{};
+    CHECK (test.GetValue ("duration", "typed", msecs));
+    CHECK_EQUAL (1500, msecs.count ());
+    CHECK (test.GetValue ("duration", "typed", secs));
+    CHECK_EQUAL (2, secs.count ()); //rounded to nearest
+    test.PutString ("duration", "-1500ms", "typed");
+    CHECK (test.GetValue ("duration", "typed", secs));
+    CHECK_EQUAL (-2, secs.count ());
+
+    //large tick counts are exact
+    chrono::nanoseconds nsecs{};
+    test.PutString ("duration", "9007199254740993", "typed");
+    CHECK (test.GetValue ("duration", "typed", nsecs));
+    CHECK_EQUAL (9007199254740993, nsecs.count ());
+    test.PutString ("duration", "9223372036854775807ns", "typed");
+    CHECK (test.GetValue ("duration", "typed", nsecs));
+    CHECK_EQUAL (INT64_MAX, nsecs.count ());
+    test.PutString ("duration", "9223372036854775808", "typed");
+    CHECK (!test.GetValue ("duration", "typed", nsecs));
+    test.PutString ("duration", "9223372036854775807s", "typed");
+    CHECK (!test.GetValue ("duration", "typed", nsecs));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Typed_values_errors)
+  {
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+    test.PutString ("trailing", "123abc", "typed");
+    test.PutString ("big", "300", "typed");
+    test.PutString ("negative", "-1", "typed");
+    test.PutString ("unit", "3 parsecs", "typed");
+    test.PutString ("bool", "maybe", "typed");
+
+    int i = 42;
+    CHECK (!test.GetValue ("trailing", "typed", i));
+    CHECK (!test.GetValue ("missing", "typed", i));
+    CHECK_EQUAL (42, i); //unchanged on failure
+    CHECK_EQUAL (123, test.GetInt ("trailing", "typed")); //atoi-like behavior
+
+    //empty values give the default, like missing keys
+    test.PutString ("empty", "", "typed");
+    deque<string> keys;
+    test.GetKeys (keys, "typed");
+    CHECK (find (keys.begin (), keys.end (), "empty") != keys.end ());
+    CHECK_EQUAL (42, test.GetInt ("empty", "typed", 42));
+    CHECK_EQUAL (4.5, test.GetDouble ("empty", "typed", 4.5));
+    CHECK (test.GetBool ("empty", "typed", true));
+    test.PutString ("plus_one", "+1", "typed");
+    CHECK (test.GetBool ("plus_one", "typed", false));
+
+    int8_t i8 = 0;
+    CHECK (!test.GetValue ("big", "typed", i8));
+    unsigned int u = 0;
+    CHECK (!test.GetValue ("negative", "typed", u));
+    chrono::seconds secs{};
+    CHECK (!test.GetValue ("unit", "typed", secs));
+    bool b = true;
+    CHECK (!test.GetValue ("bool", "typed", b));
+
+    test.PutString ("no_unit", " 25 ", "typed");
+    CHECK (test.GetValue ("no_unit", "typed", secs));
+    CHECK_EQUAL (25, secs.count ());
+    utf8::remove ("test.ini");
+  }
+
+  TEST (PutDouble_decimals)
+  {
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+    CHECK (test.PutDouble ("pi", 3.14159, "section"));
+    CHECK_EQUAL ("3.14", test.GetString ("pi", "section"));
+    CHECK (test.PutDouble ("pi", 3.14159, "section", 4));
+    CHECK_EQUAL (3.1416, test.GetDouble ("pi", "section"));
+
+    //hexadecimal values are accepted, like strtod does
+    CHECK (test.PutString ("hex", "0x1p3", "section"));
+    CHECK_EQUAL (8., test.GetDouble ("hex", "section"));
+    CHECK (test.PutString ("hex", "-0X1.8p1", "section"));
+    CHECK_EQUAL (-3., test.GetDouble ("hex", "section"));
+    double d = 0;
+    CHECK (test.GetValue ("hex", "section", d));
+    CHECK_EQUAL (-3., d);
+    utf8::remove ("test.ini");
+  }
+  TEST (Unicode_case_insensitive)
+  {
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+    CHECK (test.PutString (u8"Κλειδί", "greek", u8"Ενότητα"));
+    CHECK (test.PutString (u8"Ключ", "cyrillic", u8"Раздел"));
+
+    CHECK_EQUAL ("greek", test.GetString (u8"ΚΛΕΙΔΊ", u8"ενότητα"));
+    CHECK_EQUAL ("cyrillic", test.GetString (u8"ключ", u8"РАЗДЕЛ"));
+
+    //replace value using a different case
+    CHECK (test.PutString (u8"ΚΛΕΙΔΊ", "new greek", u8"ΕΝΌΤΗΤΑ"));
+    deque<string> keys;
+    CHECK_EQUAL (1, test.GetKeys (keys, u8"ενότητα"));
+    CHECK_EQUAL ("new greek", test.GetString (u8"κλειδί", u8"Ενότητα"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Exact_name_match)
+  {
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+    test.PutString ("key10", "value10", "section10");
+
+    //a prefix of a name doesn't match
+    CHECK (!test.HasKey ("key1", "section10"));
+    CHECK (!test.HasKey ("key10", "section1"));
+    CHECK (test.PutString ("key1", "value1", "section1"));
+    CHECK_EQUAL ("value10", test.GetString ("key10", "section10"));
+    CHECK_EQUAL ("value1", test.GetString ("key1", "section1"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Index_follows_file_changes)
+  {
+    utf8::remove ("test.ini");
+    this_thread::sleep_for (200ms);
+    utf8::IniFile test ("test.ini");
+    test.PutString ("key", "value", "section");
+    CHECK_EQUAL ("value", test.GetString ("key", "section"));
+
+    //file changed by someone else
+    FILE* f = utf8::fopen ("test.ini", "w");
+    fputs ("[section]\n"
+           "other=something\n"
+           "key=changed\n"
+           "[section]\n"
+           "key=second\n", f);
+    fclose (f);
+    CHECK_EQUAL ("changed", test.GetString ("key", "section"));
+    CHECK_EQUAL ("something", test.GetString ("OTHER", "Section"));
+    CHECK (!test.HasKey ("missing", "section"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Compiled_image)
+  {
+    utf8::remove ("test.ini");
+    utf8::remove ("test.img");
+    FILE* f = utf8::fopen ("test.ini", "w");
+    fputs ("[section1]\n"
+           "key1=value1\n"
+           "; comment=not a key\n"
+           "Key2 =  value2  \n"
+           "key1=second value\n"
+           "[ Section2 ]\n"
+           "key3=value3\n"
+           "[section1]\n"
+           "key4=value4\n", f);
+    fclose (f);
+
+    utf8::IniFile text ("test.ini");
+    utf8::IniFile test ("test.ini");
+    CHECK (test.Compile ("test.img"));
+    CHECK (test.LoadCompiled ("test.img"));
+
+    CHECK_EQUAL ("value1", test.GetString ("KEY1", "section1"));
+    CHECK_EQUAL ("value2", test.GetString ("key2", "SECTION1"));
+    CHECK_EQUAL ("value3", test.GetString ("key3", "section2"));
+    CHECK (!test.HasKey ("key4", "section1"));
+    CHECK (!test.HasKey ("comment", "section1"));
+    CHECK (!test.HasKey ("key1", "nosection"));
+
+    deque<string> img_keys, txt_keys;
+    CHECK_EQUAL (text.GetKeys (txt_keys, "section1"), test.GetKeys (img_keys, "section1"));
+    CHECK (img_keys == txt_keys);
+    deque<string> img_sects, txt_sects;
+    CHECK_EQUAL (3, test.GetSections (img_sects));
+    text.GetSections (txt_sects);
+    CHECK (img_sects == txt_sects);
+    char buf[256], txt_buf[256];
+    CHECK_EQUAL (text.GetSections (txt_buf, sizeof (txt_buf)), test.GetSections (buf, sizeof (buf)));
+    CHECK (!memcmp (buf, txt_buf, strlen ("section1") + strlen (" Section2") + strlen ("section1") + 4));
+
+    //writing makes the image stale; object falls back to text file
+    CHECK (test.PutString ("key1", "new value", "section1"));
+    CHECK_EQUAL ("new value", test.GetString ("key1", "section1"));
+    CHECK (!test.LoadCompiled ("test.img"));
+    CHECK_EQUAL ("new value", test.GetString ("key1", "section1"));
+
+    utf8::remove ("test.ini");
+    utf8::remove ("test.img");
+  }
+
+  TEST (Compiled_image_content_check)
+  {
+    const char* content = "[section]\n"
+                          "key=value\n";
+    utf8::remove ("test.ini");
+    FILE* f = utf8::fopen ("test.ini", "w");
+    fputs (content, f);
+    fclose (f);
+    utf8::IniFile test ("test.ini");
+    CHECK (test.Compile ("test.img"));
+
+    //same content with a different modification time is accepted
+    this_thread::sleep_for (50ms);
+    f = utf8::fopen ("test.ini", "w");
+    fputs (content, f);
+    fclose (f);
+    CHECK (test.LoadCompiled ("test.img"));
+    CHECK_EQUAL ("value", test.GetString ("key", "section"));
+
+    //same size, different content is rejected
+    f = utf8::fopen ("test.ini", "w");
+    fputs ("[section]\n"
+           "key=VALUE\n", f);
+    fclose (f);
+    CHECK_EQUAL ("VALUE", test.GetString ("key", "section"));
+    CHECK (!test.LoadCompiled ("test.img"));
+
+    //not an image
+    CHECK (!test.LoadCompiled ("test.ini"));
+    utf8::remove ("test.ini");
+    utf8::remove ("test.img");
+  }
+
+  TEST (Journal_mode)
+  {
+    utf8::remove ("test.ini");
+    utf8::remove ("test.ini.journal");
+    utf8::IniFile test ("test.ini");
+    test.PutString ("key1", "value1", "section1");
+    test.PutString ("key2", "value2", "section1");
+    auto size = filesystem::file_size ("test.ini");
+
+    test.EnableJournal ();
+    CHECK (test.PutString ("key1", "new value", "section1"));
+    CHECK (test.PutString ("key3", "value3", "section1"));
+    CHECK (test.PutInt ("key4", 4, "section2"));
+    CHECK (test.DeleteKey ("key2", "section1"));
+
+    //INI file is not changed
+    CHECK_EQUAL (size, filesystem::file_size ("test.ini"));
+    CHECK (filesystem::exists ("test.ini.journal"));
+
+    //other readers see the changes
+    utf8::IniFile reader ("test.ini");
+    CHECK_EQUAL ("new value", reader.GetString ("key1", "section1"));
+    CHECK_EQUAL ("value3", reader.GetString ("KEY3", "Section1"));
+    CHECK_EQUAL (4, reader.GetInt ("key4", "section2"));
+    CHECK (!reader.HasKey ("key2", "section1"));
+    deque<string> keys;
+    CHECK_EQUAL (2, reader.GetKeys (keys, "section1"));
+    CHECK_EQUAL ("key1", keys[0]);
+    CHECK_EQUAL ("key3", keys[1]);
+    deque<string> sections;
+    CHECK_EQUAL (2, reader.GetSections (sections));
+    CHECK_EQUAL ("section2", sections[1]);
+
+    CHECK (test.Compact ());
+    CHECK (!filesystem::exists ("test.ini.journal"));
+    CHECK_EQUAL ("new value", reader.GetString ("key1", "section1"));
+    CHECK (!reader.HasKey ("key2", "section1"));
+    CHECK_EQUAL (4, reader.GetInt ("key4", "section2"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Journal_same_result)
+  {
+    utf8::remove ("test.ini");
+    utf8::remove ("journal.ini");
+    utf8::IniFile direct ("test.ini");
+    utf8::IniFile journal ("journal.ini");
+    journal.EnableJournal ();
+
+    for (auto f : { &direct, &journal })
+    {
+      f->PutString ("key1", "value1", "section1");
+      f->PutString ("key2", " value2 ", "section1 ");
+      f->PutString ("key3", "value3", "section2");
+      f->PutString ("KEY1", "changed", "SECTION1");
+      f->DeleteKey ("key2", "section1");
+      f->PutString ("key2", "value2", "section1");
+      f->DeleteKey ("missing", "section3");
+      f->PutString ("key4", "value4", "section3");
+    }
+    CHECK (journal.DisableJournal ());
+
+    FILE* f1 = utf8::fopen ("test.ini", "rb");
+    FILE* f2 = utf8::fopen ("journal.ini", "rb");
+    char b1[1024], b2[1024];
+    size_t n1 = fread (b1, 1, sizeof (b1), f1);
+    size_t n2 = fread (b2, 1, sizeof (b2), f2);
+    fclose (f1);
+    fclose (f2);
+    CHECK_EQUAL (n1, n2);
+    CHECK (!memcmp (b1, b2, n1));
+    utf8::remove ("test.ini");
+    utf8::remove ("journal.ini");
+  }
+
+  TEST (Journal_background_compaction)
+  {
+    utf8::remove ("test.ini");
+    utf8::remove ("test.ini.journal");
+    utf8::IniFile test ("test.ini");
+    test.EnableJournal (100, 50ms);
+    test.PutString ("key", "value", "section");
+    CHECK (filesystem::exists ("test.ini.journal"));
+
+    //compacted when journal is too old
+    for (int i = 0; i < 100 && filesystem::exists ("test.ini.journal"); i++)
+      this_thread::sleep_for (10ms);
+    CHECK (!filesystem::exists ("test.ini.journal"));
+
+    //compacted when journal is too big
+    auto size = filesystem::file_size ("test.ini");
+    test.EnableJournal (100, 1h);
+    for (int i = 0; i < 10; i++)
+      test.PutInt ("key" + to_string (i), i, "section");
+    for (int i = 0; i < 100 && filesystem::file_size ("test.ini") == size; i++)
+      this_thread::sleep_for (10ms);
+    CHECK (filesystem::file_size ("test.ini") > size);
+
+    utf8::IniFile reader ("test.ini");
+    CHECK_EQUAL ("value", reader.GetString ("key", "section"));
+    CHECK_EQUAL (9, reader.GetInt ("key9", "section"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Async_writes)
+  {
+    utf8::remove ("test.ini");
+    {
+      utf8::IniFile test ("test.ini");
+      test.PutString ("key1", "value1", "section1");
+      auto size = filesystem::file_size ("test.ini");
+
+      test.EnableAsync (1h, 1h);
+      CHECK (test.PutString ("key1", "new value", "section1"));
+      CHECK (test.PutString ("key2", "value2", "section2"));
+
+      //changes are visible to this object but not written yet
+      CHECK_EQUAL ("new value", test.GetString ("key1", "section1"));
+      CHECK_EQUAL ("value2", test.GetString ("key2", "section2"));
+      deque<string> sections;
+      CHECK_EQUAL (2, test.GetSections (sections));
+      CHECK_EQUAL (size, filesystem::file_size ("test.ini"));
+      utf8::IniFile other ("test.ini");
+      CHECK_EQUAL ("value1", other.GetString ("key1", "section1"));
+
+      CHECK (test.Flush ());
+      CHECK_EQUAL ("new value", other.GetString ("key1", "section1"));
+      CHECK_EQUAL ("value2", other.GetString ("key2", "section2"));
+
+      CHECK (test.DeleteKey ("key2", "section2"));
+      CHECK (!test.HasKey ("key2", "section2"));
+      auto done = test.FlushAsync ();
+      CHECK (done.get ());
+      CHECK (!other.HasKey ("key2", "section2"));
+
+      //changes are written when object is destroyed
+      test.PutString ("key3", "value3", "section1");
+    }
+    utf8::IniFile test ("test.ini");
+    CHECK_EQUAL ("value3", test.GetString ("key3", "section1"));
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Async_debounce)
+  {
+    utf8::remove ("test.ini");
+    utf8::IniFile test ("test.ini");
+    utf8::IniFile other ("test.ini");
+    test.EnableAsync (20ms, 1s);
+    for (int i = 0; i < 10; i++)
+      test.PutInt ("key", i, "section");
+    CHECK_EQUAL (9, test.GetInt ("key", "section"));
+    for (int i = 0; i < 100 && !other.HasKey ("key", "section"); i++)
+      this_thread::sleep_for (10ms);
+    CHECK_EQUAL (9, other.GetInt ("key", "section"));
+    CHECK (test.DisableAsync ());
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Iterate_sections_entries)
+  {
+    utf8::remove ("test.ini");
+    FILE* f = utf8::fopen ("test.ini", "wb");
+    fputs ("\xEF\xBB\xBF\r\n"
+           "[section1]\r\n"
+           "key1 = value1 \r\n"
+           "; comment=not a key\r\n"
+           "malformed line\r\n"
+           "key2=\r\n"
+           "[ Section2 ]\r\n"
+           "key3=value3", f);
+    fclose (f);
+
+    utf8::IniFile test ("test.ini");
+    deque<string> expected;
+    test.GetSections (expected);
+    size_t n = 0;
+    for (auto name : test.sections ())
+    {
+      CHECK_EQUAL (expected[n], string (name));
+      n++;
+    }
+    CHECK_EQUAL (2, n);
+
+    vector<pair<string, string>> entries;
+    for (auto& [key, value] : test.entries ("SECTION1"))
+      entries.emplace_back (key, value);
+    CHECK_EQUAL (2, entries.size ());
+    CHECK_EQUAL ("key1", entries[0].first);
+    CHECK_EQUAL ("value1", entries[0].second);
+    CHECK_EQUAL ("key2", entries[1].first);
+    CHECK_EQUAL ("", entries[1].second);
+
+    auto last = test.entries ("section2");
+    auto it = last.begin ();
+    CHECK (it != last.end ());
+    CHECK_EQUAL ("value3", string (it->value));
+    CHECK (++it == last.end ());
+
+    auto none = test.entries ("no section");
+    CHECK (none.begin () == none.end ());
+    utf8::remove ("test.ini");
+
+    auto empty = test.sections ();
+    CHECK (empty.begin () == empty.end ());
+  }
+
+  TEST (Operation_stats)
+  {
+    utf8::remove ("test.ini");
+    utf8::IniFile test ("test.ini");
+    auto before = utf8::IniFile::global_stats ();
+    int callbacks = 0;
+    utf8::IniFile::set_stats_callback ([&](const string& file, utf8::IniStats::op kind,
+                                   std::chrono::nanoseconds) {
+      if (file == test.File () && kind == utf8::IniStats::write)
+        callbacks++;
+    });
+
+    test.PutString ("key", "value", "section");
+    test.PutString ("key", "value", "section");   //same value, not written
+    test.PutString ("key", "other", "section");
+    CHECK_EQUAL ("other", test.GetString ("key", "section"));
+    utf8::IniFile::set_stats_callback (nullptr);
+
+    auto st = test.stats ();
+    CHECK_EQUAL (3, st.calls[utf8::IniStats::write]);
+    CHECK_EQUAL (1, st.calls[utf8::IniStats::read]);
+    CHECK_EQUAL (2, st.rewrites);
+    CHECK_EQUAL (1, st.skipped_writes);
+    CHECK (st.opens >= 5);
+    CHECK (st.bytes_read > 0);
+    CHECK (st.bytes_written > 0);
+    CHECK (st.time[utf8::IniStats::write].count () > 0);
+    CHECK_EQUAL (3, callbacks);
+
+    auto after = utf8::IniFile::global_stats ();
+    CHECK (after.rewrites - before.rewrites >= st.rewrites);
+    CHECK (after.calls[utf8::IniStats::write] - before.calls[utf8::IniStats::write] >= 3);
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Document_same_result)
+  {
+    const char* text = "\xEF\xBB\xBF\r\n"
+      "; comment line\r\n"
+      "[section1]\r\n"
+      "key1 = value1\r\n"
+      "\r\n"
+      "; another comment\n"
+      "key2=value2\n"
+      "[section2]\n"
+      "key3=value3\n"
+      "[other]\r\n"
+      "key=value\r\n";
+    utf8::remove ("test.ini");
+    utf8::remove ("doc.ini");
+    FILE* f = utf8::fopen ("test.ini", "wb");
+    fputs (text, f);
+    fclose (f);
+    utf8::IniFile file ("test.ini");
+
+    utf8::IniDocument doc;
+    doc.Parse (text);
+    CHECK_EQUAL (text, doc.str ());
+    CHECK_EQUAL ("value1", doc.GetString ("KEY1", "Section1"));
+    CHECK (!doc.HasKey ("key3", "section1"));
+
+    file.PutString ("key1", "changed", "section1");
+    doc.PutString ("key1", "changed", "section1");
+    file.PutString ("new", "key", "section1");
+    doc.PutString ("new", "key", "section1");
+    file.DeleteKey ("key3", "section2");
+    doc.DeleteKey ("key3", "section2");
+    file.PutString ("key4", "value4", "section3");
+    doc.PutString ("key4", "value4", "section3");
+    file.CopySection (file, "section1", "other");
+    doc.CopySection (doc, "section1", "other");
+    file.DeleteSection ("section2");
+    doc.DeleteSection ("section2");
+
+    CHECK (doc.Save ("doc.ini"));
+    utf8::IniDocument saved ("doc.ini");
+    utf8::IniDocument direct ("test.ini");
+    CHECK_EQUAL (direct.str (), saved.str ());
+    CHECK_EQUAL ("changed", saved.GetString ("key1", "other"));
+    deque<string> sections;
+    CHECK_EQUAL (3, saved.GetSections (sections));
+    CHECK_EQUAL ("section3", sections[2]);
+    utf8::remove ("test.ini");
+    utf8::remove ("doc.ini");
+  }
+
+  TEST (Document_new_file)
+  {
+    utf8::remove ("test.ini");
+    utf8::remove ("doc.ini");
+    utf8::IniFile file ("test.ini");
+    utf8::IniDocument doc ("doc.ini");  //file doesn't exist
+
+    for (int i = 0; i < 3; i++)
+    {
+      string sect = "section" + to_string (i);
+      file.PutInt ("key", i, sect);
+      doc.PutString ("key", to_string (i), sect);
+    }
+    CHECK (doc.Save ("doc.ini"));
+    CHECK_EQUAL (utf8::IniDocument ("test.ini").str (), utf8::IniDocument ("doc.ini").str ());
+    utf8::remove ("test.ini");
+    utf8::remove ("doc.ini");
+  }
+
+  TEST (Utf16_files)
+  {
+    u16string text = u"[Section]\r\nkey=value\r\nname=\u00e9t\u00e9 \U0001F600\r\n[other]\r\nk=v\r\n";
+    for (bool big_endian : { false, true })
+    {
+      utf8::remove ("test.ini");
+      FILE* f = utf8::fopen ("test.ini", "wb");
+      unsigned char bom[2] = { 0xFF, 0xFE };
+      if (big_endian)
+        swap (bom[0], bom[1]);
+      fwrite (bom, 1, 2, f);
+      for (char16_t c : text)
+      {
+        unsigned char b[2] = { (unsigned char)(c & 0xFF), (unsigned char)(c >> 8) };
+        if (big_endian)
+          swap (b[0], b[1]);
+        fwrite (b, 1, 2, f);
+      }
+      fclose (f);
+
+      utf8::IniFile test ("test.ini");
+      CHECK_EQUAL ("value", test.GetString ("key", "section"));
+      CHECK_EQUAL ("\xC3\xA9t\xC3\xA9 \xF0\x9F\x98\x80", test.GetString ("name", "section"));
+      deque<string> sections;
+      CHECK_EQUAL (2, test.GetSections (sections));
+      CHECK_EQUAL ("Section", sections[0]);
+      auto entries = test.entries ("other");
+      CHECK (entries.begin () != entries.end ());
+      CHECK_EQUAL ("v", string (entries.begin ()->value));
+
+      //index and translation are kept between reads: only the key line is read
+      auto before = test.stats ();
+      CHECK_EQUAL ("value", test.GetString ("key", "section"));
+      CHECK_EQUAL (strlen ("key=value\r\n"), test.stats ().bytes_read - before.bytes_read);
+
+      //compiled image matches the file
+      CHECK (test.Compile ("test.img"));
+      CHECK (test.LoadCompiled ("test.img"));
+      before = test.stats ();
+      CHECK_EQUAL ("value", test.GetString ("key", "section"));
+      CHECK_EQUAL (before.opens, test.stats ().opens);
+      test.LoadCompiled ("");
+      utf8::remove ("test.img");
+
+      //file is rewritten as UTF-8
+      test.PutString ("key", "changed", "section");
+      CHECK_EQUAL ("changed", test.GetString ("key", "section"));
+      CHECK_EQUAL ("v", test.GetString ("k", "other"));
+      utf8::remove ("test.ini");
+    }
+  }
+
+  TEST (Large_file_index)
+  {
+    //large enough to be parsed in parallel
+    utf8::remove ("test.ini");
+    FILE* f = utf8::fopen ("test.ini", "wb");
+    fputs ("orphan=no section\n", f);
+    const int nsect = 200, nkeys = 1000;
+    for (int s = 0; s < nsect; s++)
+    {
+      fprintf (f, "[Section%d]\n; comment\n", s);
+      for (int k = 0; k < nkeys; k++)
+        fprintf (f, "key%d = value of key %d in section %d ........................\n", k, k, s);
+    }
+    fputs ("[section7]\nkey1=repeated section\n", f);
+    fclose (f);
+    CHECK (filesystem::file_size ("test.ini") > 8 * 1024 * 1024);
+
+    utf8::IniFile test ("test.ini");
+    for (int s = 0; s < nsect; s += 13)
+    {
+      for (int k = 0; k < nkeys; k += 97)
+      {
+        char expected[80];
+        snprintf (expected, sizeof (expected), "value of key %d in section %d ........................", k, s);
+        CHECK_EQUAL (expected, test.GetString ("KEY" + to_string (k), "section" + to_string (s)));
+      }
+    }
+    CHECK_EQUAL ("value of key 1 in section 7 ........................", test.GetString ("key1", "section7"));
+    CHECK (!test.HasKey ("orphan", ""));
+    CHECK (!test.HasKey ("key1000", "section0"));
+    test.PutString ("key5", "changed", "section199");
+    CHECK_EQUAL ("changed", test.GetString ("key5", "section199"));
+    utf8::remove ("test.ini");
+  }
+
+#ifndef _WIN32
+  TEST (Shared_snapshot)
+  {
+    utf8::remove ("test.ini");
+    utf8::IniFile::RemoveShared ("utf8_tests_ini");
+    utf8::IniFile writer ("test.ini");
+    writer.PutString ("key", "value", "section");
+    writer.PutString ("other", "value2", "section");
+
+    utf8::IniFile p1 ("test.ini"), p2 ("test.ini");
+    CHECK (p1.EnableShared ("utf8_tests_ini"));  //publishes generation 1
+    CHECK (p2.EnableShared ("/utf8_tests_ini")); //attaches to it
+    CHECK_EQUAL ("value", p2.GetString ("key", "section"));
+    deque<string> keys;
+    CHECK_EQUAL (2, p2.GetKeys (keys, "section"));
+#ifdef __linux__
+    CHECK (filesystem::exists ("/dev/shm/utf8_tests_ini.1"));
+#endif
+
+    //file changes -> new generation
+    writer.PutString ("key", "changed", "section");
+    CHECK_EQUAL ("changed", p2.GetString ("key", "section"));
+    CHECK_EQUAL ("changed", p1.GetString ("key", "section"));
+#ifdef __linux__
+    CHECK (filesystem::exists ("/dev/shm/utf8_tests_ini.2"));
+    CHECK (!filesystem::exists ("/dev/shm/utf8_tests_ini.1"));
+#endif
+
+    CHECK (utf8::IniFile::RemoveShared ("utf8_tests_ini"));
+    utf8::remove ("test.ini");
+  }
+#endif
+
+  TEST (Sax_parser)
+  {
+    struct collector : public utf8::IniHandler {
+      bool section (string_view name, size_t offset) override
+        { events.push_back ("S:" + string (name) + "@" + to_string (offset)); return true; }
+      bool entry (string_view key, string_view value, size_t /*offset*/) override
+        { events.push_back ("E:" + string (key) + "=" + string (value)); return key != "stop"; }
+      bool comment (string_view text, size_t /*offset*/) override
+        { events.push_back ("C:" + string (text)); return true; }
+      vector<string> events;
+    };
+
+    utf8::remove ("test.ini");
+    FILE* f = utf8::fopen ("test.ini", "wb");
+    fputs ("\xEF\xBB\xBF[ first ]\r\n"
+           "; a comment \r\n"
+           "key1 = value1\r\n"
+           "\r\n"
+           "malformed\n"
+           "[second]\n"
+           "key2=", f);
+    fclose (f);
+
+    collector c;
+    CHECK (utf8::ini_parse ("test.ini", c));
+    vector<string> expected{ "S:first@3", "C:a comment", "E:key1=value1", "S:second@55", "E:key2=" };
+    CHECK_EQUAL (expected.size (), c.events.size ());
+    for (size_t i = 0; i < expected.size () && i < c.events.size (); i++)
+      CHECK_EQUAL (expected[i], c.events[i]);
+
+    //lines longer than parsing buffer
+    f = utf8::fopen ("test.ini", "wb");
+    string long_value (100000, 'x');
+    fprintf (f, "[section]\nlong=%s\nstop=here\nnext=not seen\n", long_value.c_str ());
+    fclose (f);
+    collector c2;
+    CHECK (!utf8::ini_parse ("test.ini", c2)); //stopped by handler
+    CHECK_EQUAL (3, c2.events.size ());
+    CHECK_EQUAL ("E:long=" + long_value, c2.events[1]);
+
+    //UTF-16 file longer than parsing buffer
+    f = utf8::fopen ("test.ini", "wb");
+    fwrite ("\xFF\xFE", 1, 2, f);
+    u16string text = u"[section]\n";
+    for (int i = 0; i < 10000; i++)
+      text += u"key=\u00e9t\u00e9 \U0001F600\n";
+    for (char16_t ch : text)
+    {
+      unsigned char bytes[2] = { (unsigned char)(ch & 0xFF), (unsigned char)(ch >> 8) };
+      fwrite (bytes, 1, 2, f);
+    }
+    fclose (f);
+    collector c3;
+    CHECK (utf8::ini_parse ("test.ini", c3));
+    CHECK_EQUAL (10001, c3.events.size ());
+    CHECK_EQUAL ("S:section@0", c3.events[0]);
+    CHECK_EQUAL ("E:key=\xC3\xA9t\xC3\xA9 \xF0\x9F\x98\x80", c3.events.back ());
+    utf8::remove ("test.ini");
+  }
+
+  TEST (Ini_stack)
+  {
+    utf8::IniFile defaults ("defaults.ini"), site ("site.ini"), local ("local.ini");
+    defaults.PutString ("color", "red", "Display");
+    defaults.PutString ("size", "10", "Display");
+    defaults.PutString ("name", "default", "User");
+    site.PutString ("size", "12", "DISPLAY");
+    site.PutString ("name", "site", "User");
+    local.PutString ("Name", "me", "user");
+
+    utf8::IniStack stack{ "defaults.ini", "site.ini" };
+    CHECK (stack.Push (local));
+    CHECK_EQUAL (3, stack.Size ());
+
+    CHECK_EQUAL ("red", stack.GetString ("color", "display"));
+    CHECK_EQUAL ("12", stack.GetString ("size", "Display"));
+    CHECK_EQUAL ("me", stack.GetString (" name ", "User"));
+    CHECK_EQUAL ("none", stack.GetString ("missing", "User", "none"));
+    CHECK_EQUAL (0, stack.Layer ("color", "Display"));
+    CHECK_EQUAL (1, stack.Layer ("size", "Display"));
+    CHECK_EQUAL (2, stack.Layer ("name", "User"));
+    CHECK_EQUAL (-1, stack.Layer ("color", "User"));
+    CHECK (!stack.HasKey ("missing", "User"));
+
+    //changes in a layer are visible through the stack
+    site.DeleteKey ("size", "Display");
+    site.PutString ("color", "blue and green", "Display");
+    CHECK_EQUAL ("10", stack.GetString ("size", "Display"));
+    CHECK_EQUAL ("blue and green", stack.GetString ("color", "Display"));
+    CHECK_EQUAL (1, stack.Layer ("color", "Display"));
+
+    //missing files are empty layers
+    utf8::remove (local.File ());
+    CHECK_EQUAL ("site", stack.GetString ("name", "User"));
+    utf8::remove (defaults.File ());
+    utf8::remove (site.File ());
+    CHECK (!stack.HasKey ("color", "Display"));
+  }
 }
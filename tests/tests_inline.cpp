@@ -0,0 +1,68 @@
+/*
+  Copyright (c) Mircea Neacsu (2014-2024) Licensed under MIT License.
+  This is part of UTF8 project. See LICENSE file for full license terms.
+*/
+
+/*
+  Tests for inline versions of basic functions. The results must be the same
+  as those of the library versions.
+*/
+#define UTF8_HEADER_ONLY
+#include <utpp/utpp.h>
+#include <utf8/utf8.h>
+
+using namespace std;
+
+SUITE (HeaderOnly)
+{
+  TEST (next_prev)
+  {
+    string s{ u8"aα€😃" };
+    const char* p = s.c_str ();
+    CHECK_EQUAL ((int)U'a', (int)utf8::next (p));
+    CHECK_EQUAL ((int)U'α', (int)utf8::next (p));
+    CHECK_EQUAL ((int)U'€', (int)utf8::next (p));
+    CHECK_EQUAL ((int)U'😃', (int)utf8::next (p));
+    CHECK_EQUAL (0, (int)utf8::next (p));
+    CHECK_EQUAL ((int)U'😃', (int)utf8::prev (p));
+    CHECK_EQUAL ((int)U'€', (int)utf8::prev (p));
+
+    auto it = s.cbegin ();
+    utf8::next (it, s.cend ());
+    CHECK_EQUAL ((int)U'α', (int)utf8::next (it, s.cend ()));
+    CHECK_EQUAL ((int)U'α', (int)utf8::prev (it, s.cbegin ()));
+    CHECK_EQUAL (4, utf8::length (s));
+    CHECK_EQUAL (4, utf8::length (s.c_str ()));
+  }
+
+  TEST (encode_same_as_narrow)
+  {
+    for (char32_t c : { U'a', U'ß', U'ᓀ', U'😎', (char32_t)0x10FFFF })
+    {
+      string s;
+      utf8::encode (c, s);
+      CHECK_EQUAL (utf8::narrow (c), s);
+    }
+  }
+
+  TEST (invalid_encodings)
+  {
+    const char* p = "\xC0\x80";
+    CHECK_EQUAL ((int)utf8::REPLACEMENT_CHARACTER, (int)utf8::next (p));
+    CHECK (!utf8::is_valid ("\xFF"));
+
+    auto prev = utf8::error_mode (utf8::action::except);
+    string s;
+    CHECK_THROW_EQUAL (utf8::encode (0x110000, s), utf8::exception (utf8::exception::invalid_char32), utf8::exception);
+    utf8::error_mode (prev);
+  }
+
+  TEST (char_class)
+  {
+    CHECK (utf8::isspace (u8"　"));
+    CHECK (utf8::isblank ("\t"));
+    CHECK (!utf8::isspace ("x"));
+    CHECK (utf8::isdigit ("7"));
+    CHECK (utf8::isupper (u8"Ă"));
+  }
+}
@@ -5,8 +5,10 @@
 #include <utpp/utpp.h>
 #include <utf8/utf8.h>
 #include <iostream>
+#include <sstream>
 #include <filesystem>
 #include <tuple>
+#include <thread>
 
 #if USE_WINDOWS_API
 #include <windows.h>
@@ -551,6 +553,17 @@ TEST (case_conversion_ret)
   CHECK_EQUAL (u8"αλφάβητο", utf8::tolower (u8"ΑΛΦΆΒΗΤΟ"));
 }
 
+//check case folding of single characters
+TEST (case_conversion_char)
+{
+  CHECK_EQUAL ((int)U'a', (int)utf8::tolower (U'A'));
+  CHECK_EQUAL ((int)U'Z', (int)utf8::toupper (U'z'));
+  CHECK_EQUAL ((int)U'1', (int)utf8::toupper (U'1'));
+  CHECK_EQUAL ((int)U'λ', (int)utf8::tolower (U'Λ'));
+  CHECK_EQUAL ((int)U'Ж', (int)utf8::toupper (U'ж'));
+  CHECK_EQUAL ((int)U'日', (int)utf8::tolower (U'日'));
+}
+
 //check case-insensitive comparison
 TEST (icompare_equal)
 {
@@ -720,3 +733,398 @@ TEST (trim)
             u8"\u2006\u2007\u2008\u2009\u200A\u202f\u205f\u3000");
   CHECK_EQUAL (t, u8"MIRCEA NEACȘU ĂÂȚÎ");
 }
+
+#ifdef UTF8_STATS
+TEST (conversion_stats)
+{
+  utf8::collect_stats (true);
+  CHECK (utf8::collect_stats (true));
+
+  auto before = utf8::stats ();
+  auto w = utf8::widen (u8"aβ😃");
+  utf8::narrow (w);
+  utf8::runes (u8"aβ");
+  auto prev = utf8::error_mode (utf8::action::replace);
+  utf8::runes ("a\xC0");
+  utf8::valid_str ("\xC0"); //validity checks are not counted
+  utf8::error_mode (prev);
+  std::thread t ([] { utf8::widen ("xyz"); });
+  t.join ();
+  auto after = utf8::stats ();
+  utf8::collect_stats (false);
+
+  CHECK_EQUAL (7 + 3, after.bytes_in[utf8::conversion_stats::utf8_to_wide]
+                    - before.bytes_in[utf8::conversion_stats::utf8_to_wide]);
+  CHECK_EQUAL ((w.size () + 3) * sizeof (wchar_t),
+               after.bytes_out[utf8::conversion_stats::utf8_to_wide]
+             - before.bytes_out[utf8::conversion_stats::utf8_to_wide]);
+  CHECK_EQUAL (w.size () * sizeof (wchar_t),
+               after.bytes_in[utf8::conversion_stats::wide_to_utf8]
+             - before.bytes_in[utf8::conversion_stats::wide_to_utf8]);
+  CHECK_EQUAL (3 + 2, after.bytes_in[utf8::conversion_stats::utf8_to_utf32]
+                    - before.bytes_in[utf8::conversion_stats::utf8_to_utf32]);
+  CHECK_EQUAL (1, after.replacements[utf8::exception::invalid_utf8]
+                - before.replacements[utf8::exception::invalid_utf8]);
+  CHECK_EQUAL (7, after.ascii_chars - before.ascii_chars);
+  CHECK_EQUAL (6, after.multibyte_chars - before.multibyte_chars);
+
+  //nothing is counted when collection is off
+  utf8::widen ("abc");
+  CHECK_EQUAL (after.ascii_chars, utf8::stats ().ascii_chars);
+}
+#else
+TEST (conversion_stats_disabled)
+{
+  //library built without UTF8_STATS: nothing is collected
+  CHECK (!utf8::collect_stats (true));
+  utf8::widen (u8"aβ");
+  CHECK_EQUAL (0, utf8::stats ().ascii_chars);
+  CHECK (!utf8::collect_stats (false));
+}
+#endif
+
+TEST (vectorized_kernels)
+{
+  string target = utf8::cpu_target ();
+  CHECK (target == "scalar" || target == "sse2" || target == "avx2" || target == "neon");
+
+  //non-ASCII characters at every position of blocks of different sizes
+  for (size_t len = 1; len < 100; len++)
+  {
+    for (size_t pos = 0; pos < len; pos++)
+    {
+      string s (len, 'a');
+      s.replace (pos, 1, u8"ε");
+      u32string expected (len, U'a');
+      expected[pos] = U'ε';
+      CHECK (utf8::runes (s) == expected);
+      CHECK (utf8::widen (s.c_str ()).size () == len);
+      CHECK (utf8::valid_str (s));
+
+      s[pos + 1] = 'x'; //break encoding
+      CHECK (!utf8::valid_str (s));
+    }
+  }
+
+  //long strings are processed in many blocks
+  string text;
+  for (int i = 0; i < 5000; i++)
+    text += u8"aβ€😃";
+  CHECK_EQUAL (utf8::length (text), utf8::runes (text).size ());
+  CHECK_EQUAL (25000, utf8::widen (text).size ());
+}
+
+TEST (constexpr_literals)
+{
+  constexpr auto greek = utf8::literal_wide (u8"ελληνικό");
+  static_assert (greek.size () == 8, "wrong length");
+  static_assert (greek.c_str ()[0] == L'ε' && greek.c_str ()[8] == 0, "wrong conversion");
+  CHECK (greek.view () == utf8::widen (u8"ελληνικό"));
+
+  constexpr auto emoji = utf8::literal_wide (u8"a😃");
+  static_assert (emoji.size () == 3, "no surrogate pair");
+  CHECK (wstring (emoji) == utf8::widen (u8"a😃"));
+
+  constexpr auto r = utf8::literal_runes (u8"aβ€😃");
+  static_assert (r.size () == 4 && r.c_str ()[3] == U'😃', "wrong conversion");
+  CHECK (u32string (r) == utf8::runes (u8"aβ€😃"));
+
+  using namespace std::literals;
+  static_assert (utf8::valid_str (u8"aβ€😃"sv), "valid string");
+  static_assert (!utf8::valid_str ("a\xC0\xAF"sv), "overlong encoding");
+  static_assert (!utf8::valid_str ("\xED\xA0\x80"sv), "surrogate");
+  static_assert (!utf8::valid_str ("ab\xE2\x82"sv), "short encoding");
+
+  //at run time invalid literals throw
+  CHECK_THROW (utf8::literal_wide ("\xC0\xAF"), utf8::exception);
+}
+
+TEST (pmr_conversions)
+{
+  //count allocations from memory resource
+  struct counting_resource : std::pmr::memory_resource {
+    std::pmr::monotonic_buffer_resource arena;
+    int count = 0;
+    void* do_allocate (size_t bytes, size_t align) override
+    {
+      count++;
+      return arena.allocate (bytes, align);
+    }
+    void do_deallocate (void*, size_t, size_t) override {}
+    bool do_is_equal (const memory_resource& other) const noexcept override
+    {
+      return this == &other;
+    }
+  } mr;
+
+  string s = u8"aβ€😃 ΑΒΓ";
+  auto ws = utf8::pmr::widen (s, &mr);
+  CHECK (ws.get_allocator ().resource () == &mr);
+  CHECK (wstring (ws) == utf8::widen (s));
+
+  auto r = utf8::pmr::runes (s, &mr);
+  CHECK (u32string (r) == utf8::runes (s));
+
+  CHECK (utf8::pmr::narrow (ws, &mr) == s.c_str ());
+  CHECK (utf8::pmr::narrow (r, &mr) == s.c_str ());
+  CHECK (utf8::pmr::narrow (U'😃', &mr) == u8"😃");
+  CHECK (utf8::pmr::tolower (s, &mr) == utf8::tolower (s).c_str ());
+  CHECK (utf8::pmr::toupper (s, &mr) == utf8::toupper (s).c_str ());
+  CHECK (mr.count > 0);
+
+  //view that is not null-terminated ends in the middle of a character
+  std::string_view part ("\xC3\xA9xyz", 1);
+  CHECK (utf8::pmr::widen (part, &mr) == L"\xFFFD");
+  CHECK (utf8::pmr::runes (part, &mr) == U"\xFFFD");
+
+  //default resource
+  CHECK (utf8::pmr::tolower (u8"ΑΒΓ") == u8"αβγ");
+}
+
+TEST (scoped_wide_conversions)
+{
+  const wchar_t* first;
+  {
+    utf8::scoped_wide w (u8"ελληνικό");
+    CHECK (w.c_str () == utf8::widen (u8"ελληνικό"));
+    CHECK_EQUAL (8, w.size ());
+    first = w.c_str ();
+  }
+
+  //buffer is reused after the object is destroyed
+  {
+    utf8::scoped_wide w (string (u8"aβ€😃"));
+    CHECK_EQUAL (first, w.c_str ());
+    CHECK (std::wstring_view (w) == utf8::widen (u8"aβ€😃"));
+  }
+
+  //strings remain valid when other strings are added, even in new blocks
+  utf8::scoped_wide w1 ("abc");
+  string big (5000, 'x');
+  {
+    utf8::scoped_wide w2 (big);
+    utf8::scoped_wide w3 ("defgh", 3);
+    CHECK (w2.c_str () == utf8::widen (big));
+    CHECK (w3.c_str () == wstring (L"def"));
+  }
+  CHECK (w1.c_str () == wstring (L"abc"));
+  CHECK (utf8::scoped_wide ("").c_str () == wstring ());
+
+  //space is released if conversion throws
+  const wchar_t* top = utf8::scoped_wide ("x").c_str ();
+  auto prev_mode = utf8::error_mode (utf8::action::except);
+  CHECK_THROW (utf8::scoped_wide ("ab\xC0\xAF"), utf8::exception);
+  utf8::error_mode (prev_mode);
+  CHECK_EQUAL (top, utf8::scoped_wide ("x").c_str ());
+}
+
+TEST (column_conversions)
+{
+  //column with a leading offset, as in a slice
+  string data = u8"--abcαβγ😃x\xC0\xAFyz";
+  vector<int32_t> offsets{ 2, 5, 11, 15, 15, 20 };
+  size_t rows = offsets.size () - 1;
+
+  vector<utf8::row_error> errors;
+  CHECK (!utf8::valid_column (data.data (), offsets.data (), rows, &errors));
+  CHECK_EQUAL (1, errors.size ());
+  CHECK_EQUAL (4, errors[0].row);
+  CHECK_EQUAL (1, errors[0].position);
+
+  vector<size_t> lengths;
+  CHECK_EQUAL (3 + 3 + 1 + 0 + 4, utf8::length_column (data.data (), offsets.data (), rows, lengths));
+  CHECK_EQUAL (3, lengths[1]);
+
+  wstring w;
+  vector<int32_t> woff;
+  CHECK (!utf8::widen_column (data.data (), offsets.data (), rows, w, woff, &errors));
+  CHECK_EQUAL (1, errors.size ());
+  u32string r;
+  vector<int32_t> roff;
+  CHECK (!utf8::runes_column (data.data (), offsets.data (), rows, r, roff));
+  for (size_t i = 0; i < rows; i++)
+  {
+    string row = data.substr (offsets[i], offsets[i + 1] - offsets[i]);
+    CHECK (w.substr (woff[i], woff[i + 1] - woff[i]) == utf8::widen (row));
+    CHECK (r.substr (roff[i], roff[i + 1] - roff[i]) == utf8::runes (row));
+  }
+  CHECK_EQUAL (0, woff[0]);
+  CHECK_EQUAL (w.size (), woff[rows]);
+
+  //back to UTF-8; last row now has a replacement character
+  string n;
+  vector<int32_t> noff;
+  CHECK (utf8::narrow_column (w.data (), woff.data (), rows, n, noff, &errors));
+  CHECK (errors.empty ());
+  CHECK_EQUAL (u8"abcαβγ😃x�yz", n);
+  CHECK (utf8::narrow_column (r.data (), roff.data (), rows, n, noff));
+  CHECK_EQUAL (u8"abcαβγ😃x�yz", n);
+
+  //invalid wide characters
+  wstring bad = L"ab\xD800" L"c";
+  vector<int32_t> boff{ 0, 2, 4 };
+  CHECK (!utf8::narrow_column (bad.data (), boff.data (), 2, n, noff, &errors));
+  CHECK_EQUAL (1, errors[0].row);
+  CHECK_EQUAL (0, errors[0].position);
+  CHECK_EQUAL (u8"ab�c", n);
+
+  //ASCII column
+  string ascii = "onetwothree";
+  vector<int32_t> aoff{ 0, 3, 6, 11 };
+  CHECK (utf8::valid_column (ascii.data (), aoff.data (), 3));
+  CHECK (utf8::widen_column (ascii.data (), aoff.data (), 3, w, woff));
+  CHECK (w == L"onetwothree");
+  CHECK (woff == aoff);
+}
+
+TEST (mapped_text_file)
+{
+  const size_t chunk = 1024 * 1024;
+  auto write = [] (const string& content) {
+    utf8::ofstream f ("mapped.txt", ios::binary);
+    f << content;
+  };
+
+  //characters across chunk boundaries
+  string text (chunk - 1, 'a');
+  text += u8"😃";
+  text += string (chunk, 'b');
+  text += u8"αβγ";
+  write (u8"\xEF\xBB\xBF" + text);
+  {
+    utf8::mapped_text m ("mapped.txt");
+    CHECK (m.is_open ());
+    CHECK (m.bom () == utf8::mapped_text::bom_type::utf8);
+    CHECK (m.view () == text);
+    CHECK (m.valid (0, 10));
+    CHECK (m.valid ());
+  }
+
+  //invalid character in last chunk is found only when validating that chunk
+  text.back () = 'x';
+  write (text);
+  {
+    utf8::mapped_text m ("mapped.txt");
+    CHECK (m.bom () == utf8::mapped_text::bom_type::none);
+    CHECK_EQUAL (text.size (), m.size ());
+    CHECK (m.valid (0, chunk));
+    CHECK (!m.valid (2 * chunk, 10));
+    CHECK (!m.valid ());
+  }
+
+  //stray continuation byte at beginning of chunk
+  text = string (chunk, 'a') + "\x80" + "bcd";
+  write (text);
+  CHECK (!utf8::mapped_text ("mapped.txt").valid ());
+
+  write ("\xFF\xFE" "a");
+  {
+    utf8::mapped_text m ("mapped.txt");
+    CHECK (m.bom () == utf8::mapped_text::bom_type::utf16le);
+    CHECK (m.view () == "a");
+  }
+  utf8::remove ("mapped.txt");
+
+  utf8::mapped_text m;
+  CHECK (!m.open ("mapped.txt"));
+  CHECK (!m.is_open ());
+  CHECK (m.view ().empty ());
+}
+
+TEST (transcoding_streams)
+{
+  //long enough to need several buffer refills
+  string text;
+  for (int i = 0; i < 20000; i++)
+    text += u8"aβ€😃\n";
+
+  const utf8::file_encoding encodings[] = {
+    utf8::file_encoding::utf16le, utf8::file_encoding::utf16be,
+    utf8::file_encoding::utf32le, utf8::file_encoding::utf32be
+  };
+  for (auto enc : encodings)
+  {
+    {
+      utf8::ofstream out ("transcode.txt", ios::out, enc);
+      CHECK (out.is_open ());
+      out << text;
+    }
+
+    //check file content
+    string raw;
+    {
+      utf8::ifstream in ("transcode.txt", ios::binary);
+      raw.assign (istreambuf_iterator<char> (in), istreambuf_iterator<char> ());
+    }
+    if (enc == utf8::file_encoding::utf16le)
+    {
+      wstring w = utf8::widen (text);
+      CHECK_EQUAL (w.size () * 2, raw.size ());
+      CHECK (raw.substr (0, 4) == string ("a\0\xB2\x03", 4));
+    }
+    else if (enc == utf8::file_encoding::utf32be)
+    {
+      CHECK_EQUAL (utf8::runes (text).size () * 4, raw.size ());
+      CHECK (raw.substr (12, 4) == string ("\0\x01\xF6\x03", 4));
+    }
+
+    utf8::ifstream in ("transcode.txt", ios::in, enc);
+    string line, back;
+    while (getline (in, line))
+      back += line + '\n';
+    CHECK (back == text);
+  }
+
+  //ASCII runs of different lengths between non-ASCII characters
+  string runs;
+  for (size_t len = 1; len < 70; len++)
+  {
+    for (size_t pos = 0; pos < len; pos++)
+    {
+      string s (len, 'a');
+      s.replace (pos, 1, u8"β");
+      runs += s + '\n';
+    }
+  }
+  for (auto enc : { utf8::file_encoding::utf16le, utf8::file_encoding::utf16be })
+  {
+    {
+      utf8::ofstream out ("transcode.txt", ios::out, enc);
+      out << runs;
+    }
+    utf8::ifstream in ("transcode.txt", ios::in, enc);
+    stringstream ss;
+    ss << in.textbuf ();
+    CHECK (ss.str () == runs);
+  }
+
+  //invalid encodings are replaced
+  {
+    //lone low surrogate and incomplete code unit at end of file
+    utf8::ofstream out ("transcode.txt", ios::binary);
+    out.write ("\x41\x00\x00\xDC\x42", 5);
+  }
+  {
+    utf8::ifstream in ("transcode.txt", ios::in, utf8::file_encoding::utf16le);
+    string s;
+    getline (in, s);
+    CHECK_EQUAL (u8"A��", s);
+  }
+
+  //textbuf returns the transcoding buffer; rdbuf remains the file buffer
+  {
+    utf8::ofstream out;
+    out = utf8::ofstream ("transcode.txt", ios::out, utf8::file_encoding::utf16le);
+    out << text;
+  }
+  {
+    utf8::ifstream in;
+    in = utf8::ifstream ("transcode.txt", ios::in, utf8::file_encoding::utf16le);
+    CHECK (in.is_open ());
+    CHECK (in.rdbuf ()->is_open ());
+    stringstream ss;
+    ss << in.textbuf ();
+    CHECK (ss.str () == text);
+  }
+  utf8::remove ("transcode.txt");
+}